@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _AGGREGATOR_H
+#define _AGGREGATOR_H
+
+#include <openvizsla.h>
+#include <usb.h>
+
+#include <stdint.h>
+
+/* NAK runs of different endpoints kept at the same time */
+#define AGGREGATOR_MAX_RUNS 16
+/* Bounds the delay of summaries on an idle bus, about 1 s of full speed SOFs */
+#define AGGREGATOR_MAX_COUNT 1000
+
+struct aggregator_run {
+	int active;
+	uint8_t type;
+	uint8_t address;
+	uint8_t endpoint;
+	uint32_t count;
+	uint16_t first_frame;
+	uint16_t last_frame;
+	uint64_t first_ts;
+	uint64_t last_ts;
+};
+
+struct ov_aggregator {
+	int flags;
+	ov_packet_decoder_callback callback;
+	void* user_data;
+
+	struct aggregator_run sof;
+	struct aggregator_run runs[AGGREGATOR_MAX_RUNS];
+
+	/* IN or PING token waiting for its handshake */
+	int token_held;
+	union {
+		struct ov_packet packet;
+		uint8_t data[sizeof(struct ov_packet) + USB_TOKEN_SIZE];
+	} token;
+
+	union {
+		struct ov_packet packet;
+		uint8_t data[sizeof(struct ov_packet) + sizeof(struct ov_summary)];
+	} summary;
+};
+
+ov_packet_decoder_callback aggregator_set_callback(struct ov_aggregator* agg, ov_packet_decoder_callback callback, void* user_data);
+
+#endif // _AGGREGATOR_H
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _AIO_WRITER_H
+#define _AIO_WRITER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AIO_DIRECT 0x01 /* Bypass the page cache when the filesystem allows it */
+#define AIO_THREAD 0x02 /* Do not try io_uring */
+
+/* Alignment of buffers, file offsets and lengths for O_DIRECT */
+#define AIO_ALIGN 4096
+
+/* A file is closed once it is marked closing and its last write is done,
+ * which covers short writes resubmitted out of order */
+struct aio_file {
+	int fd;
+	/* Written size, the file is truncated to it on close */
+	uint64_t size;
+	size_t writes;
+	int closing;
+};
+
+struct aio_buffer {
+	uint8_t* data;
+	struct aio_file* file;
+	uint64_t offset;
+	size_t length;
+	size_t done;
+	/* Last buffer of the file */
+	int close;
+
+	struct aio_buffer* next;
+};
+
+struct aio_uring;
+
+/* Writes buffers from a fixed pool in the background, either by io_uring
+ * or by a writer thread using pwrite(). The producer side is not thread
+ * safe and is expected to be driven by a single thread. */
+struct aio_writer {
+	unsigned int flags;
+	size_t buf_size;
+	size_t buf_count;
+	uint8_t* memory;
+	struct aio_buffer* buffers;
+
+	/* Current file */
+	struct aio_file* file;
+	int direct;
+	uint64_t offset;
+
+	struct aio_uring* uring;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct aio_buffer* free_list;
+	struct aio_buffer* queue_head;
+	struct aio_buffer* queue_tail;
+	size_t in_flight;
+	int stop;
+
+	const char* error_str;
+};
+
+int aio_writer_init(struct aio_writer* aw, size_t buf_count, size_t buf_size, unsigned int flags);
+int aio_writer_open(struct aio_writer* aw, const char* filename, uint64_t prealloc);
+struct aio_buffer* aio_writer_get_buffer(struct aio_writer* aw);
+int aio_writer_submit(struct aio_writer* aw, struct aio_buffer* buffer, size_t length);
+int aio_writer_close(struct aio_writer* aw, struct aio_buffer* buffer, size_t length);
+int aio_writer_wait(struct aio_writer* aw);
+void aio_writer_destroy(struct aio_writer* aw);
+int aio_writer_is_uring(struct aio_writer* aw);
+
+#endif // _AIO_WRITER_H
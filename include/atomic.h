@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _ATOMIC_H
+#define _ATOMIC_H
+
+#include <stddef.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Sequentially consistent operations on long counters and pointers. They
+ * are lock-free, so may be used from a signal handler. */
+
+#ifdef _MSC_VER
+static inline long atomic_inc(volatile long* p) {
+	return _InterlockedIncrement(p);
+}
+
+static inline long atomic_dec(volatile long* p) {
+	return _InterlockedDecrement(p);
+}
+
+static inline long atomic_load_long(volatile long* p) {
+	return _InterlockedCompareExchange(p, 0, 0);
+}
+
+static inline void atomic_store_long(volatile long* p, long v) {
+	_InterlockedExchange(p, v);
+}
+
+static inline void* atomic_load_ptr(void* volatile* p) {
+	return _InterlockedCompareExchangePointer(p, NULL, NULL);
+}
+
+static inline void* atomic_exchange_ptr(void* volatile* p, void* v) {
+	return _InterlockedExchangePointer(p, v);
+}
+
+static inline int atomic_cas_ptr(void* volatile* p, void* expected, void* desired) {
+	return _InterlockedCompareExchangePointer(p, desired, expected) == expected;
+}
+#else
+static inline long atomic_inc(volatile long* p) {
+	return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline long atomic_dec(volatile long* p) {
+	return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline long atomic_load_long(volatile long* p) {
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_store_long(volatile long* p, long v) {
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline void* atomic_load_ptr(void* volatile* p) {
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void* atomic_exchange_ptr(void* volatile* p, void* v) {
+	return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_cas_ptr(void* volatile* p, void* expected, void* desired) {
+	return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+#endif // _ATOMIC_H
@@ -5,27 +5,52 @@
 
 #include <decoder.h>
 #include <ftdi.h>
+#include <histogram.h>
 #include <openvizsla.h>
+#include <pool.h>
+#include <record.h>
 #include <reg.h>
+#include <timestamp.h>
+#include <usbstat.h>
 
 #include <stdint.h>
 #include <memory.h>
 
+struct pollfd;
+
 struct cha {
 	struct ftdi_context ftdi;
 	struct reg reg;
+	/* SDRAM ring shared by SDRAM SINK and SDRAM HOST READ */
+	uint32_t ring_base;
+	uint32_t ring_end;
+	/* Accounting of the control path, may be NULL */
+	struct usbstat* usbstat;
 	const char* error_str;
 };
 
+#define CHA_LOOP_TRANSFER_COUNT 3
+#define CHA_LOOP_REQUEST_COUNT 16
+#define CHA_LOOP_REQUEST_TIMEOUT_MS 1000
+#define CHA_LOOP_BUFFER_SIZE 4096
+#define CHA_LOOP_LOAD_INTERVAL_MS 100
+
 struct cha_loop {
 	struct cha* cha;
 	struct frame_decoder fd;
-	struct libusb_transfer* transfer[3];
+	struct libusb_transfer* transfer[CHA_LOOP_TRANSFER_COUNT];
 	size_t active_transfers;
 
 	ov_packet_decoder_callback callback;
 	void* user_data;
 
+	/* Packets are decoded into pool slots when set */
+	struct packet_pool* pool;
+	/* Packets are decoded in place into records when set */
+	struct record_buffer* records;
+
+	struct timestamp ts;
+
 	int count;
 	int max_count;
 	enum cha_loop_state {
@@ -37,6 +62,82 @@ struct cha_loop {
 		HOST_READ_OFF = 5
 	} state;
 	int complete;
+	/* Transfers stay in flight when the loop returns */
+	int persistent;
+
+	/* Set by cha_loop_break() from any thread or signal handler, and
+	 * applied by the loop thread. The wakeup fd interrupts poll(). */
+	volatile long break_requested;
+	int wakeup_fd[2];
+	struct pollfd* pollfds;
+	size_t pollfd_count;
+
+	/* Forwarded changes of pollfds, the wakeup fd stays the last one */
+	ov_pollfd_added_callback pollfd_added;
+	ov_pollfd_removed_callback pollfd_removed;
+	void* pollfd_user_data;
+
+	/* SDRAM pointers are requested with bus frames and the replies are
+	 * taken from the stream, most significant byte first */
+	struct cha_backlog {
+		int interval_ms;
+		uint64_t next_ns;
+		uint32_t wptr;
+		uint32_t rptr;
+		uint32_t threshold;
+		struct ov_backlog stats;
+		ov_backlog_callback callback;
+		void* user_data;
+	} backlog;
+
+	/* In-band register requests, only the first one is in flight and it
+	 * is completed by the bus frame from request_addr */
+	struct cha_request {
+		enum cha_request_type {
+			CHA_REQUEST_READ,
+			CHA_REQUEST_WRITE,
+			CHA_REQUEST_ULPI_READ,
+			CHA_REQUEST_ULPI_WRITE
+		} type;
+		uint16_t addr;
+		uint8_t value;
+		int step;
+		ov_register_callback callback;
+		void* user_data;
+	} requests[CHA_LOOP_REQUEST_COUNT];
+	size_t request_first;
+	size_t request_count;
+	int request_sent;
+	uint16_t request_addr;
+	uint64_t request_deadline_ns;
+
+	/* Session boundary of cha_loop_rearm(), drained when the sampled
+	 * SDRAM pointers are equal */
+	struct cha_rearm {
+		enum cha_rearm_state {
+			CHA_REARM_IDLE,
+			CHA_REARM_PAUSING,
+			CHA_REARM_DRAINING
+		} state;
+		int sampling;
+		uint64_t deadline_ns;
+		ov_session_callback callback;
+		void* user_data;
+	} rearm;
+
+	/* Per transfer timing, callback_ns accumulates the callbacks of the
+	 * transfer being decoded */
+	struct cha_latency {
+		int enabled;
+		int budget_percent;
+		ov_consumer_load_callback callback;
+		void* user_data;
+		uint64_t callback_ns;
+		uint64_t window_start_ns;
+		struct ov_consumer_load load;
+		int slow;
+		struct histogram histogram[2];
+	} latency;
 };
 
 int cha_init(struct cha* cha, struct fwpkg* fwpkg);
@@ -52,6 +153,7 @@ int cha_write_ulpi(struct cha* cha, uint8_t addr, uint8_t val);
 int cha_read_ulpi(struct cha* cha, uint8_t addr, uint8_t* val);
 int cha_get_usb_speed(struct cha* cha, enum ov_usb_speed* speed);
 int cha_set_usb_speed(struct cha* cha, enum ov_usb_speed speed);
+int cha_set_sdram_ring(struct cha* cha, uint32_t base, uint32_t size);
 int cha_start_stream(struct cha* cha);
 int cha_halt_stream(struct cha* cha);
 int cha_stop_stream(struct cha* cha);
@@ -60,6 +162,25 @@ void cha_destroy(struct cha* cha);
 
 int cha_loop_init(struct cha_loop* loop, struct cha* cha, struct ov_packet* packet, size_t packet_size, ov_packet_decoder_callback callback, void* user_data);
 int cha_loop_run(struct cha_loop* loop, int count);
+int cha_loop_run_timeout(struct cha_loop* loop, int count, int timeout_ms);
+void cha_loop_set_timestamp_mode(struct cha_loop* loop, enum ov_timestamp_mode mode);
+void cha_loop_set_filter(struct cha_loop* loop, const struct filter* filter);
+void cha_loop_set_validation(struct cha_loop* loop, int enable);
+void cha_loop_set_snaplen(struct cha_loop* loop, size_t snaplen);
+int cha_loop_set_pool(struct cha_loop* loop, struct packet_pool* pool);
+void cha_loop_set_records(struct cha_loop* loop, struct record_buffer* records);
+int cha_loop_get_pollfds(struct cha_loop* loop, struct ov_pollfd* pollfds, size_t count);
+void cha_loop_set_backlog_monitor(struct cha_loop* loop, int interval_ms, uint32_t threshold, ov_backlog_callback callback, void* user_data);
+void cha_loop_get_backlog(struct cha_loop* loop, struct ov_backlog* backlog);
+void cha_loop_set_latency_monitor(struct cha_loop* loop, int enable, int budget_percent, ov_consumer_load_callback callback, void* user_data);
+void cha_loop_reset_latency(struct cha_loop* loop);
+int cha_loop_request(struct cha_loop* loop, enum cha_request_type type, uint16_t addr, uint8_t value, ov_register_callback callback, void* user_data);
+void cha_loop_abort_requests(struct cha_loop* loop);
+int cha_loop_pause(struct cha_loop* loop);
+int cha_loop_resume(struct cha_loop* loop);
+int cha_loop_rearm(struct cha_loop* loop, ov_session_callback callback, void* user_data);
+void cha_loop_set_pollfd_notifiers(struct cha_loop* loop, ov_pollfd_added_callback added, ov_pollfd_removed_callback removed, void* user_data);
+int cha_loop_get_timeout(struct cha_loop* loop);
 ov_packet_decoder_callback cha_loop_set_callback(struct cha_loop* loop, ov_packet_decoder_callback callback, void* user_data);
 void cha_loop_break(struct cha_loop* loop);
 void cha_loop_destroy(struct cha_loop* loop);
@@ -4,11 +4,14 @@
 #define _CHB_H
 
 #include <ftdi.h>
+#include <usbstat.h>
 
 #include <stdint.h>
 
 struct chb {
 	struct ftdi_context ftdi;
+	/* Accounting of the control path, may be NULL */
+	struct usbstat* usbstat;
 	const char* error_str;
 };
 
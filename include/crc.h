@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _CRC_H
+#define _CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openvizsla.h>
+
+/* USB CRCs as defined in Universal Serial Bus Specification Revision 2.0,
+ * Section 8.3.5. Both are transmitted LSb first, so the reflected forms
+ * of the polynomials are used.
+ */
+
+uint8_t crc5_usb(const uint8_t* data, size_t bits);
+uint16_t crc16_usb(const uint8_t* data, size_t size);
+
+/* Returns non-zero when the packet is damaged */
+int crc_check_packet(const struct ov_packet* packet);
+
+#endif // _CRC_H
@@ -6,6 +6,7 @@
 #include <memory.h>
 #include <stdint.h>
 
+#include <filter.h>
 #include <openvizsla.h>
 
 struct decoder_ops {
@@ -19,6 +20,17 @@ struct packet_decoder {
 	struct decoder_ops ops;
 	void* user_data;
 
+	/* Filter of the current packet, next_filter is taken at the next one */
+	const struct filter* filter;
+	const struct filter* next_filter;
+	int filter_pending;
+	size_t filter_length;
+	size_t skip_length;
+	int validate;
+	size_t snaplen;
+	/* Data bytes of the current packet in the stream */
+	size_t packet_length;
+
 	uint64_t cumulative_ts;
 	int ts_byte;
 	int ts_length;
@@ -28,7 +40,8 @@ struct packet_decoder {
 		NEED_PACKET_LENGTH_LO,
 		NEED_PACKET_LENGTH_HI,
 		NEED_PACKET_TIMESTAMP,
-		NEED_PACKET_DATA
+		NEED_PACKET_DATA,
+		SKIP_PACKET_DATA
 	} state;
 
 	size_t buf_actual_length;
@@ -39,6 +52,11 @@ struct packet_decoder {
 
 int packet_decoder_init(struct packet_decoder* pd, struct ov_packet* p, size_t size, const struct decoder_ops* ops, void* user_data);
 int packet_decoder_proc(struct packet_decoder* pd, uint8_t* buf, size_t size);
+void packet_decoder_set_filter(struct packet_decoder* pd, const struct filter* filter);
+void packet_decoder_set_validation(struct packet_decoder* pd, int enable);
+void packet_decoder_set_snaplen(struct packet_decoder* pd, size_t snaplen);
+void packet_decoder_set_packet(struct packet_decoder* pd, struct ov_packet* p, size_t size);
+void packet_decoder_reset_timestamp(struct packet_decoder* pd);
 
 struct frame_decoder {
 	struct packet_decoder pd;
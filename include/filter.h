@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <openvizsla.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILTER_MAX_INSN 256
+#define FILTER_MAX_STACK 32
+#define FILTER_MAX_NESTING 64
+
+/* Value of addr, endp and dir for packets other than tokens */
+#define FILTER_NONE UINT32_C(0xffffffff)
+
+enum filter_op {
+	FILTER_OP_PUSH,
+	FILTER_OP_PID,
+	FILTER_OP_ADDR,
+	FILTER_OP_ENDP,
+	FILTER_OP_DIR,
+	FILTER_OP_SIZE,
+	FILTER_OP_FLAGS,
+	FILTER_OP_DATA,
+	FILTER_OP_BITAND,
+	FILTER_OP_EQ,
+	FILTER_OP_NE,
+	FILTER_OP_LT,
+	FILTER_OP_LE,
+	FILTER_OP_GT,
+	FILTER_OP_GE,
+	FILTER_OP_NOT,
+	/* Short circuit: jump if the top is false (true), pop it otherwise */
+	FILTER_OP_JFALSE,
+	FILTER_OP_JTRUE,
+	FILTER_OP_RET
+};
+
+struct filter_insn {
+	uint8_t op;
+	uint32_t arg;
+};
+
+/* Stack machine program. Empty program accepts everything. */
+struct filter {
+	struct filter_insn insn[FILTER_MAX_INSN];
+	size_t length;
+	/* Number of leading payload bytes the program looks at */
+	size_t data_length;
+
+	const char* error_str;
+};
+
+void filter_init(struct filter* filter);
+int filter_compile(struct filter* filter, const char* expr);
+int filter_match(const struct filter* filter, const struct ov_packet* packet);
+
+#endif // _FILTER_H
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Log-linear histogram in the style of HdrHistogram. Values below
+ * HISTOGRAM_SUB_COUNT are exact, larger ones fall into buckets of
+ * HISTOGRAM_SUB_COUNT / 2 per power of two, so the relative error stays
+ * below 2 / HISTOGRAM_SUB_COUNT over the whole 64-bit range.
+ */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_HALF_COUNT + HISTOGRAM_HALF_COUNT)
+
+struct histogram {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t total;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_reset(struct histogram* h);
+void histogram_record(struct histogram* h, uint64_t value);
+/* Highest value equivalent to the given percentile, 0 when empty */
+uint64_t histogram_percentile(const struct histogram* h, double percentile);
+
+#endif // _HISTOGRAM_H
@@ -13,6 +13,9 @@ extern "C" {
 #endif
 
 struct ov_device;
+struct ov_reassembler;
+struct ov_aggregator;
+struct ov_sink;
 
 #ifdef _MSC_VER
 #pragma pack(push, 1)
@@ -28,6 +31,7 @@ ov_packet {
 	uint8_t flags;
 	uint16_t size;
 	uint64_t timestamp;
+	uint16_t captured;  /* Bytes in data, only when OV_FLAGS_SNAPPED is set */
 	uint8_t  data[];
 };
 #ifdef _MSC_VER
@@ -36,6 +40,82 @@ ov_packet {
 
 typedef void (*ov_packet_decoder_callback)(struct ov_packet*, void*);
 
+struct ov_pollfd {
+	int fd;
+	short events;  /* POLLIN, POLLOUT */
+};
+
+/* Data written to the SDRAM ring by the device and not read by the host yet */
+struct ov_backlog {
+	uint32_t current;
+	uint32_t high_water;
+	uint32_t ring_size;
+	uint64_t samples;
+};
+
+typedef void (*ov_backlog_callback)(const struct ov_backlog* backlog, void* user_data);
+
+/* Public calls with USB round trip accounting */
+enum ov_call {
+	OV_CALL_OPEN          = 0,
+	OV_CALL_SET_USB_SPEED = 1,
+	OV_CALL_CAPTURE_START = 2,
+	OV_CALL_CAPTURE_STOP  = 3,
+	OV_CALL_LOAD_FIRMWARE = 4,
+	OV_CALL_COUNT
+};
+
+/* USB traffic of the control path during calls, times are in ns. Reads
+ * include empty reads while polling for a reply. */
+struct ov_call_stats {
+	uint64_t calls;
+	uint64_t writes;
+	uint64_t reads;
+	uint64_t empty_reads;
+	uint64_t round_trips;
+	uint64_t bytes_written;
+	uint64_t bytes_read;
+	uint64_t usb_ns;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+enum ov_latency_kind {
+	OV_LATENCY_CALLBACK = 0,  /* User callbacks per transfer */
+	OV_LATENCY_DECODE   = 1   /* Decoding per transfer, without callbacks */
+};
+
+struct ov_latency {
+	uint64_t count;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t mean_ns;
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+};
+
+/* Time spent on the data which arrived during interval_ns */
+struct ov_consumer_load {
+	uint64_t interval_ns;
+	uint64_t bytes;
+	uint64_t callback_ns;
+	uint64_t decode_ns;
+	int slow;  /* The budget is exceeded */
+};
+
+typedef void (*ov_consumer_load_callback)(const struct ov_consumer_load* load, void* user_data);
+
+/* Status is -1 when the request was aborted or timed out */
+typedef void (*ov_register_callback)(int status, uint8_t value, void* user_data);
+
+/* Status is -1 when the capture stopped before the session ended */
+typedef void (*ov_session_callback)(int status, void* user_data);
+
+typedef void (*ov_pollfd_added_callback)(int fd, short events, void* user_data);
+typedef void (*ov_pollfd_removed_callback)(int fd, void* user_data);
+
 enum ov_usb_speed {
 	OV_LOW_SPEED  = 0x4a,
 	OV_FULL_SPEED = 0x49,
@@ -47,13 +127,179 @@ enum ov_usb_speed {
 #define OV_FLAGS_HF0_TRUNC 0x08
 #define OV_FLAGS_HF0_FIRST 0x10
 #define OV_FLAGS_HF0_LAST  0x20
+#define OV_FLAGS_BAD_CRC   0x40 /* Set by ov_packet_validate() */
+#define OV_FLAGS_SNAPPED   0x80 /* Data is cut at snaplen, captured holds its length */
 
 #define OV_MAX_PACKET_SIZE 1027
 
+/* SDRAM of the board, the device buffers the stream in a ring within it */
+#define OV_SDRAM_SIZE              0x02000000
+#define OV_SDRAM_RING_DEFAULT_SIZE 0x01000000
+#define OV_SDRAM_RING_ALIGN        0x00010000
+
+#define OV_TIMESTAMP_FREQ_HZ 60000000
+
+enum ov_timestamp_mode {
+	OV_TIMESTAMP_RAW       = 0, /* OV_TIMESTAMP_FREQ_HZ ticks since capture start */
+	OV_TIMESTAMP_REALTIME  = 1, /* Nanoseconds since the Epoch */
+	OV_TIMESTAMP_MONOTONIC = 2  /* Nanoseconds of the host monotonic clock */
+};
+
 static inline uint16_t ov_packet_captured_size(struct ov_packet* p) {
+    if (p->flags & OV_FLAGS_SNAPPED)
+        return p->captured;
+
     return (p->flags & OV_FLAGS_HF0_TRUNC) ? OV_MAX_PACKET_SIZE : p->size;
 }
 
+/* Native record with a naturally aligned header, records are laid out back
+ * to back in a buffer with the payload padded to OV_RECORD_ALIGN bytes */
+struct ov_record {
+	uint64_t timestamp;
+	uint16_t size;     /* Size of the packet on the bus */
+	uint16_t captured; /* Bytes stored in data */
+	uint8_t  flags;
+	uint8_t  pid;      /* First byte of the packet, 0 for empty packets */
+	uint8_t  addr;     /* Token fields or OV_RECORD_NONE */
+	uint8_t  endp;
+	uint8_t  data[];
+};
+
+#define OV_RECORD_ALIGN 8
+#define OV_RECORD_NONE  0xff
+
+static inline size_t ov_record_size(const struct ov_record* r) {
+	return (sizeof(struct ov_record) + r->captured + OV_RECORD_ALIGN - 1) & ~(size_t)(OV_RECORD_ALIGN - 1);
+}
+
+static inline const struct ov_record* ov_record_next(const struct ov_record* r) {
+	return (const struct ov_record*)((const uint8_t*)r + ov_record_size(r));
+}
+
+/* Records stay valid until the callback returns */
+typedef void (*ov_record_callback)(const struct ov_record* records, size_t size, size_t count, void* user_data);
+
+enum ov_sink_format {
+	OV_SINK_PCAP   = 0, /* Nanosecond pcap */
+	OV_SINK_PCAPNG = 1
+};
+
+#define OV_SINK_ASYNC_DIRECT 0x01 /* Use O_DIRECT when the filesystem allows it */
+
+struct ov_sink_segment {
+	uint32_t sequence;  /* Rotation number, segments are ordered by it */
+	uint64_t first_ts;
+	uint64_t last_ts;
+	uint64_t packets;
+	uint64_t size;
+};
+
+enum ov_trigger_type {
+	OV_TRIGGER_PID      = 0, /* Packet with the given PID byte */
+	OV_TRIGGER_ENDPOINT = 1, /* Token addressed to the given address and endpoint */
+	OV_TRIGGER_PATTERN  = 2, /* Packet data matching the pattern under the mask */
+	OV_TRIGGER_ERROR    = 3  /* Packet with OV_FLAGS_HF0_ERR */
+};
+
+#define OV_TRIGGER_ANY_ENDPOINT 0xff
+#define OV_TRIGGER_ANY_OFFSET   (-1)
+
+struct ov_trigger {
+	enum ov_trigger_type type;
+	uint8_t pid;
+	uint8_t address;
+	uint8_t endpoint;
+	const uint8_t* pattern;
+	const uint8_t* mask;  /* NULL to compare all bits */
+	size_t pattern_size;
+	int offset;           /* Offset of the pattern in the packet or OV_TRIGGER_ANY_OFFSET */
+};
+
+enum ov_split {
+	OV_SPLIT_NONE     = 0,
+	OV_SPLIT_START    = 1,
+	OV_SPLIT_COMPLETE = 2
+};
+
+struct ov_transaction {
+	uint64_t timestamp;   /* Timestamp of the token */
+	uint8_t token;        /* IN, OUT, SETUP or PING PID */
+	uint8_t address;
+	uint8_t endpoint;
+	uint8_t data_pid;     /* 0 when there is no data packet */
+	uint8_t handshake;    /* 0 when there is no handshake, e.g. isochronous */
+	uint8_t split;        /* enum ov_split */
+	uint8_t split_hub;
+	uint8_t split_port;
+	uint16_t data_size;
+	const uint8_t* data;  /* Payload without PID and CRC16 */
+};
+
+enum ov_transfer_status {
+	OV_TRANSFER_COMPLETE = 0,
+	OV_TRANSFER_STALL    = 1,
+	OV_TRANSFER_PARTIAL  = 2  /* Transfer buffer is full, aborted or flushed */
+};
+
+struct ov_transfer {
+	uint64_t first_ts;
+	uint64_t last_ts;
+	uint8_t address;
+	uint8_t endpoint;
+	uint8_t direction;    /* 1 for IN */
+	uint8_t control;      /* Non-zero when setup is valid */
+	uint8_t setup[8];
+	enum ov_transfer_status status;
+	size_t size;
+	const uint8_t* data;
+};
+
+/* Synthetic packet standing for a run of SOFs or NAKed tokens. Its data is
+ * struct ov_summary starting with a reserved PID, so it is never taken for
+ * bus traffic, and the timestamp is the one of the first packet. */
+#define OV_PACKET_MAGIC_SUMMARY 0xa8
+
+#define OV_AGGREGATE_SOF 0x01 /* Runs of SOFs */
+#define OV_AGGREGATE_NAK 0x02 /* IN/NAK and PING/NAK per endpoint */
+
+enum ov_summary_type {
+	OV_SUMMARY_SOF      = 1,
+	OV_SUMMARY_IN_NAK   = 2,
+	OV_SUMMARY_PING_NAK = 3
+};
+
+#ifdef _MSC_VER
+#pragma pack(push, 1)
+#endif
+struct
+#ifdef __GNUC__
+	__attribute__((packed))
+#endif
+ov_summary {
+	uint8_t  pid;            /* 0xf0 */
+	uint8_t  type;           /* enum ov_summary_type */
+	uint8_t  address;        /* NAK runs only */
+	uint8_t  endpoint;
+	uint32_t count;          /* Number of SOFs or NAKed tokens */
+	uint16_t first_frame;    /* SOF runs only */
+	uint16_t last_frame;
+	uint64_t last_timestamp;
+};
+#ifdef _MSC_VER
+#pragma pack(pop)
+#endif
+
+static inline const struct ov_summary* ov_packet_summary(const struct ov_packet* p) {
+	/* Summaries are never snapped, so the flag rules out device packets */
+	if (p->magic != OV_PACKET_MAGIC_SUMMARY || (p->flags & OV_FLAGS_SNAPPED))
+		return NULL;
+
+	return (const struct ov_summary*)p->data;
+}
+
+typedef void (*ov_transaction_callback)(const struct ov_transaction*, void*);
+typedef void (*ov_transfer_callback)(const struct ov_transfer*, void*);
+
 OPENVIZSLA_EXPORT struct ov_device* ov_new(const char* firmware_filename);
 OPENVIZSLA_EXPORT int  ov_open(struct ov_device* ov);
 OPENVIZSLA_EXPORT void ov_free(struct ov_device* ov);
@@ -61,16 +307,149 @@ OPENVIZSLA_EXPORT void ov_free(struct ov_device* ov);
 OPENVIZSLA_EXPORT int ov_get_usb_speed(struct ov_device* ov, enum ov_usb_speed* speed);
 OPENVIZSLA_EXPORT int ov_set_usb_speed(struct ov_device* ov, enum ov_usb_speed speed);
 
+OPENVIZSLA_EXPORT int ov_capture_set_timestamp_mode(struct ov_device* ov, enum ov_timestamp_mode mode);
+/* Packets not matching the filter expression are dropped before they are
+ * copied, NULL clears the filter. E.g. "pid == IN && addr == 3 && endp == 1" */
+OPENVIZSLA_EXPORT int ov_capture_set_filter(struct ov_device* ov, const char* filter);
+OPENVIZSLA_EXPORT void ov_capture_set_validation(struct ov_device* ov, int enable);
+/* Keep at most snaplen bytes of each packet, size still holds the size on
+ * the bus. 0 disables it. */
+OPENVIZSLA_EXPORT int ov_capture_set_snaplen(struct ov_device* ov, size_t snaplen);
+/* Placement of the SDRAM ring for the next ov_capture_start(), base and
+ * size are multiples of OV_SDRAM_RING_ALIGN. Burst mode uses the whole
+ * SDRAM, so the device absorbs the longest host stalls. */
+OPENVIZSLA_EXPORT int ov_capture_set_sdram_ring(struct ov_device* ov, uint32_t base, uint32_t size);
+OPENVIZSLA_EXPORT int ov_capture_set_burst_mode(struct ov_device* ov, int enable);
+/* Sample the SDRAM ring pointers in-band every interval_ms while capturing,
+ * 0 disables it. The callback is called when the backlog crosses threshold
+ * in either direction, from the thread dispatching the capture. */
+OPENVIZSLA_EXPORT void ov_capture_set_backlog_monitor(struct ov_device* ov, int interval_ms, uint32_t threshold, ov_backlog_callback callback, void* user_data);
+OPENVIZSLA_EXPORT void ov_capture_get_backlog(struct ov_device* ov, struct ov_backlog* backlog);
+/* Time callbacks and decoding of every transfer while capturing, may also
+ * be changed during capture from the dispatching thread. The callback is
+ * called from that thread when the time spent on the data of an interval
+ * crosses budget_percent of the time the data took to arrive, i.e. when
+ * the consumer stops or starts keeping up again. */
+OPENVIZSLA_EXPORT void ov_capture_set_latency_monitor(struct ov_device* ov, int enable, int budget_percent, ov_consumer_load_callback callback, void* user_data);
+/* Valid during and after capture, until the next ov_capture_start() or
+ * ov_capture_reset_latency(), e.g. to measure a phase of the capture */
+OPENVIZSLA_EXPORT int ov_capture_get_latency(struct ov_device* ov, enum ov_latency_kind kind, struct ov_latency* latency);
+OPENVIZSLA_EXPORT uint64_t ov_capture_get_latency_percentile(struct ov_device* ov, enum ov_latency_kind kind, double percentile);
+OPENVIZSLA_EXPORT void ov_capture_reset_latency(struct ov_device* ov);
+/* Register access while capturing, valid between ov_capture_start() and
+ * ov_capture_stop() on the dispatching thread. Requests are sent in-band
+ * in order and the callback is called once the reply arrives in the stream.
+ * Names are those of the firmware register map, e.g. "LEDS_OUT". */
+OPENVIZSLA_EXPORT int ov_capture_read_register(struct ov_device* ov, const char* name, ov_register_callback callback, void* user_data);
+OPENVIZSLA_EXPORT int ov_capture_write_register(struct ov_device* ov, const char* name, uint8_t value, ov_register_callback callback, void* user_data);
+OPENVIZSLA_EXPORT int ov_capture_read_ulpi(struct ov_device* ov, uint8_t addr, ov_register_callback callback, void* user_data);
+OPENVIZSLA_EXPORT int ov_capture_write_ulpi(struct ov_device* ov, uint8_t addr, uint8_t value, ov_register_callback callback, void* user_data);
+/* Stop and restart capturing USB traffic without tearing the stream down.
+ * Data already in SDRAM keeps being delivered while paused. */
+OPENVIZSLA_EXPORT int ov_capture_pause(struct ov_device* ov);
+OPENVIZSLA_EXPORT int ov_capture_resume(struct ov_device* ov);
+/* Start a new session on the running capture. Capturing pauses, the old
+ * session is drained by the dispatching loop, then the callback is called
+ * after its last packet and capturing resumes. Raw timestamps of the new
+ * session count from the last packet of the old one, converted timestamps
+ * continue without a jump. */
+OPENVIZSLA_EXPORT int ov_capture_rearm(struct ov_device* ov, ov_session_callback callback, void* user_data);
+/* OV_AGGREGATE_* flags, the callback of ov_capture_start() and the pull
+ * mode then receive summaries instead of SOFs and NAKed tokens */
+OPENVIZSLA_EXPORT void ov_capture_set_aggregation(struct ov_device* ov, int flags);
+/* Decode packets into a pool growing by count slots, so that the callback
+ * may keep a packet by ov_packet_ref(). The packet argument of
+ * ov_capture_start() may then be NULL. */
+OPENVIZSLA_EXPORT void ov_capture_set_pool(struct ov_device* ov, size_t count);
 OPENVIZSLA_EXPORT int ov_capture_start(struct ov_device* ov, struct ov_packet* packet, size_t packet_size, ov_packet_decoder_callback callback, void* user_data);
+/* Packets are decoded directly into a buffer of buffer_size bytes as
+ * struct ov_record, which is passed to the callback once per transfer or
+ * when it is full. The packet pool is not used. */
+OPENVIZSLA_EXPORT int ov_capture_start_records(struct ov_device* ov, size_t buffer_size, ov_record_callback callback, void* user_data);
 OPENVIZSLA_EXPORT int ov_capture_dispatch(struct ov_device* ov, int count);
+/* Return the number of processed packets when count packets are processed
+ * or timeout expires, leaving the transfers in flight. The count is checked
+ * between transfers, so more packets may be processed. */
+OPENVIZSLA_EXPORT int ov_capture_dispatch_timeout(struct ov_device* ov, int count, int timeout_ms);
+OPENVIZSLA_EXPORT int ov_capture_dispatch_nonblock(struct ov_device* ov, int count);
+/* Event loop integration, valid between ov_capture_start() and ov_capture_stop().
+ * Wait for the file descriptors, or for ov_capture_get_timeout() milliseconds
+ * when it is not negative, then call ov_capture_process_events().
+ * ov_capture_get_pollfds() returns the total number of descriptors, which may
+ * exceed count, or -1 when the platform cannot provide them. */
+OPENVIZSLA_EXPORT int ov_capture_get_pollfds(struct ov_device* ov, struct ov_pollfd* pollfds, size_t count);
+OPENVIZSLA_EXPORT void ov_capture_set_pollfd_notifiers(struct ov_device* ov, ov_pollfd_added_callback added, ov_pollfd_removed_callback removed, void* user_data);
+OPENVIZSLA_EXPORT int ov_capture_get_timeout(struct ov_device* ov);
+OPENVIZSLA_EXPORT int ov_capture_process_events(struct ov_device* ov);
 OPENVIZSLA_EXPORT void ov_capture_breakloop(struct ov_device* ov);
 OPENVIZSLA_EXPORT ov_packet_decoder_callback ov_capture_set_callback(struct ov_device* ov, ov_packet_decoder_callback callback, void* user_data);
 OPENVIZSLA_EXPORT int ov_capture_stop(struct ov_device* ov);
 
+/* Pull mode: packets are stored in an internal queue of queue_size bytes
+ * and stay valid until released by ov_capture_release() in the order they
+ * were returned, or until ov_capture_stop(). Next and batch return 0 at
+ * the end of stream or after ov_capture_breakloop(). */
+OPENVIZSLA_EXPORT int ov_capture_start_queued(struct ov_device* ov, size_t queue_size);
+OPENVIZSLA_EXPORT int ov_capture_next(struct ov_device* ov, struct ov_packet** packet);
+OPENVIZSLA_EXPORT int ov_capture_read_batch(struct ov_device* ov, struct ov_packet** packets, size_t count);
+/* Return 1 when packets can be read without blocking, 0 when timeout_ms
+ * expires first. With timeout_ms 0 only the ready events are handled, so it
+ * may be called instead of ov_capture_process_events() by an event loop. */
+OPENVIZSLA_EXPORT int ov_capture_wait(struct ov_device* ov, int timeout_ms);
+/* End of stream is reached and all packets were read */
+OPENVIZSLA_EXPORT int ov_capture_at_end(struct ov_device* ov);
+OPENVIZSLA_EXPORT void ov_capture_release(struct ov_device* ov, size_t count);
+OPENVIZSLA_EXPORT uint64_t ov_capture_get_dropped(struct ov_device* ov);
+
 OPENVIZSLA_EXPORT int ov_load_firmware(struct ov_device* ov, const char* filename);
 
+OPENVIZSLA_EXPORT int ov_get_call_stats(struct ov_device* ov, enum ov_call call, struct ov_call_stats* stats);
+OPENVIZSLA_EXPORT void ov_reset_call_stats(struct ov_device* ov);
+/* Table of all calls, returns the length like snprintf() */
+OPENVIZSLA_EXPORT size_t ov_format_call_stats(struct ov_device* ov, char* buf, size_t size);
+
 OPENVIZSLA_EXPORT const char* ov_get_error_string(struct ov_device* ov);
 
+/* Only for packets from the pool, the reference may be dropped from any thread */
+OPENVIZSLA_EXPORT struct ov_packet* ov_packet_ref(struct ov_packet* packet);
+OPENVIZSLA_EXPORT void ov_packet_unref(struct ov_packet* packet);
+
+/* Check PID, CRC5 and CRC16, returns -1 and sets OV_FLAGS_BAD_CRC for damaged packet */
+OPENVIZSLA_EXPORT int ov_packet_validate(struct ov_packet* packet);
+
+OPENVIZSLA_EXPORT struct ov_reassembler* ov_reassembler_new(size_t max_transfer_size, ov_transaction_callback transaction_callback, ov_transfer_callback transfer_callback, void* user_data);
+OPENVIZSLA_EXPORT void ov_reassembler_free(struct ov_reassembler* reasm);
+/* Matches ov_packet_decoder_callback, so the reassembler may be given to ov_capture_start() */
+OPENVIZSLA_EXPORT void ov_reassembler_packet(struct ov_packet* packet, void* reasm);
+OPENVIZSLA_EXPORT void ov_reassembler_flush(struct ov_reassembler* reasm);
+
+/* Runs end at the first packet which is not aggregated, the summaries are
+ * passed on before it. Packets passed on may be copies. */
+OPENVIZSLA_EXPORT struct ov_aggregator* ov_aggregator_new(int flags, ov_packet_decoder_callback callback, void* user_data);
+OPENVIZSLA_EXPORT void ov_aggregator_free(struct ov_aggregator* agg);
+/* Matches ov_packet_decoder_callback */
+OPENVIZSLA_EXPORT void ov_aggregator_packet(struct ov_packet* packet, void* agg);
+OPENVIZSLA_EXPORT void ov_aggregator_flush(struct ov_aggregator* agg);
+/* Without it, the transfer end is detected by a packet shorter than the largest one seen */
+OPENVIZSLA_EXPORT int ov_reassembler_set_max_packet_size(struct ov_reassembler* reasm, uint8_t address, uint8_t endpoint, int in, uint16_t max_packet_size);
+
+/* Sinks expect packet timestamps in nanoseconds, see ov_capture_set_timestamp_mode() */
+OPENVIZSLA_EXPORT struct ov_sink* ov_sink_new_ring(const char* prefix, size_t segment_count, uint64_t segment_size, unsigned int segment_seconds);
+OPENVIZSLA_EXPORT int ov_sink_set_async(struct ov_sink* sink, size_t buffer_count, unsigned int flags);
+OPENVIZSLA_EXPORT int ov_sink_open(struct ov_sink* sink, enum ov_sink_format format, uint32_t linktype);
+OPENVIZSLA_EXPORT int ov_sink_write(struct ov_sink* sink, struct ov_packet* packet);
+OPENVIZSLA_EXPORT int ov_sink_flush(struct ov_sink* sink);
+OPENVIZSLA_EXPORT int ov_sink_close(struct ov_sink* sink);
+OPENVIZSLA_EXPORT void ov_sink_free(struct ov_sink* sink);
+OPENVIZSLA_EXPORT void ov_sink_packet_callback(struct ov_packet* packet, void* sink);
+OPENVIZSLA_EXPORT int ov_sink_ring_get_segment(struct ov_sink* sink, size_t index, struct ov_sink_segment* segment);
+/* The trigger sink does not own target, it has to be freed separately */
+OPENVIZSLA_EXPORT struct ov_sink* ov_sink_new_trigger(struct ov_sink* target, size_t pre_size, size_t post_size);
+OPENVIZSLA_EXPORT int ov_sink_trigger_add(struct ov_sink* sink, const struct ov_trigger* trigger);
+OPENVIZSLA_EXPORT int ov_sink_trigger_fire(struct ov_sink* sink);
+
+OPENVIZSLA_EXPORT const char* ov_sink_get_error_string(struct ov_sink* sink);
+
 #ifdef __cplusplus
 }
 #endif
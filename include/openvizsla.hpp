@@ -0,0 +1,508 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _OPENVIZSLA_HPP
+#define _OPENVIZSLA_HPP
+
+#include <openvizsla.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <vector>
+#define OPENVIZSLA_HAS_COROUTINES 1
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#endif
+#endif
+
+/* Header-only C++17 layer over the C API.
+ *
+ * callback_capture registers a trampoline instantiated for the handler type
+ * with ov_capture_start(). The handler is inlined into the trampoline, so a
+ * packet costs the one indirect call of the decode loop and is not copied.
+ *
+ * capture runs in the pull mode of ov_capture_start_queued() for consumers
+ * which take packets in batches, e.g. from another thread. Each packet is
+ * copied into the queue by the decode loop.
+ *
+ * With C++20 coroutines `co_await capture.next_batch()` suspends until the
+ * queue has packets. The coroutine is resumed inside capture::process_events(),
+ * which an executor calls when the descriptors of capture::pollfds() are
+ * ready, so several captures may be driven by one thread. event_loop is a
+ * minimal poll() based executor.
+ */
+
+namespace openvizsla {
+
+class error: public std::runtime_error {
+public:
+	explicit error(const char* what):
+		std::runtime_error(what ? what : "Unknown error") {}
+};
+
+class device {
+public:
+	explicit device(const char* firmware_filename = nullptr):
+		ov_(ov_new(firmware_filename)) {
+
+		if (!ov_)
+			throw error("Cannot create ov_device handler");
+	}
+
+	device(const device&) = delete;
+	device& operator=(const device&) = delete;
+
+	device(device&& other) noexcept:
+		ov_(std::exchange(other.ov_, nullptr)) {}
+
+	device& operator=(device&& other) noexcept {
+		std::swap(ov_, other.ov_);
+		return *this;
+	}
+
+	~device() {
+		if (ov_)
+			ov_free(ov_);
+	}
+
+	void open() {
+		check(ov_open(ov_));
+	}
+
+	void load_firmware(const char* filename) {
+		check(ov_load_firmware(ov_, filename));
+	}
+
+	ov_usb_speed usb_speed() {
+		ov_usb_speed speed;
+
+		check(ov_get_usb_speed(ov_, &speed));
+
+		return speed;
+	}
+
+	void set_usb_speed(ov_usb_speed speed) {
+		check(ov_set_usb_speed(ov_, speed));
+	}
+
+	void set_timestamp_mode(ov_timestamp_mode mode) {
+		check(ov_capture_set_timestamp_mode(ov_, mode));
+	}
+
+	void set_filter(const char* expr) {
+		check(ov_capture_set_filter(ov_, expr));
+	}
+
+	void set_validation(bool enable) {
+		ov_capture_set_validation(ov_, enable);
+	}
+
+	ov_device* native_handle() const noexcept {
+		return ov_;
+	}
+
+	int check(int ret) const {
+		if (ret < 0)
+			throw error(ov_get_error_string(ov_));
+
+		return ret;
+	}
+
+private:
+	ov_device* ov_;
+};
+
+/* Packets stored in the queue of a capture, released when the batch is
+ * destroyed. Batches have to be destroyed in the order they were read. */
+class batch {
+public:
+	static constexpr std::size_t capacity = 256;
+
+	class iterator {
+	public:
+		explicit iterator(ov_packet* const* p) noexcept: p_(p) {}
+
+		const ov_packet& operator*() const noexcept { return **p_; }
+		const ov_packet* operator->() const noexcept { return *p_; }
+		iterator& operator++() noexcept { ++p_; return *this; }
+		bool operator==(const iterator& other) const noexcept { return p_ == other.p_; }
+		bool operator!=(const iterator& other) const noexcept { return p_ != other.p_; }
+
+	private:
+		ov_packet* const* p_;
+	};
+
+	batch() noexcept = default;
+
+	batch(const batch&) = delete;
+	batch& operator=(const batch&) = delete;
+
+	batch(batch&& other) noexcept {
+		take(other);
+	}
+
+	batch& operator=(batch&& other) noexcept {
+		if (this != &other) {
+			reset();
+			take(other);
+		}
+
+		return *this;
+	}
+
+	~batch() {
+		reset();
+	}
+
+	void reset() noexcept {
+		if (ov_ && count_)
+			ov_capture_release(ov_, count_);
+
+		ov_ = nullptr;
+		count_ = 0;
+	}
+
+	std::size_t size() const noexcept { return count_; }
+	bool empty() const noexcept { return count_ == 0; }
+	const ov_packet& operator[](std::size_t i) const noexcept { return *packets_[i]; }
+	iterator begin() const noexcept { return iterator(packets_); }
+	iterator end() const noexcept { return iterator(packets_ + count_); }
+
+private:
+	friend class capture;
+
+	void take(batch& other) noexcept {
+		ov_ = std::exchange(other.ov_, nullptr);
+		count_ = std::exchange(other.count_, 0);
+
+		for (std::size_t i = 0; i < count_; ++i)
+			packets_[i] = other.packets_[i];
+	}
+
+	ov_device* ov_ = nullptr;
+	std::size_t count_ = 0;
+	ov_packet* packets_[capacity];
+};
+
+/* Capture is stopped when the object is destroyed */
+class capture {
+public:
+	static constexpr std::size_t default_queue_size = 4 * 1024 * 1024;
+
+	explicit capture(device& dev, std::size_t queue_size = default_queue_size):
+		dev_(&dev) {
+
+		dev_->check(ov_capture_start_queued(dev_->native_handle(), queue_size));
+	}
+
+	capture(const capture&) = delete;
+	capture& operator=(const capture&) = delete;
+
+	capture(capture&& other) noexcept:
+		dev_(std::exchange(other.dev_, nullptr)) {}
+
+	capture& operator=(capture&& other) noexcept {
+		std::swap(dev_, other.dev_);
+		return *this;
+	}
+
+	~capture() {
+		if (dev_)
+			ov_capture_stop(dev_->native_handle());
+	}
+
+	void stop() {
+		device* dev = std::exchange(dev_, nullptr);
+
+		if (dev)
+			dev->check(ov_capture_stop(dev->native_handle()));
+	}
+
+	/* Safe to call from any thread or a signal handler */
+	void breakloop() noexcept {
+		ov_capture_breakloop(dev_->native_handle());
+	}
+
+	void pause() {
+		dev_->check(ov_capture_pause(dev_->native_handle()));
+	}
+
+	void resume() {
+		dev_->check(ov_capture_resume(dev_->native_handle()));
+	}
+
+	/* Wait at most timeout_ms when not negative, an empty batch is
+	 * returned on timeout or at the end of stream */
+	batch read_batch(int timeout_ms = -1) {
+		ov_device* ov = dev_->native_handle();
+		batch result;
+
+		if (dev_->check(ov_capture_wait(ov, timeout_ms)) > 0) {
+			result.count_ = dev_->check(ov_capture_read_batch(ov, result.packets_, batch::capacity));
+			result.ov_ = ov;
+		}
+
+		return result;
+	}
+
+	batch try_read_batch() {
+		return read_batch(0);
+	}
+
+	bool at_end() const noexcept {
+		return ov_capture_at_end(dev_->native_handle());
+	}
+
+	std::uint64_t dropped() const noexcept {
+		return ov_capture_get_dropped(dev_->native_handle());
+	}
+
+	device& get_device() const noexcept {
+		return *dev_;
+	}
+
+#ifdef OPENVIZSLA_HAS_COROUTINES
+	class batch_awaiter {
+	public:
+		explicit batch_awaiter(capture& cap) noexcept: cap_(cap) {}
+
+		bool await_ready() {
+			result_ = cap_.try_read_batch();
+
+			return !result_.empty() || cap_.at_end();
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) noexcept {
+			handle_ = handle;
+			cap_.awaiter_ = this;
+		}
+
+		batch await_resume() {
+			if (error_)
+				std::rethrow_exception(error_);
+
+			return std::move(result_);
+		}
+
+	private:
+		friend class capture;
+
+		capture& cap_;
+		batch result_;
+		std::coroutine_handle<> handle_;
+		std::exception_ptr error_;
+	};
+
+	/* An empty batch marks the end of stream. Only one coroutine may wait
+	 * for a capture at a time. */
+	batch_awaiter next_batch() noexcept {
+		return batch_awaiter(*this);
+	}
+
+	bool waiting() const noexcept {
+		return awaiter_ != nullptr;
+	}
+
+	std::vector<ov_pollfd> pollfds() const {
+		ov_device* ov = dev_->native_handle();
+		std::vector<ov_pollfd> fds(dev_->check(ov_capture_get_pollfds(ov, nullptr, 0)));
+
+		fds.resize(dev_->check(ov_capture_get_pollfds(ov, fds.data(), fds.size())));
+
+		return fds;
+	}
+
+	/* Milliseconds until process_events() has to be called even without
+	 * ready descriptors, -1 when there is no such deadline */
+	int timeout() const noexcept {
+		return ov_capture_get_timeout(dev_->native_handle());
+	}
+
+	/* Handle the ready USB events and resume the waiting coroutine, on this
+	 * thread, once the queue has packets. Does nothing without a waiter, so
+	 * the queue applies back pressure while the consumer is busy. */
+	void process_events() {
+		batch_awaiter* awaiter = static_cast<batch_awaiter*>(awaiter_);
+
+		if (!awaiter)
+			return;
+
+		try {
+			batch result = try_read_batch();
+
+			if (result.empty() && !at_end())
+				return;
+
+			awaiter->result_ = std::move(result);
+		} catch (...) {
+			awaiter->error_ = std::current_exception();
+		}
+
+		awaiter_ = nullptr;
+		awaiter->handle_.resume();
+	}
+#endif
+
+private:
+	device* dev_;
+	void* awaiter_ = nullptr;
+};
+
+/* Capture is stopped when the object is destroyed. The object is registered
+ * with the decode loop, so it can not be moved. */
+template <typename Handler>
+class callback_capture {
+public:
+	callback_capture(device& dev, Handler handler):
+		dev_(&dev), handler_(std::move(handler)) {
+
+		dev_->check(ov_capture_start(dev_->native_handle(), reinterpret_cast<ov_packet*>(buf_), sizeof(buf_), &trampoline, this));
+	}
+
+	callback_capture(const callback_capture&) = delete;
+	callback_capture& operator=(const callback_capture&) = delete;
+
+	~callback_capture() {
+		if (dev_)
+			ov_capture_stop(dev_->native_handle());
+	}
+
+	void stop() {
+		device* dev = std::exchange(dev_, nullptr);
+
+		if (dev)
+			dev->check(ov_capture_stop(dev->native_handle()));
+	}
+
+	/* Safe to call from any thread or a signal handler */
+	void breakloop() noexcept {
+		ov_capture_breakloop(dev_->native_handle());
+	}
+
+	void pause() {
+		dev_->check(ov_capture_pause(dev_->native_handle()));
+	}
+
+	void resume() {
+		dev_->check(ov_capture_resume(dev_->native_handle()));
+	}
+
+	/* Pass count packets to the handler, 0 until the end of stream or
+	 * breakloop(). Returns false when the capture is over. An exception of
+	 * the handler stops the loop and is rethrown here. */
+	bool dispatch(int count = 0) {
+		const int ret = ov_capture_dispatch(dev_->native_handle(), count);
+
+		if (error_)
+			std::rethrow_exception(std::exchange(error_, nullptr));
+
+		/* Other negative values are the end of stream or a break */
+		if (ret == -1)
+			dev_->check(ret);
+
+		return ret >= 0;
+	}
+
+	Handler& handler() noexcept {
+		return handler_;
+	}
+
+	device& get_device() const noexcept {
+		return *dev_;
+	}
+
+private:
+	/* Exceptions can not unwind through the C decode loop */
+	static void trampoline(ov_packet* packet, void* user_data) noexcept {
+		callback_capture* self = static_cast<callback_capture*>(user_data);
+
+		try {
+			std::invoke(self->handler_, static_cast<const ov_packet&>(*packet));
+		} catch (...) {
+			if (!self->error_) {
+				self->error_ = std::current_exception();
+				ov_capture_breakloop(self->dev_->native_handle());
+			}
+		}
+	}
+
+	device* dev_;
+	Handler handler_;
+	std::exception_ptr error_;
+	/* ov_packet is packed, so any byte buffer is aligned for it */
+	std::uint8_t buf_[sizeof(ov_packet) + OV_MAX_PACKET_SIZE];
+};
+
+#if defined(OPENVIZSLA_HAS_COROUTINES) && !defined(_WIN32)
+/* Drives the captures with a waiting coroutine from a single thread */
+class event_loop {
+public:
+	void add(capture& cap) {
+		captures_.push_back(&cap);
+	}
+
+	/* Has to be called before the capture is destroyed, also from a coroutine */
+	void remove(capture& cap) noexcept {
+		for (capture*& c : captures_) {
+			if (c == &cap)
+				c = nullptr;
+		}
+	}
+
+	/* Run until no capture is awaited */
+	void run() {
+		std::vector<struct pollfd> fds;
+
+		for (;;) {
+			int timeout = -1;
+
+			fds.clear();
+			captures_.erase(std::remove(captures_.begin(), captures_.end(), nullptr), captures_.end());
+
+			for (capture* cap: captures_) {
+				if (!cap->waiting())
+					continue;
+
+				for (const ov_pollfd& fd: cap->pollfds())
+					fds.push_back({fd.fd, fd.events, 0});
+
+				const int cap_timeout = cap->timeout();
+				if (cap_timeout >= 0 && (timeout < 0 || cap_timeout < timeout))
+					timeout = cap_timeout;
+			}
+
+			if (fds.empty())
+				return;
+
+			if (::poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+				throw error("Cannot poll capture file descriptors");
+
+			/* Captures may be added or removed by resumed coroutines */
+			for (std::size_t i = 0; i < captures_.size(); ++i) {
+				if (captures_[i])
+					captures_[i]->process_events();
+			}
+		}
+	}
+
+private:
+	std::vector<capture*> captures_;
+};
+#endif
+
+inline std::size_t captured_size(const ov_packet& packet) noexcept {
+	return ov_packet_captured_size(const_cast<ov_packet*>(&packet));
+}
+
+} // namespace openvizsla
+
+#endif // _OPENVIZSLA_HPP
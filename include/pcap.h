@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _PCAP_H
+#define _PCAP_H
+
+#include <openvizsla.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCAP_NANOSEC_MAGIC 0xa1b23c4d
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define PCAPNG_SHB_SIZE 28
+#define PCAPNG_IDB_SIZE 32
+#define PCAPNG_EPB_HEADER_SIZE 32
+
+/* Upper bound of the file header size for any format */
+#define PCAP_MAX_FILE_HEADER_SIZE (PCAPNG_SHB_SIZE + PCAPNG_IDB_SIZE)
+/* Upper bound of a single record size for any format */
+#define PCAP_MAX_RECORD_SIZE (PCAPNG_EPB_HEADER_SIZE + OV_MAX_PACKET_SIZE + 3)
+
+size_t pcap_file_header(uint8_t* buf, enum ov_sink_format format, uint32_t linktype);
+size_t pcap_record_size(enum ov_sink_format format, const struct ov_packet* packet);
+size_t pcap_record(uint8_t* buf, enum ov_sink_format format, const struct ov_packet* packet);
+
+#endif // _PCAP_H
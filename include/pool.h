@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <openvizsla.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PACKET_POOL_ALIGN 16
+
+struct packet_pool;
+
+/* The packet follows the header at PACKET_SLOT_HEADER_SIZE */
+struct packet_slot {
+	struct packet_slot* next;
+	struct packet_pool* pool;
+	volatile long refcount;
+};
+
+#define PACKET_SLOT_HEADER_SIZE ((sizeof(struct packet_slot) + PACKET_POOL_ALIGN - 1) & ~(size_t)(PACKET_POOL_ALIGN - 1))
+#define PACKET_SLOT_SIZE ((PACKET_SLOT_HEADER_SIZE + sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE + PACKET_POOL_ALIGN - 1) & ~(size_t)(PACKET_POOL_ALIGN - 1))
+
+struct packet_slab {
+	struct packet_slab* next;
+	uint8_t* buf;
+};
+
+/* Slots are taken by the capture thread only, while the last reference
+ * may be dropped from any thread. Returned slots are pushed to a lock-free
+ * stack which the capture thread takes as a whole when its own free list
+ * is empty, so there is no ABA problem. When both lists are empty, the pool
+ * grows by another slab.
+ *
+ * The pool itself is referenced by its owner and by every slot in use, so
+ * packets may outlive the capture.
+ */
+struct packet_pool {
+	size_t slab_size;
+	struct packet_slab* slabs;
+	struct packet_slot* free_list;
+	void* volatile returned;
+	volatile long refcount;
+};
+
+struct packet_pool* packet_pool_new(size_t slab_size);
+struct ov_packet* packet_pool_get(struct packet_pool* pool);
+void packet_pool_unref(struct packet_pool* pool);
+
+static inline struct packet_slot* packet_slot_from_packet(struct ov_packet* packet) {
+	return (struct packet_slot*)((uint8_t*)packet - PACKET_SLOT_HEADER_SIZE);
+}
+
+static inline struct ov_packet* packet_slot_packet(struct packet_slot* slot) {
+	return (struct ov_packet*)((uint8_t*)slot + PACKET_SLOT_HEADER_SIZE);
+}
+
+#endif // _POOL_H
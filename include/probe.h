@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _PROBE_H
+#define _PROBE_H
+
+/* USDT probes of the openvizsla provider, for example with bpftrace:
+ *
+ *   bpftrace -e 'usdt:libopenvizsla.so:openvizsla:transfer_complete { @[arg1] = count(); }'
+ *
+ * A probe site is a single nop until a tracer attaches, so arguments are
+ * restricted to values which are already at hand. Without sys/sdt.h the
+ * probes compile to nothing.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE2(name, a, b) DTRACE_PROBE2(openvizsla, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(openvizsla, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(openvizsla, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+#endif // _PROBE_H
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+#include <openvizsla.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PACKET_QUEUE_ALIGN 8
+#define PACKET_QUEUE_MIN_SIZE (64 * 1024)
+
+/* Packets are kept back to back and a record never wraps. When the tail
+ * does not fit at the end of the buffer, the data ends at wrap_end and
+ * continues from the start.
+ *
+ * Records between head and read are handed out but not released yet,
+ * records between read and tail are not handed out yet.
+ */
+struct packet_queue {
+	uint8_t* buf;
+	size_t size;
+	size_t head;
+	size_t read;
+	size_t tail;
+	size_t wrap_end;
+	int wrapped;
+
+	size_t count;
+	size_t unread;
+};
+
+int packet_queue_init(struct packet_queue* queue, size_t size);
+int packet_queue_push(struct packet_queue* queue, const struct ov_packet* packet);
+struct ov_packet* packet_queue_next(struct packet_queue* queue);
+size_t packet_queue_release(struct packet_queue* queue, size_t count);
+size_t packet_queue_free_space(const struct packet_queue* queue);
+void packet_queue_destroy(struct packet_queue* queue);
+
+static inline size_t packet_queue_unread(const struct packet_queue* queue) {
+	return queue->unread;
+}
+
+#endif // _QUEUE_H
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _REASSEMBLER_H
+#define _REASSEMBLER_H
+
+#include <openvizsla.h>
+#include <usb.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REASM_ADDRESSES 128
+#define REASM_ENDPOINTS 16
+#define REASM_DEFAULT_TRANSFER_SIZE 65536
+
+struct reasm_endpoint {
+	/* Allocated on the first transfer */
+	uint8_t* buf;
+	size_t size;
+	uint64_t first_ts;
+	uint64_t last_ts;
+	int active;
+
+	uint16_t max_packet_size;
+	int max_packet_size_fixed;
+	/* Data PID of the last accepted packet, to drop retransmissions */
+	uint8_t last_toggle;
+
+	/* Control transfer, kept in the OUT entry */
+	int control;
+	int control_in;
+	int control_data_done;
+	uint16_t control_length;
+	uint8_t setup[USB_SETUP_SIZE];
+};
+
+struct ov_reassembler {
+	ov_transaction_callback transaction_callback;
+	ov_transfer_callback transfer_callback;
+	void* user_data;
+	size_t max_transfer_size;
+
+	enum reasm_state {
+		REASM_IDLE,
+		REASM_SPLIT,
+		REASM_TOKEN,
+		REASM_DATA
+	} state;
+
+	struct ov_transaction transaction;
+	uint8_t data[OV_MAX_PACKET_SIZE];
+
+	uint8_t split;
+	uint8_t split_hub;
+	uint8_t split_port;
+
+	/* Indexed by address, endpoint and direction */
+	struct reasm_endpoint endpoints[REASM_ADDRESSES * REASM_ENDPOINTS * 2];
+};
+
+#endif // _REASSEMBLER_H
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <openvizsla.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The decoder writes struct ov_packet so that its data lands where the
+ * data of the record goes, the header is converted in place on commit. */
+#define RECORD_PACKET_OFFSET (sizeof(struct ov_record) - sizeof(struct ov_packet))
+#define RECORD_MAX_SIZE ((sizeof(struct ov_record) + OV_MAX_PACKET_SIZE + OV_RECORD_ALIGN - 1) & ~(size_t)(OV_RECORD_ALIGN - 1))
+#define RECORD_BUFFER_MIN_SIZE (16 * RECORD_MAX_SIZE)
+
+struct record_buffer {
+	uint8_t* buf;
+	size_t size;
+	size_t used;
+	size_t count;
+
+	ov_record_callback callback;
+	void* user_data;
+};
+
+int record_buffer_init(struct record_buffer* rb, size_t size, ov_record_callback callback, void* user_data);
+/* Where the next packet has to be decoded, with room for OV_MAX_PACKET_SIZE bytes of data */
+struct ov_packet* record_buffer_packet(struct record_buffer* rb);
+/* Convert the packet returned by record_buffer_packet() to a record */
+void record_buffer_commit(struct record_buffer* rb);
+void record_buffer_flush(struct record_buffer* rb);
+void record_buffer_destroy(struct record_buffer* rb);
+
+#endif // _RECORD_H
@@ -19,6 +19,8 @@ enum reg_name {
 	SDRAM_HOST_READ_GO,
 
 	SDRAM_SINK_PTR_READ,
+	SDRAM_SINK_WPTR,
+	SDRAM_SINK_RPTR,
 	SDRAM_SINK_RING_BASE,
 	SDRAM_SINK_RING_END,
 	SDRAM_SINK_GO,
@@ -39,6 +41,7 @@ struct reg {
 int reg_init(struct reg* reg, char* map);
 int reg_init_from_fwpkg(struct reg* reg, struct fwpkg* fwpkg);
 int reg_init_from_reg(struct reg* reg, struct reg* other);
+int reg_lookup(struct reg* reg, const char* name, uint16_t* addr);
 
 const char* reg_get_error_string(struct reg* reg);
 
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _SINK_H
+#define _SINK_H
+
+#include <openvizsla.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct sink_ops {
+	int (*open) (struct ov_sink*, enum ov_sink_format, uint32_t);
+	int (*write) (struct ov_sink*, struct ov_packet*);
+	int (*flush) (struct ov_sink*);
+	int (*close) (struct ov_sink*);
+	void (*destroy) (struct ov_sink*);
+	int (*set_async) (struct ov_sink*, size_t, unsigned int);
+};
+
+struct ov_sink {
+	const struct sink_ops* ops;
+	int is_open;
+	const char* error_str;
+};
+
+struct aio_writer;
+struct aio_buffer;
+
+/* Buffered file written with large sequential writes, either by stdio or
+ * asynchronously from a buffer pool */
+struct sink_file {
+	FILE* file;
+	struct aio_writer* aio;
+	struct aio_buffer* aio_buffer;
+	uint8_t* buf;
+	size_t buf_size;
+	size_t buf_used;
+	uint64_t size;
+
+	const char* error_str;
+};
+
+void sink_init(struct ov_sink* sink, const struct sink_ops* ops);
+
+int sink_file_init(struct sink_file* sf, size_t buf_size);
+int sink_file_set_async(struct sink_file* sf, size_t buf_count, unsigned int flags);
+int sink_file_open(struct sink_file* sf, const char* filename, uint64_t prealloc);
+uint8_t* sink_file_reserve(struct sink_file* sf, size_t size);
+void sink_file_commit(struct sink_file* sf, size_t size);
+int sink_file_flush(struct sink_file* sf);
+int sink_file_close(struct sink_file* sf);
+int sink_file_wait(struct sink_file* sf);
+void sink_file_destroy(struct sink_file* sf);
+
+#endif // _SINK_H
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _TIMESTAMP_H
+#define _TIMESTAMP_H
+
+#include <openvizsla.h>
+
+#include <stdint.h>
+
+/* Nanoseconds per tick are kept as a fixed-point number with
+ * TIMESTAMP_SHIFT fractional bits, so that conversion is a multiplication
+ * and a shift instead of a division.
+ */
+#define TIMESTAMP_SHIFT 32
+/* Ticks since the anchor are kept below this limit to avoid overflow of
+ * the 64-bit product. 2^27 ticks is about 2.2 seconds.
+ */
+#define TIMESTAMP_MAX_DELTA (UINT64_C(1) << 27)
+
+struct timestamp {
+	enum ov_timestamp_mode mode;
+
+	/* Conversion: ns = anchor_ns + (((ticks - anchor_ticks) * mult + anchor_frac) >> TIMESTAMP_SHIFT) */
+	uint64_t anchor_ticks;
+	uint64_t anchor_ns;
+	uint64_t anchor_frac;
+	uint64_t mult;
+	uint64_t nominal_mult;
+
+	/* Offset between the selected clock and CLOCK_MONOTONIC */
+	int64_t clock_offset;
+
+	/* Drift estimation, all host times are CLOCK_MONOTONIC */
+	uint64_t origin_ns;
+	uint64_t last_ticks;
+	uint64_t sampled_ticks;
+	uint64_t base_ticks;
+	uint64_t base_host_ns;
+	uint64_t interval_start_ns;
+	uint64_t best_ticks;
+	uint64_t best_host_ns;
+	int64_t best_offset;
+	int have_base;
+	int have_best;
+};
+
+void timestamp_init(struct timestamp* ts, enum ov_timestamp_mode mode, uint64_t monotonic_ns, int64_t clock_offset);
+void timestamp_start(struct timestamp* ts, enum ov_timestamp_mode mode);
+void timestamp_rebase(struct timestamp* ts, uint64_t ticks);
+void timestamp_restart(struct timestamp* ts, uint64_t ticks);
+void timestamp_sample(struct timestamp* ts, uint64_t ticks, uint64_t monotonic_ns);
+void timestamp_sample_now(struct timestamp* ts);
+
+uint64_t timestamp_monotonic_ns(void);
+/* Cheapest clock for measuring short intervals, not slewed by NTP */
+uint64_t timestamp_raw_ns(void);
+uint64_t timestamp_realtime_ns(void);
+
+static inline uint64_t timestamp_convert(struct timestamp* ts, uint64_t ticks) {
+	ts->last_ticks = ticks;
+
+	if (ticks - ts->anchor_ticks >= TIMESTAMP_MAX_DELTA)
+		timestamp_rebase(ts, ticks);
+
+	return ts->anchor_ns + (((ticks - ts->anchor_ticks) * ts->mult + ts->anchor_frac) >> TIMESTAMP_SHIFT) + ts->clock_offset;
+}
+
+#endif // _TIMESTAMP_H
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _USB_H
+#define _USB_H
+
+#include <stdint.h>
+
+/* USB packet ID is 4-bit. It is send in octet alongside complemented form.
+ * The list of PIDs is available in Universal Serial Bus Specification Revision 2.0,
+ * Table 8-1. PID Types
+ */
+#define USB_PID_DATA_MDATA 0x0F
+#define USB_PID_HANDSHAKE_STALL 0x1E
+#define USB_PID_TOKEN_SETUP 0x2D
+#define USB_PID_SPECIAL_PRE_OR_ERR 0x3C
+#define USB_PID_DATA_DATA1 0x4B
+#define USB_PID_HANDSHAKE_NAK 0x5A
+#define USB_PID_TOKEN_IN 0x69
+#define USB_PID_SPECIAL_SPLIT 0x78
+#define USB_PID_DATA_DATA2 0x87
+#define USB_PID_HANDSHAKE_NYET 0x96
+#define USB_PID_TOKEN_SOF 0xA5
+#define USB_PID_SPECIAL_PING 0xB4
+#define USB_PID_DATA_DATA0 0xC3
+#define USB_PID_HANDSHAKE_ACK 0xD2
+#define USB_PID_TOKEN_OUT 0xE1
+#define USB_PID_SPECIAL_RESERVED 0xF0
+
+#define USB_TOKEN_SIZE 3
+#define USB_SPLIT_SIZE 4
+#define USB_SETUP_SIZE 8
+
+/* Tokens carrying the device address and the endpoint number */
+static inline int usb_pid_has_endpoint(uint8_t pid) {
+	return (pid == USB_PID_TOKEN_OUT || pid == USB_PID_TOKEN_IN || pid == USB_PID_TOKEN_SETUP || pid == USB_PID_SPECIAL_PING);
+}
+
+static inline uint8_t usb_token_address(const uint8_t* data) {
+	return data[1] & 0x7f;
+}
+
+static inline uint8_t usb_token_endpoint(const uint8_t* data) {
+	return ((data[2] & 0x07) << 1) | (data[1] >> 7);
+}
+
+/* 11-bit frame number of SOF */
+static inline uint16_t usb_sof_frame(const uint8_t* data) {
+	return ((data[2] & 0x07) << 8) | data[1];
+}
+
+#endif // _USB_H
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef _USBSTAT_H
+#define _USBSTAT_H
+
+#include <ftdi.h>
+#include <openvizsla.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* USB traffic of the control path is accounted to the public call in
+ * progress, nested calls are accounted to the outermost one and traffic
+ * outside of instrumented calls is not accounted at all. Adding traffic to
+ * a NULL stat does nothing.
+ */
+struct usbstat {
+	struct ov_call_stats calls[OV_CALL_COUNT];
+	struct ov_call_stats* current;
+	uint64_t start_ns;
+	int depth;
+};
+
+void usbstat_init(struct usbstat* stat);
+void usbstat_begin(struct usbstat* stat, enum ov_call call);
+void usbstat_end(struct usbstat* stat);
+void usbstat_add_write(struct usbstat* stat, int size, uint64_t ns);
+void usbstat_add_read(struct usbstat* stat, int size, uint64_t ns);
+void usbstat_add_round_trip(struct usbstat* stat);
+size_t usbstat_format(struct usbstat* stat, char* buf, size_t size);
+const char* usbstat_call_name(enum ov_call call);
+
+/* ftdi_write_data() and ftdi_read_data() with accounting */
+int usbstat_write_data(struct usbstat* stat, struct ftdi_context* ftdi, const uint8_t* buf, int size);
+int usbstat_read_data(struct usbstat* stat, struct ftdi_context* ftdi, uint8_t* buf, int size);
+
+#endif // _USBSTAT_H
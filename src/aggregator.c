@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <aggregator.h>
+#include <usb.h>
+
+#include <openvizsla_export.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Damaged packets and the end of stream are always passed on */
+#define AGGREGATOR_SKIP_FLAGS (OV_FLAGS_HF0_ERR | OV_FLAGS_HF0_OVF | OV_FLAGS_HF0_TRUNC | OV_FLAGS_HF0_LAST | OV_FLAGS_BAD_CRC)
+
+static void aggregator_emit(struct ov_aggregator* agg, struct ov_packet* packet) {
+	if (agg->callback)
+		agg->callback(packet, agg->user_data);
+}
+
+static void aggregator_emit_run(struct ov_aggregator* agg, struct aggregator_run* run) {
+	const struct ov_summary summary = {
+		.pid = USB_PID_SPECIAL_RESERVED,
+		.type = run->type,
+		.address = run->address,
+		.endpoint = run->endpoint,
+		.count = run->count,
+		.first_frame = run->first_frame,
+		.last_frame = run->last_frame,
+		.last_timestamp = run->last_ts,
+	};
+
+	agg->summary.packet.magic = OV_PACKET_MAGIC_SUMMARY;
+	agg->summary.packet.flags = 0;
+	agg->summary.packet.size = sizeof(summary);
+	agg->summary.packet.timestamp = run->first_ts;
+	memcpy(agg->summary.packet.data, &summary, sizeof(summary));
+
+	run->active = 0;
+
+	aggregator_emit(agg, &agg->summary.packet);
+}
+
+/* Pass on all summaries in the order the runs started */
+static void aggregator_emit_runs(struct ov_aggregator* agg) {
+	for (;;) {
+		struct aggregator_run* first = (agg->sof.active ? &agg->sof : NULL);
+		size_t i;
+
+		for (i = 0; i < AGGREGATOR_MAX_RUNS; ++i) {
+			if (agg->runs[i].active && (!first || agg->runs[i].first_ts < first->first_ts))
+				first = &agg->runs[i];
+		}
+
+		if (!first)
+			break;
+
+		aggregator_emit_run(agg, first);
+	}
+}
+
+static void aggregator_emit_token(struct ov_aggregator* agg) {
+	if (!agg->token_held)
+		return;
+
+	agg->token_held = 0;
+	aggregator_emit(agg, &agg->token.packet);
+}
+
+static int aggregator_is_token(const struct ov_packet* packet, uint8_t pid) {
+	return (packet->size == USB_TOKEN_SIZE
+		&& ov_packet_captured_size((struct ov_packet*)packet) == USB_TOKEN_SIZE
+		&& packet->data[0] == pid);
+}
+
+static void aggregator_add_sof(struct ov_aggregator* agg, const struct ov_packet* packet) {
+	struct aggregator_run* run = &agg->sof;
+	const uint16_t frame = usb_sof_frame(packet->data);
+
+	if (!run->active) {
+		run->active = 1;
+		run->type = OV_SUMMARY_SOF;
+		run->address = 0;
+		run->endpoint = 0;
+		run->count = 0;
+		run->first_frame = frame;
+		run->first_ts = packet->timestamp;
+	}
+
+	run->count++;
+	run->last_frame = frame;
+	run->last_ts = packet->timestamp;
+
+	if (run->count >= AGGREGATOR_MAX_COUNT)
+		aggregator_emit_runs(agg);
+}
+
+static void aggregator_add_nak(struct ov_aggregator* agg, const struct ov_packet* nak) {
+	const struct ov_packet* token = &agg->token.packet;
+	const uint8_t type = (token->data[0] == USB_PID_TOKEN_IN ? OV_SUMMARY_IN_NAK : OV_SUMMARY_PING_NAK);
+	const uint8_t address = usb_token_address(token->data);
+	const uint8_t endpoint = usb_token_endpoint(token->data);
+	struct aggregator_run* run = NULL;
+	size_t i;
+
+	for (i = 0; i < AGGREGATOR_MAX_RUNS; ++i) {
+		struct aggregator_run* r = &agg->runs[i];
+
+		if (r->active && r->type == type && r->address == address && r->endpoint == endpoint) {
+			run = r;
+			break;
+		}
+
+		if (!r->active && !run)
+			run = r;
+	}
+
+	/* Too many endpoints are polled at once */
+	if (!run) {
+		aggregator_emit_runs(agg);
+		run = &agg->runs[0];
+	}
+
+	if (!run->active) {
+		run->active = 1;
+		run->type = type;
+		run->address = address;
+		run->endpoint = endpoint;
+		run->count = 0;
+		run->first_frame = 0;
+		run->last_frame = 0;
+		run->first_ts = token->timestamp;
+	}
+
+	run->count++;
+	run->last_ts = nak->timestamp;
+	agg->token_held = 0;
+
+	if (run->count >= AGGREGATOR_MAX_COUNT)
+		aggregator_emit_runs(agg);
+}
+
+OPENVIZSLA_EXPORT
+struct ov_aggregator* ov_aggregator_new(int flags, ov_packet_decoder_callback callback, void* user_data) {
+	struct ov_aggregator* agg = NULL;
+
+	agg = calloc(1, sizeof(struct ov_aggregator));
+	if (!agg) {
+		return NULL;
+	}
+
+	agg->flags = flags;
+	agg->callback = callback;
+	agg->user_data = user_data;
+
+	return agg;
+}
+
+OPENVIZSLA_EXPORT
+void ov_aggregator_free(struct ov_aggregator* agg) {
+	free(agg);
+}
+
+OPENVIZSLA_EXPORT
+void ov_aggregator_packet(struct ov_packet* packet, void* data) {
+	struct ov_aggregator* agg = (struct ov_aggregator*)data;
+	const int plain = !(packet->flags & AGGREGATOR_SKIP_FLAGS);
+
+	if (agg->token_held) {
+		if (plain && packet->size == 1 && packet->data[0] == USB_PID_HANDSHAKE_NAK) {
+			aggregator_add_nak(agg, packet);
+			return;
+		}
+
+		aggregator_emit_runs(agg);
+		aggregator_emit_token(agg);
+	}
+
+	if (plain && (agg->flags & OV_AGGREGATE_SOF) && aggregator_is_token(packet, USB_PID_TOKEN_SOF)) {
+		aggregator_add_sof(agg, packet);
+		return;
+	}
+
+	if (plain && (agg->flags & OV_AGGREGATE_NAK)
+		&& (aggregator_is_token(packet, USB_PID_TOKEN_IN) || aggregator_is_token(packet, USB_PID_SPECIAL_PING))) {
+
+		memcpy(&agg->token, packet, sizeof(agg->token));
+		agg->token_held = 1;
+		return;
+	}
+
+	aggregator_emit_runs(agg);
+	aggregator_emit(agg, packet);
+}
+
+OPENVIZSLA_EXPORT
+void ov_aggregator_flush(struct ov_aggregator* agg) {
+	aggregator_emit_runs(agg);
+	aggregator_emit_token(agg);
+}
+
+ov_packet_decoder_callback aggregator_set_callback(struct ov_aggregator* agg, ov_packet_decoder_callback callback, void* user_data) {
+	ov_packet_decoder_callback old_callback = agg->callback;
+
+	agg->callback = callback;
+	agg->user_data = user_data;
+
+	return old_callback;
+}
@@ -0,0 +1,584 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifndef WIN32
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <aio_writer.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct aio_uring {
+	int fd;
+	void* sq_ptr;
+	size_t sq_size;
+	void* cq_ptr;
+	size_t cq_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+};
+
+static int uring_enter(struct aio_uring* uring, unsigned int to_submit, unsigned int min_complete) {
+	const unsigned int flags = (min_complete ? IORING_ENTER_GETEVENTS : 0);
+	long ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return (ret < 0 ? -1 : 0);
+}
+
+static int uring_probe_write(struct aio_uring* uring) {
+	const size_t ops_count = 256;
+	struct io_uring_probe* probe = NULL;
+	int ret = 0;
+
+	probe = calloc(1, sizeof(struct io_uring_probe) + ops_count * sizeof(struct io_uring_probe_op));
+	if (!probe)
+		return 0;
+
+	/* IORING_OP_WRITE appeared together with the probe interface */
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE, probe, ops_count) == 0)
+		ret = (probe->last_op >= IORING_OP_WRITE && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED));
+
+	free(probe);
+
+	return ret;
+}
+
+static void uring_destroy(struct aio_uring* uring) {
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->cq_ptr, uring->cq_size);
+	munmap(uring->sq_ptr, uring->sq_size);
+	close(uring->fd);
+	free(uring);
+}
+
+static struct aio_uring* uring_new(unsigned int entries) {
+	struct aio_uring* uring = NULL;
+	struct io_uring_params params;
+
+	uring = calloc(1, sizeof(struct aio_uring));
+	if (!uring) {
+		goto fail_malloc;
+	}
+
+	memset(&params, 0, sizeof(params));
+	uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (uring->fd < 0) {
+		goto fail_setup;
+	}
+
+	uring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring->sq_ptr = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->sq_ptr == MAP_FAILED) {
+		goto fail_mmap_sq;
+	}
+
+	uring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->cq_ptr = mmap(NULL, uring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+	if (uring->cq_ptr == MAP_FAILED) {
+		goto fail_mmap_cq;
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		goto fail_mmap_sqes;
+	}
+
+	uring->sq_head = (unsigned*)((char*)uring->sq_ptr + params.sq_off.head);
+	uring->sq_tail = (unsigned*)((char*)uring->sq_ptr + params.sq_off.tail);
+	uring->sq_mask = (unsigned*)((char*)uring->sq_ptr + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned*)((char*)uring->sq_ptr + params.sq_off.array);
+	uring->cq_head = (unsigned*)((char*)uring->cq_ptr + params.cq_off.head);
+	uring->cq_tail = (unsigned*)((char*)uring->cq_ptr + params.cq_off.tail);
+	uring->cq_mask = (unsigned*)((char*)uring->cq_ptr + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*)((char*)uring->cq_ptr + params.cq_off.cqes);
+
+	if (!uring_probe_write(uring)) {
+		uring_destroy(uring);
+		return NULL;
+	}
+
+	return uring;
+
+fail_mmap_sqes:
+	munmap(uring->cq_ptr, uring->cq_size);
+fail_mmap_cq:
+	munmap(uring->sq_ptr, uring->sq_size);
+fail_mmap_sq:
+	close(uring->fd);
+fail_setup:
+	free(uring);
+fail_malloc:
+
+	return NULL;
+}
+
+static int uring_submit_write(struct aio_uring* uring, struct aio_buffer* buffer, uint64_t index) {
+	const unsigned int tail = *uring->sq_tail;
+	const unsigned int slot = tail & *uring->sq_mask;
+	struct io_uring_sqe* sqe = &uring->sqes[slot];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = buffer->file->fd;
+	sqe->addr = (uintptr_t)(buffer->data + buffer->done);
+	sqe->len = buffer->length - buffer->done;
+	sqe->off = buffer->offset + buffer->done;
+	sqe->user_data = index;
+
+	uring->sq_array[slot] = slot;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	/* Without SQPOLL the kernel consumes entries only inside io_uring_enter().
+	 * An entry it took completes through the ring even if the call failed,
+	 * one it did not is withdrawn so its buffer is never written after reuse */
+	uring_enter(uring, 1, 0);
+	if (__atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) != tail)
+		return 0;
+
+	__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	return -1;
+}
+#else
+struct aio_uring;
+#endif
+
+static int aio_write_buffer(struct aio_buffer* buffer) {
+	while (buffer->done < buffer->length) {
+		ssize_t ret = pwrite(buffer->file->fd, buffer->data + buffer->done, buffer->length - buffer->done, buffer->offset + buffer->done);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		buffer->done += ret;
+	}
+
+	return 0;
+}
+
+static int aio_close_file(struct aio_file* file) {
+	int ret = 0;
+
+	/* Drop the padding of the last O_DIRECT block and the stale tail of
+	 * a reused file */
+	ret = ftruncate(file->fd, file->size);
+
+	if (close(file->fd) != 0)
+		ret = -1;
+
+	free(file);
+
+	return ret;
+}
+
+/* Called with lock held */
+static int aio_writer_release(struct aio_writer* aw, struct aio_file* file) {
+	if (!file->closing || file->writes > 0)
+		return 0;
+
+	if (aio_close_file(file) < 0) {
+		if (!aw->error_str)
+			aw->error_str = "Can not close file";
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Called with lock held */
+static void aio_writer_complete(struct aio_writer* aw, struct aio_buffer* buffer, int ret) {
+	struct aio_file* file = buffer->file;
+
+	if (ret < 0 && !aw->error_str)
+		aw->error_str = "Can not write file";
+
+	buffer->file = NULL;
+	buffer->next = aw->free_list;
+	aw->free_list = buffer;
+	aw->in_flight--;
+
+	file->writes--;
+	aio_writer_release(aw, file);
+}
+
+static void* aio_writer_thread(void* arg) {
+	struct aio_writer* aw = arg;
+	struct aio_buffer* buffer = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&aw->lock);
+	for (;;) {
+		while (!aw->queue_head && !aw->stop)
+			pthread_cond_wait(&aw->cond, &aw->lock);
+
+		buffer = aw->queue_head;
+		if (!buffer)
+			break;
+
+		aw->queue_head = buffer->next;
+		if (!aw->queue_head)
+			aw->queue_tail = NULL;
+		pthread_mutex_unlock(&aw->lock);
+
+		ret = aio_write_buffer(buffer);
+
+		pthread_mutex_lock(&aw->lock);
+		aio_writer_complete(aw, buffer, ret);
+		pthread_cond_broadcast(&aw->cond);
+	}
+	pthread_mutex_unlock(&aw->lock);
+
+	return NULL;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* Called with lock held */
+static int aio_writer_reap(struct aio_writer* aw, int wait) {
+	struct aio_uring* uring = aw->uring;
+	unsigned int head = *uring->cq_head;
+	unsigned int tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail && wait) {
+		if (uring_enter(uring, 0, 1) < 0) {
+			aw->error_str = "Can not wait for io_uring completion";
+			return -1;
+		}
+
+		tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	for (; head != tail; ++head) {
+		const struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cq_mask];
+		struct aio_buffer* buffer = &aw->buffers[cqe->user_data];
+		int ret = 0;
+
+		if (cqe->res > 0 && buffer->done + cqe->res < buffer->length) {
+			/* Short write, submit the remainder */
+			buffer->done += cqe->res;
+			if (uring_submit_write(uring, buffer, cqe->user_data) == 0)
+				continue;
+			ret = -1;
+		} else if (cqe->res < 0 || (cqe->res == 0 && buffer->length > 0)) {
+			ret = -1;
+		}
+
+		aio_writer_complete(aw, buffer, ret);
+	}
+
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+	return 0;
+}
+#endif
+
+int aio_writer_init(struct aio_writer* aw, size_t buf_count, size_t buf_size, unsigned int flags) {
+	size_t i;
+	int ret = 0;
+
+	memset(aw, 0, sizeof(struct aio_writer));
+
+	aw->flags = flags;
+	aw->file = NULL;
+	aw->buf_count = buf_count;
+	aw->buf_size = (buf_size + AIO_ALIGN - 1) & ~(size_t)(AIO_ALIGN - 1);
+
+	ret = posix_memalign((void**)&aw->memory, AIO_ALIGN, aw->buf_count * aw->buf_size);
+	if (ret != 0) {
+		aw->error_str = "Can not allocate buffers";
+		goto fail_memalign;
+	}
+
+	aw->buffers = calloc(buf_count, sizeof(struct aio_buffer));
+	if (!aw->buffers) {
+		aw->error_str = "Can not allocate buffers";
+		goto fail_malloc_buffers;
+	}
+
+	for (i = buf_count; i-- > 0;) {
+		aw->buffers[i].data = aw->memory + i * aw->buf_size;
+		aw->buffers[i].next = aw->free_list;
+		aw->free_list = &aw->buffers[i];
+	}
+
+	pthread_mutex_init(&aw->lock, NULL);
+	pthread_cond_init(&aw->cond, NULL);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (!(flags & AIO_THREAD))
+		aw->uring = uring_new(buf_count);
+#endif
+
+	if (!aw->uring) {
+		ret = pthread_create(&aw->thread, NULL, &aio_writer_thread, aw);
+		if (ret != 0) {
+			aw->error_str = "Can not create writer thread";
+			goto fail_pthread_create;
+		}
+	}
+
+	return 0;
+
+fail_pthread_create:
+	pthread_cond_destroy(&aw->cond);
+	pthread_mutex_destroy(&aw->lock);
+	free(aw->buffers);
+fail_malloc_buffers:
+	free(aw->memory);
+fail_memalign:
+
+	return -1;
+}
+
+int aio_writer_open(struct aio_writer* aw, const char* filename, uint64_t prealloc) {
+	/* Not truncated, a reused file keeps its blocks until it is closed */
+	const int flags = O_WRONLY | O_CREAT;
+	const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+	struct aio_file* file = NULL;
+
+	aw->file = NULL;
+	aw->direct = 0;
+	aw->offset = 0;
+
+	file = calloc(1, sizeof(struct aio_file));
+	if (!file) {
+		aw->error_str = "Can not allocate file";
+		return -1;
+	}
+
+	file->fd = -1;
+
+#ifdef O_DIRECT
+	if (aw->flags & AIO_DIRECT) {
+		file->fd = open(filename, flags | O_DIRECT, mode);
+		/* Not all filesystems support O_DIRECT, fall back to the page cache */
+		aw->direct = (file->fd >= 0);
+	}
+#endif
+	if (file->fd < 0)
+		file->fd = open(filename, flags, mode);
+
+	if (file->fd < 0) {
+		aw->error_str = "Can not open file";
+		free(file);
+		return -1;
+	}
+
+#if defined(__APPLE__) && defined(F_NOCACHE)
+	if (aw->flags & AIO_DIRECT)
+		fcntl(file->fd, F_NOCACHE, 1);
+#endif
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+	if (prealloc)
+		fallocate(file->fd, FALLOC_FL_KEEP_SIZE, 0, prealloc);
+#endif
+
+	aw->file = file;
+
+	return 0;
+}
+
+struct aio_buffer* aio_writer_get_buffer(struct aio_writer* aw) {
+	struct aio_buffer* buffer = NULL;
+
+	pthread_mutex_lock(&aw->lock);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (aw->uring) {
+		while (!aw->free_list && !aw->error_str)
+			aio_writer_reap(aw, 1);
+	} else
+#endif
+	{
+		while (!aw->free_list && !aw->error_str)
+			pthread_cond_wait(&aw->cond, &aw->lock);
+	}
+
+	if (!aw->error_str) {
+		buffer = aw->free_list;
+		aw->free_list = buffer->next;
+	}
+
+	pthread_mutex_unlock(&aw->lock);
+
+	return buffer;
+}
+
+static int aio_writer_queue(struct aio_writer* aw, struct aio_buffer* buffer) {
+	int ret = 0;
+
+	pthread_mutex_lock(&aw->lock);
+
+	aw->in_flight++;
+	buffer->file->writes++;
+	if (buffer->close)
+		buffer->file->closing = 1;
+
+	if (aw->error_str) {
+		aio_writer_complete(aw, buffer, -1);
+		pthread_mutex_unlock(&aw->lock);
+		return -1;
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (aw->uring) {
+		if (uring_submit_write(aw->uring, buffer, buffer - aw->buffers) < 0) {
+			aio_writer_complete(aw, buffer, -1);
+			ret = -1;
+		}
+
+		/* Recycle completed buffers early without waiting */
+		aio_writer_reap(aw, 0);
+
+		pthread_mutex_unlock(&aw->lock);
+
+		return ret;
+	}
+#endif
+
+	buffer->next = NULL;
+	if (aw->queue_tail)
+		aw->queue_tail->next = buffer;
+	else
+		aw->queue_head = buffer;
+	aw->queue_tail = buffer;
+
+	pthread_cond_broadcast(&aw->cond);
+	pthread_mutex_unlock(&aw->lock);
+
+	return ret;
+}
+
+int aio_writer_submit(struct aio_writer* aw, struct aio_buffer* buffer, size_t length) {
+	buffer->file = aw->file;
+	buffer->offset = aw->offset;
+	buffer->length = length;
+	buffer->done = 0;
+	buffer->close = 0;
+
+	aw->offset += length;
+
+	return aio_writer_queue(aw, buffer);
+}
+
+int aio_writer_close(struct aio_writer* aw, struct aio_buffer* buffer, size_t length) {
+	struct aio_file* file = aw->file;
+	int ret = 0;
+
+	if (!file)
+		return 0;
+
+	aw->file = NULL;
+
+	if (!buffer) {
+		/* Nothing left to write, close once the pending writes are done */
+		pthread_mutex_lock(&aw->lock);
+		file->size = aw->offset;
+		file->closing = 1;
+		ret = aio_writer_release(aw, file);
+		pthread_mutex_unlock(&aw->lock);
+
+		return ret;
+	}
+
+	buffer->file = file;
+	buffer->offset = aw->offset;
+	buffer->length = length;
+	buffer->done = 0;
+	buffer->close = 1;
+	file->size = aw->offset + length;
+
+	if (aw->direct) {
+		/* O_DIRECT requires whole blocks, the tail is truncated on close */
+		const size_t padded = (length + AIO_ALIGN - 1) & ~(size_t)(AIO_ALIGN - 1);
+
+		memset(buffer->data + length, 0, padded - length);
+		buffer->length = padded;
+	}
+
+	return aio_writer_queue(aw, buffer);
+}
+
+int aio_writer_wait(struct aio_writer* aw) {
+	int ret = 0;
+
+	pthread_mutex_lock(&aw->lock);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (aw->uring) {
+		while (aw->in_flight > 0 && aio_writer_reap(aw, 1) == 0)
+			;
+	} else
+#endif
+	{
+		while (aw->in_flight > 0)
+			pthread_cond_wait(&aw->cond, &aw->lock);
+	}
+
+	ret = (aw->error_str ? -1 : 0);
+
+	pthread_mutex_unlock(&aw->lock);
+
+	return ret;
+}
+
+void aio_writer_destroy(struct aio_writer* aw) {
+	if (aw->file)
+		aio_writer_close(aw, NULL, 0);
+
+	aio_writer_wait(aw);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (aw->uring) {
+		uring_destroy(aw->uring);
+		aw->uring = NULL;
+	} else
+#endif
+	{
+		pthread_mutex_lock(&aw->lock);
+		aw->stop = 1;
+		pthread_cond_broadcast(&aw->cond);
+		pthread_mutex_unlock(&aw->lock);
+
+		pthread_join(aw->thread, NULL);
+	}
+
+	pthread_cond_destroy(&aw->cond);
+	pthread_mutex_destroy(&aw->lock);
+	free(aw->buffers);
+	free(aw->memory);
+}
+
+int aio_writer_is_uring(struct aio_writer* aw) {
+	return (aw->uring != NULL);
+}
+
+#endif // WIN32
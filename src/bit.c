@@ -187,6 +187,9 @@ int bit_load_firmware(struct bit* bit, struct cha* cha, struct chb* chb) {
 			bit->error_str = ftdi_get_error_string(&cha->ftdi);
 			return -1;
 		}
+
+		/* Time of the bitstream writes overlaps, it only shows in the call total */
+		usbstat_add_write(cha->usbstat, i, 0);
 	}
 
 	if (ftdi_transfer_data_done(tc) < 0) {
@@ -198,7 +201,7 @@ int bit_load_firmware(struct bit* bit, struct cha* cha, struct chb* chb) {
 	memset(init_cycles, 0, sizeof(init_cycles));
 
 	for (try = 3;
-		try && (ret = ftdi_write_data(&cha->ftdi, init_cycles, sizeof(init_cycles))) > 0
+		try && (ret = usbstat_write_data(cha->usbstat, &cha->ftdi, init_cycles, sizeof(init_cycles))) > 0
 		&& (ret = chb_get_high(chb, &status)) == 0
 		&& !(status & PORTB_DONE_BIT);
 		--try);
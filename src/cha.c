@@ -1,12 +1,24 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
 
+#include <atomic.h>
 #include <cha.h>
 #include <decoder.h>
+#include <probe.h>
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 #include <libusb.h>
 
 #define OV_VENDOR  0x1d50
@@ -51,14 +63,14 @@ static int cha_sync_stream(struct cha* cha, uint16_t addr) {
 		goto fail_ftdi_tcioflush;
 	}
 
-	if (ftdi_write_data(&cha->ftdi, msg, sizeof(msg)) < 0) {
+	if (usbstat_write_data(cha->usbstat, &cha->ftdi, msg, sizeof(msg)) < 0) {
 		cha->error_str = ftdi_get_error_string(&cha->ftdi);
 		goto fail_ftdi_write_data;
 	}
 
 	/* FIXME: assign proper timeout to libftdi */
 	do {
-		if ((ret = ftdi_read_data(&cha->ftdi, buf, sizeof(buf))) < 0) {
+		if ((ret = usbstat_read_data(cha->usbstat, &cha->ftdi, buf, sizeof(buf))) < 0) {
 			cha->error_str = ftdi_get_error_string(&cha->ftdi);
 			goto fail_ftdi_read_data;
 		}
@@ -76,6 +88,8 @@ static int cha_sync_stream(struct cha* cha, uint16_t addr) {
 		}
 	} while (sync_state != 5);
 
+	usbstat_add_round_trip(cha->usbstat);
+
 	if (ftdi_tcioflush(&cha->ftdi) < 0) {
 		cha->error_str = ftdi_get_error_string(&cha->ftdi);
 		goto fail_ftdi_tcioflush;
@@ -95,19 +109,21 @@ static int cha_transaction(struct cha* cha, uint16_t addr, uint8_t in_val, uint8
 
 	msg[4] = cha_transaction_checksum(msg, 4);
 
-	if (ftdi_write_data(&cha->ftdi, msg, sizeof(msg)) < 0) {
+	if (usbstat_write_data(cha->usbstat, &cha->ftdi, msg, sizeof(msg)) < 0) {
 		cha->error_str = ftdi_get_error_string(&cha->ftdi);
 		goto fail_ftdi_write_data;
 	}
 
 	/* FIXME: assign proper timeout to libftdi */
 	do {
-		if ((ret = ftdi_read_data(&cha->ftdi, msg, sizeof(msg))) < 0) {
+		if ((ret = usbstat_read_data(cha->usbstat, &cha->ftdi, msg, sizeof(msg))) < 0) {
 			cha->error_str = ftdi_get_error_string(&cha->ftdi);
 			goto fail_ftdi_read_data;
 		}
 	} while (ret == 0);
 
+	usbstat_add_round_trip(cha->usbstat);
+
 	if (cha_transaction_checksum(msg, 4) != msg[4]) {
 		cha->error_str = "Wrong checksum";
 		goto fail_transaction_checksum;
@@ -158,6 +174,8 @@ int cha_init(struct cha* cha, struct fwpkg* fwpkg) {
 	int ret = 0;
 
 	memset(cha, 0, sizeof(struct cha));
+	cha->ring_base = 0;
+	cha->ring_end = OV_SDRAM_RING_DEFAULT_SIZE;
 
 	ret = reg_init_from_fwpkg(&cha->reg, fwpkg);
 	if (ret < 0) {
@@ -221,7 +239,7 @@ int cha_switch_fifo_mode(struct cha* cha) {
 		goto fail_switch_mode;
 	}
 
-	if (ftdi_write_data(&cha->ftdi, init_cycles, sizeof(init_cycles)) < 0) {
+	if (usbstat_write_data(cha->usbstat, &cha->ftdi, init_cycles, sizeof(init_cycles)) < 0) {
 		cha->error_str = ftdi_get_error_string(&cha->ftdi);
 		goto fail_ftdi_write_data;
 	}
@@ -249,12 +267,20 @@ static int cha_read_reg(struct cha* cha, uint16_t addr, uint8_t* val) {
 	return cha_transaction(cha, addr, 0, val);
 }
 
+static void cha_frame(uint8_t* msg, uint16_t addr, uint8_t val) {
+	msg[0] = 0x55;
+	msg[1] = addr >> 8;
+	msg[2] = addr & 0xFF;
+	msg[3] = val;
+	msg[4] = cha_transaction_checksum(msg, 4);
+}
+
 static int cha_cast_reg(struct cha* cha, uint16_t addr, uint8_t val) {
-	uint8_t msg[5] = {0x55, 0x80 | (addr >> 8), addr & 0xFF, val, 0x00};
+	uint8_t msg[5];
 
-	msg[4] = cha_transaction_checksum(msg, 4);
+	cha_frame(msg, 0x8000 | addr, val);
 
-	if (ftdi_write_data(&cha->ftdi, msg, sizeof(msg)) < 0) {
+	if (usbstat_write_data(cha->usbstat, &cha->ftdi, msg, sizeof(msg)) < 0) {
 		cha->error_str = ftdi_get_error_string(&cha->ftdi);
 		goto fail_ftdi_write_data;
 	}
@@ -401,9 +427,26 @@ int cha_set_usb_speed(struct cha* cha, enum ov_usb_speed speed) {
 	return 0;
 }
 
+int cha_set_sdram_ring(struct cha* cha, uint32_t base, uint32_t size) {
+	if (size < OV_SDRAM_RING_ALIGN || base % OV_SDRAM_RING_ALIGN || size % OV_SDRAM_RING_ALIGN) {
+		cha->error_str = "SDRAM ring has to be aligned to OV_SDRAM_RING_ALIGN";
+		return -1;
+	}
+
+	if (base > OV_SDRAM_SIZE || size > OV_SDRAM_SIZE - base) {
+		cha->error_str = "SDRAM ring exceeds the SDRAM";
+		return -1;
+	}
+
+	cha->ring_base = base;
+	cha->ring_end = base + size;
+
+	return 0;
+}
+
 int cha_start_stream(struct cha* cha) {
-	const uint32_t ring_base = 0;
-	const uint32_t ring_end = 0x01000000;
+	const uint32_t ring_base = cha->ring_base;
+	const uint32_t ring_end = cha->ring_end;
 
 	int ret = 0;
 
@@ -510,31 +553,363 @@ static void cha_loop_cancel_transfer(struct cha_loop* loop) {
 	}
 }
 
+static void cha_loop_set_state(struct cha_loop* loop, enum cha_loop_state state) {
+	PROBE2(loop_state, loop->state, state);
+
+	loop->state = state;
+}
+
+static uint64_t cha_loop_latency_start(struct cha_loop* loop) {
+	return (loop->latency.enabled ? timestamp_raw_ns() : 0);
+}
+
+static void cha_loop_latency_callback(struct cha_loop* loop, uint64_t start_ns) {
+	/* Not timed when the monitor was enabled from the callback */
+	if (loop->latency.enabled && start_ns)
+		loop->latency.callback_ns += timestamp_raw_ns() - start_ns;
+}
+
+/* Record the transfer and check the load once per interval */
+static void cha_loop_latency_update(struct cha_loop* loop, uint64_t start_ns, size_t bytes) {
+	struct cha_latency* latency = &loop->latency;
+	const uint64_t now = timestamp_raw_ns();
+	const uint64_t total_ns = now - start_ns;
+	const uint64_t callback_ns = MIN(latency->callback_ns, total_ns);
+	int slow;
+
+	histogram_record(&latency->histogram[OV_LATENCY_CALLBACK], callback_ns);
+	histogram_record(&latency->histogram[OV_LATENCY_DECODE], total_ns - callback_ns);
+
+	if (latency->window_start_ns == 0)
+		latency->window_start_ns = start_ns;
+
+	latency->load.bytes += bytes;
+	latency->load.callback_ns += callback_ns;
+	latency->load.decode_ns += total_ns - callback_ns;
+
+	if (now - latency->window_start_ns < (uint64_t)CHA_LOOP_LOAD_INTERVAL_MS * 1000000)
+		return;
+
+	latency->load.interval_ns = now - latency->window_start_ns;
+
+	/* Busy for longer than the budget of the time the data took to arrive */
+	slow = (latency->load.callback_ns + latency->load.decode_ns) * 100 > latency->load.interval_ns * latency->budget_percent;
+	latency->load.slow = slow;
+
+	if (latency->callback && latency->budget_percent > 0 && slow != latency->slow)
+		latency->callback(&latency->load, latency->user_data);
+
+	latency->slow = slow;
+	latency->window_start_ns = now;
+	memset(&latency->load, 0, sizeof(latency->load));
+}
+
+static void cha_loop_check_break(struct cha_loop* loop) {
+	if (loop->state == RUNNING && atomic_load_long(&loop->break_requested)) {
+		cha_loop_set_state(loop, BREAK_LOOP);
+
+		cha_loop_cancel_transfer(loop);
+	}
+}
+
 static void cha_loop_packet_callback(void* data, struct ov_packet* packet) {
 	struct cha_loop* loop = (struct cha_loop*)data;
+	uint8_t flags;
+
+	cha_loop_check_break(loop);
 
 	/* When the loop is stopped via cha_loop_break(), leftover packets may
 	 * follow from the read data buffer. */
 	if (loop->state != RUNNING)
 		return;
 
+	flags = packet->flags;
+
+	if (loop->ts.mode != OV_TIMESTAMP_RAW)
+		packet->timestamp = timestamp_convert(&loop->ts, packet->timestamp);
+
+	PROBE4(packet, packet->timestamp, packet->size, flags, loop->count);
+
 	if (loop->callback) {
+		const uint64_t start_ns = cha_loop_latency_start(loop);
+
 		loop->callback(packet, loop->user_data);
+
+		cha_loop_latency_callback(loop, start_ns);
+	}
+
+	/* The callback kept a reference, so decode the next packet elsewhere */
+	if (loop->pool && atomic_load_long(&packet_slot_from_packet(packet)->refcount) > 1) {
+		struct ov_packet* next = packet_pool_get(loop->pool);
+
+		if (!next) {
+			cha_loop_set_state(loop, FATAL_ERROR);
+			loop->cha->error_str = "Cannot allocate memory for packet pool";
+			return;
+		}
+
+		packet_decoder_set_packet(&loop->fd.pd, next, PACKET_SLOT_SIZE - PACKET_SLOT_HEADER_SIZE);
+		ov_packet_unref(packet);
+	}
+
+	/* The packet header becomes the record header, the record callback
+	 * may be called when the buffer is full */
+	if (loop->records) {
+		const uint64_t start_ns = cha_loop_latency_start(loop);
+
+		record_buffer_commit(loop->records);
+		cha_loop_latency_callback(loop, start_ns);
+		packet_decoder_set_packet(&loop->fd.pd, record_buffer_packet(loop->records), sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE);
 	}
 
-	if (loop->max_count > 0 && loop->count++ >= loop->max_count)
-		loop->state = COUNT_LIMIT;
+	loop->count++;
+
+	/* Persistent loop returns between transfers, so no data is dropped */
+	if (loop->max_count > 0 && loop->count > loop->max_count && !loop->persistent)
+		cha_loop_set_state(loop, COUNT_LIMIT);
 
-	if (packet->flags & OV_FLAGS_HF0_LAST)
-		loop->state = END_OF_STREAM;
+	if (flags & OV_FLAGS_HF0_LAST)
+		cha_loop_set_state(loop, END_OF_STREAM);
+}
+
+static void cha_loop_rearm_complete(struct cha_loop* loop, int status) {
+	struct cha_rearm rearm = loop->rearm;
+
+	loop->rearm.state = CHA_REARM_IDLE;
+	loop->rearm.sampling = 0;
+
+	if (rearm.callback)
+		rearm.callback(status, rearm.user_data);
+}
+
+static void cha_loop_rearm_paused(int status, uint8_t value, void* data) {
+	struct cha_loop* loop = (struct cha_loop*)data;
+
+	(void)value;
+
+	if (status < 0) {
+		cha_loop_rearm_complete(loop, status);
+		return;
+	}
+
+	loop->rearm.state = CHA_REARM_DRAINING;
+}
+
+static void cha_loop_rearm_sampled(struct cha_loop* loop, uint32_t backlog) {
+	loop->rearm.sampling = 0;
+
+	if (backlog > 0)
+		return;
+
+	/* Last packets of the old session go out before the boundary */
+	if (loop->records)
+		record_buffer_flush(loop->records);
+
+	/* The device keeps counting while paused, so the first delta after the
+	 * resume spans the pause. Ticks count from the last old packet, whose
+	 * time the new session continues from. */
+	timestamp_restart(&loop->ts, loop->fd.pd.cumulative_ts);
+	packet_decoder_reset_timestamp(&loop->fd.pd);
+	cha_loop_rearm_complete(loop, 0);
+
+	if (cha_loop_resume(loop) < 0)
+		cha_loop_set_state(loop, FATAL_ERROR);
+}
+
+static void cha_loop_backlog_update(struct cha_loop* loop) {
+	struct cha_backlog* backlog = &loop->backlog;
+	const uint32_t size = loop->cha->ring_end - loop->cha->ring_base;
+	const uint32_t previous = backlog->stats.current;
+	const uint32_t current = (backlog->wptr >= backlog->rptr ? backlog->wptr - backlog->rptr : size - (backlog->rptr - backlog->wptr));
+
+	backlog->stats.current = current;
+	backlog->stats.ring_size = size;
+	backlog->stats.samples++;
+
+	if (current > backlog->stats.high_water)
+		backlog->stats.high_water = current;
+
+	if (backlog->callback && backlog->threshold > 0 && (previous < backlog->threshold) != (current < backlog->threshold))
+		backlog->callback(&backlog->stats, backlog->user_data);
+
+	if (loop->rearm.state == CHA_REARM_DRAINING)
+		cha_loop_rearm_sampled(loop, current);
+}
+
+/* Latch the SDRAM SINK pointers and read them back through the stream */
+static int cha_loop_backlog_request(struct cha_loop* loop) {
+	struct cha* cha = loop->cha;
+	struct reg* reg = &cha->reg;
+	uint8_t msg[9 * 5];
+	size_t i;
+
+	cha_frame(msg, 0x8000 | reg->addr[SDRAM_SINK_PTR_READ], 0);
+	for (i = 0; i < 4; ++i) {
+		cha_frame(msg + 5 * (1 + i), reg->addr[SDRAM_SINK_WPTR] + i, 0);
+		cha_frame(msg + 5 * (5 + i), reg->addr[SDRAM_SINK_RPTR] + i, 0);
+	}
+
+	if (usbstat_write_data(cha->usbstat, &cha->ftdi, msg, sizeof(msg)) < 0) {
+		cha->error_str = ftdi_get_error_string(&cha->ftdi);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void cha_loop_backlog_poll(struct cha_loop* loop) {
+	const uint64_t now = timestamp_monotonic_ns();
+
+	if (loop->backlog.interval_ms <= 0 || loop->state != RUNNING || now < loop->backlog.next_ns)
+		return;
+
+	loop->backlog.next_ns = now + (uint64_t)loop->backlog.interval_ms * 1000000;
+
+	if (cha_loop_backlog_request(loop) < 0)
+		cha_loop_set_state(loop, FATAL_ERROR);
+}
+
+/* Sample the pointers again until the ring is empty, a lost reply is retried */
+static void cha_loop_rearm_poll(struct cha_loop* loop) {
+	const uint64_t now = timestamp_monotonic_ns();
+
+	if (loop->rearm.state != CHA_REARM_DRAINING || loop->state != RUNNING)
+		return;
+
+	if (loop->rearm.sampling && now < loop->rearm.deadline_ns)
+		return;
+
+	loop->rearm.sampling = 1;
+	loop->rearm.deadline_ns = now + (uint64_t)CHA_LOOP_REQUEST_TIMEOUT_MS * 1000000;
+
+	if (cha_loop_backlog_request(loop) < 0)
+		cha_loop_set_state(loop, FATAL_ERROR);
+}
+
+/* Bus frame of the current step of the request, ULPI steps mirror
+ * cha_read_ulpi() and cha_write_ulpi() */
+static void cha_request_frame(struct cha_loop* loop, const struct cha_request* request, uint16_t* addr, uint8_t* value) {
+	const uint16_t* reg_addr = loop->cha->reg.addr;
+	const uint8_t cmd = UCFG_REG_GO | (request->addr & UCFG_REG_ADDRMASK);
+	const int step = request->step;
+
+	*value = 0;
+
+	switch (request->type) {
+	case CHA_REQUEST_READ: {
+		*addr = request->addr;
+	} break;
+	case CHA_REQUEST_WRITE: {
+		*addr = 0x8000 | request->addr;
+		*value = request->value;
+	} break;
+	case CHA_REQUEST_ULPI_READ: {
+		if (step == 0) {
+			*addr = 0x8000 | reg_addr[UCFG_RCMD];
+			*value = cmd;
+		} else {
+			*addr = reg_addr[step == 1 ? UCFG_RCMD : UCFG_RDATA];
+		}
+	} break;
+	case CHA_REQUEST_ULPI_WRITE: {
+		if (step < 2) {
+			*addr = 0x8000 | reg_addr[step == 0 ? UCFG_WDATA : UCFG_WCMD];
+			*value = step == 0 ? request->value : cmd;
+		} else {
+			*addr = reg_addr[UCFG_WCMD];
+		}
+	} break;
+	}
+}
+
+/* Return 1 when the reply completes the request */
+static int cha_request_advance(struct cha_request* request, uint8_t value) {
+	switch (request->type) {
+	case CHA_REQUEST_ULPI_READ: {
+		if (request->step == 0 || (request->step == 1 && !(value & UCFG_REG_GO)))
+			request->step++;
+		else if (request->step == 2)
+			return 1;
+	} break;
+	case CHA_REQUEST_ULPI_WRITE: {
+		if (request->step < 2)
+			request->step++;
+		else if (!(value & UCFG_REG_GO))
+			return 1;
+	} break;
+	default: {
+		return 1;
+	} break;
+	}
+
+	return 0;
+}
+
+static void cha_loop_request_complete(struct cha_loop* loop, int status, uint8_t value) {
+	struct cha_request request = loop->requests[loop->request_first];
+
+	loop->request_first = (loop->request_first + 1) % CHA_LOOP_REQUEST_COUNT;
+	loop->request_count--;
+	loop->request_sent = 0;
+
+	if (request.callback)
+		request.callback(status, value, request.user_data);
+}
+
+static void cha_loop_request_send(struct cha_loop* loop) {
+	struct cha* cha = loop->cha;
+	uint16_t addr;
+	uint8_t value;
+	uint8_t msg[5];
+
+	if (loop->request_sent) {
+		if (timestamp_monotonic_ns() > loop->request_deadline_ns)
+			cha_loop_request_complete(loop, -1, 0);
+
+		return;
+	}
+
+	if (loop->request_count == 0 || loop->state != RUNNING)
+		return;
+
+	cha_request_frame(loop, &loop->requests[loop->request_first], &addr, &value);
+	cha_frame(msg, addr, value);
+
+	/* The write pumps libusb events, so the reply may be decoded before it returns */
+	loop->request_sent = 1;
+	loop->request_addr = addr;
+	loop->request_deadline_ns = timestamp_monotonic_ns() + (uint64_t)CHA_LOOP_REQUEST_TIMEOUT_MS * 1000000;
+
+	if (usbstat_write_data(cha->usbstat, &cha->ftdi, msg, sizeof(msg)) < 0) {
+		loop->request_sent = 0;
+		cha->error_str = ftdi_get_error_string(&cha->ftdi);
+		cha_loop_set_state(loop, FATAL_ERROR);
+	}
 }
 
 static void cha_loop_bus_frame_callback(void* data, uint16_t addr, uint8_t value) {
 	struct cha_loop* loop = (struct cha_loop*)data;
 	struct reg* reg = &loop->cha->reg;
 
-	if ((addr & ~(0x8000)) == reg->addr[SDRAM_HOST_READ_GO] && value == 0)
-		loop->state = HOST_READ_OFF;
+	PROBE2(bus_frame, addr, value);
+
+	if (loop->request_sent && addr == loop->request_addr) {
+		loop->request_sent = 0;
+
+		if (cha_request_advance(&loop->requests[loop->request_first], value))
+			cha_loop_request_complete(loop, 0, value);
+	}
+
+	if ((addr & ~(0x8000)) == reg->addr[SDRAM_HOST_READ_GO] && value == 0) {
+		cha_loop_set_state(loop, HOST_READ_OFF);
+	} else if (addr >= reg->addr[SDRAM_SINK_WPTR] && addr < reg->addr[SDRAM_SINK_WPTR] + 4) {
+		loop->backlog.wptr = (loop->backlog.wptr << 8) | value;
+	} else if (addr >= reg->addr[SDRAM_SINK_RPTR] && addr < reg->addr[SDRAM_SINK_RPTR] + 4) {
+		loop->backlog.rptr = (loop->backlog.rptr << 8) | value;
+
+		if (addr == reg->addr[SDRAM_SINK_RPTR] + 3)
+			cha_loop_backlog_update(loop);
+	}
 }
 
 static void LIBUSB_CALL cha_loop_transfer_callback(struct libusb_transfer* transfer) {
@@ -545,8 +920,14 @@ static void LIBUSB_CALL cha_loop_transfer_callback(struct libusb_transfer* trans
 	int ret = 0;
 	size_t offset = 0;
 
+	PROBE4(transfer_complete, transfer, transfer->status, transfer->actual_length, loop->state);
+
 	switch (transfer->status) {
 		case LIBUSB_TRANSFER_COMPLETED: {
+			const uint64_t start_ns = cha_loop_latency_start(loop);
+
+			loop->latency.callback_ns = 0;
+
 			while (loop->state == RUNNING && offset < transfer->actual_length) {
 				size_t packet_length = MIN(transfer->actual_length - offset, ftdi->max_packet_size);
 				if (packet_length > 2) {
@@ -556,19 +937,38 @@ static void LIBUSB_CALL cha_loop_transfer_callback(struct libusb_transfer* trans
 						transfer->buffer + offset + 2,
 						packet_length - 2) < 0) {
 
-						loop->state = FATAL_ERROR;
+						PROBE3(decoder_error, loop->fd.pd.error_str, offset, packet_length);
+
+						cha_loop_set_state(loop, FATAL_ERROR);
 						cha->error_str = loop->fd.pd.error_str;
 					};
 				}
 				offset += packet_length;
 			}
 
+			if (loop->records) {
+				const uint64_t flush_ns = cha_loop_latency_start(loop);
+
+				record_buffer_flush(loop->records);
+				cha_loop_latency_callback(loop, flush_ns);
+			}
+
+			if (loop->latency.enabled && start_ns)
+				cha_loop_latency_update(loop, start_ns, transfer->actual_length);
+
+			/* Estimate clock drift from the transfer completion time */
+			if (loop->ts.mode != OV_TIMESTAMP_RAW)
+				timestamp_sample_now(&loop->ts);
+
+			if (loop->state == RUNNING)
+				PROBE2(transfer_submit, transfer, loop->active_transfers);
+
 			while (loop->state == RUNNING
 				&& (ret = libusb_submit_transfer(transfer)) < 0
 				&& ret == LIBUSB_ERROR_INTERRUPTED);
 
 			if (ret < 0) {
-				loop->state = FATAL_ERROR;
+				cha_loop_set_state(loop, FATAL_ERROR);
 				cha->error_str = libusb_error_name(ret);
 			}
 
@@ -587,7 +987,7 @@ static void LIBUSB_CALL cha_loop_transfer_callback(struct libusb_transfer* trans
 		case LIBUSB_TRANSFER_NO_DEVICE:
 		case LIBUSB_TRANSFER_OVERFLOW:
 		default: {
-			loop->state = FATAL_ERROR;
+			cha_loop_set_state(loop, FATAL_ERROR);
 			cha->error_str = libusb_error_name(transfer->status);
 
 			loop->complete = !(--loop->active_transfers);
@@ -595,15 +995,194 @@ static void LIBUSB_CALL cha_loop_transfer_callback(struct libusb_transfer* trans
 	}
 }
 
+static int cha_loop_wakeup_init(struct cha_loop* loop) {
+#if defined(__linux__)
+	loop->wakeup_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	loop->wakeup_fd[1] = loop->wakeup_fd[0];
+
+	return (loop->wakeup_fd[0] < 0 ? -1 : 0);
+#elif !defined(WIN32)
+	if (pipe(loop->wakeup_fd) < 0)
+		return -1;
+
+	for (size_t i = 0; i < 2; ++i) {
+		fcntl(loop->wakeup_fd[i], F_SETFL, fcntl(loop->wakeup_fd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(loop->wakeup_fd[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	return 0;
+#else
+	loop->wakeup_fd[0] = -1;
+	loop->wakeup_fd[1] = -1;
+
+	return 0;
+#endif
+}
+
+static void cha_loop_wakeup_destroy(struct cha_loop* loop) {
+#ifndef WIN32
+	close(loop->wakeup_fd[0]);
+	if (loop->wakeup_fd[1] != loop->wakeup_fd[0])
+		close(loop->wakeup_fd[1]);
+#endif
+}
+
+/* Async-signal-safe */
+static void cha_loop_wakeup(struct cha_loop* loop) {
+#ifndef WIN32
+	const uint64_t value = 1;
+	ssize_t ret;
+
+	/* Full pipe or eventfd counter means the wakeup is pending anyway */
+	do {
+		ret = write(loop->wakeup_fd[1], &value, sizeof(value));
+	} while (ret < 0 && errno == EINTR);
+#elif LIBUSB_API_VERSION >= 0x01000105
+	libusb_interrupt_event_handler(loop->cha->ftdi.usb_ctx);
+#endif
+}
+
+#ifndef WIN32
+static void cha_loop_wakeup_drain(struct cha_loop* loop) {
+	uint64_t value;
+	ssize_t ret;
+
+	do {
+		ret = read(loop->wakeup_fd[0], &value, sizeof(value));
+	} while (ret > 0 || (ret < 0 && errno == EINTR));
+}
+
+/* The libusb file descriptors followed by the wakeup fd. When libusb
+ * cannot provide them, e.g. on Windows, the array stays NULL. */
+static int cha_loop_pollfds_init(struct cha_loop* loop) {
+	const struct libusb_pollfd** usb_pollfds = libusb_get_pollfds(loop->cha->ftdi.usb_ctx);
+	size_t count = 0;
+
+	loop->pollfds = NULL;
+	loop->pollfd_count = 0;
+
+	if (!usb_pollfds)
+		return 0;
+
+	while (usb_pollfds[count])
+		count++;
+
+	loop->pollfds = malloc((count + 1) * sizeof(struct pollfd));
+	if (!loop->pollfds) {
+		libusb_free_pollfds(usb_pollfds);
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		loop->pollfds[i].fd = usb_pollfds[i]->fd;
+		loop->pollfds[i].events = usb_pollfds[i]->events;
+	}
+
+	loop->pollfds[count].fd = loop->wakeup_fd[0];
+	loop->pollfds[count].events = POLLIN;
+	loop->pollfd_count = count + 1;
+
+	libusb_free_pollfds(usb_pollfds);
+
+	return 0;
+}
+
+static void cha_loop_pollfds_destroy(struct cha_loop* loop) {
+	free(loop->pollfds);
+	loop->pollfds = NULL;
+	loop->pollfd_count = 0;
+}
+
+static void LIBUSB_CALL cha_loop_pollfd_added(int fd, short events, void* user_data) {
+	struct cha_loop* loop = (struct cha_loop*)user_data;
+	struct pollfd* pollfds = NULL;
+
+	if (!loop->pollfds)
+		return;
+
+	pollfds = realloc(loop->pollfds, (loop->pollfd_count + 1) * sizeof(struct pollfd));
+	if (!pollfds) {
+		/* Fall back to the libusb own event waiting */
+		cha_loop_pollfds_destroy(loop);
+		return;
+	}
+
+	pollfds[loop->pollfd_count] = pollfds[loop->pollfd_count - 1];
+	pollfds[loop->pollfd_count - 1].fd = fd;
+	pollfds[loop->pollfd_count - 1].events = events;
+	loop->pollfds = pollfds;
+	loop->pollfd_count++;
+
+	if (loop->pollfd_added)
+		loop->pollfd_added(fd, events, loop->pollfd_user_data);
+}
+
+static void LIBUSB_CALL cha_loop_pollfd_removed(int fd, void* user_data) {
+	struct cha_loop* loop = (struct cha_loop*)user_data;
+
+	for (size_t i = 0; loop->pollfds && i + 1 < loop->pollfd_count; ++i) {
+		if (loop->pollfds[i].fd != fd)
+			continue;
+
+		memmove(&loop->pollfds[i], &loop->pollfds[i + 1], (loop->pollfd_count - i - 1) * sizeof(struct pollfd));
+		loop->pollfd_count--;
+		break;
+	}
+
+	if (loop->pollfd_removed)
+		loop->pollfd_removed(fd, loop->pollfd_user_data);
+}
+#endif
+
+static int cha_loop_handle_events(struct cha_loop* loop, struct timeval* timeout) {
+	libusb_context* usb_ctx = loop->cha->ftdi.usb_ctx;
+
+#ifndef WIN32
+	if (loop->pollfds) {
+		struct timeval next;
+		struct timeval zero = {0, 0};
+		long timeout_ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+		int ret;
+
+		if (libusb_get_next_timeout(usb_ctx, &next) == 1) {
+			const long next_ms = next.tv_sec * 1000 + (next.tv_usec + 999) / 1000;
+
+			if (next_ms < timeout_ms)
+				timeout_ms = next_ms;
+		}
+
+		for (size_t i = 0; i < loop->pollfd_count; ++i)
+			loop->pollfds[i].revents = 0;
+
+		ret = poll(loop->pollfds, loop->pollfd_count, (int)timeout_ms);
+		if (ret < 0 && errno != EINTR)
+			return LIBUSB_ERROR_IO;
+
+		if (loop->pollfds[loop->pollfd_count - 1].revents)
+			cha_loop_wakeup_drain(loop);
+
+		return libusb_handle_events_timeout_completed(usb_ctx, &zero, &loop->complete);
+	}
+#endif
+
+	return libusb_handle_events_timeout_completed(usb_ctx, timeout, &loop->complete);
+}
+
 int cha_loop_init(struct cha_loop* loop, struct cha* cha, struct ov_packet* packet, size_t packet_size, ov_packet_decoder_callback callback, void* user_data) {
-	const size_t buffer_size = 4096;
+	const size_t buffer_size = CHA_LOOP_BUFFER_SIZE;
 
 	struct ftdi_context* ftdi = &cha->ftdi;
 
 	loop->cha = cha;
 	loop->callback = callback;
 	loop->user_data = user_data;
+	loop->pool = NULL;
+	loop->records = NULL;
 	loop->state = RUNNING;
+	loop->active_transfers = 0;
+	loop->persistent = 0;
+
+	timestamp_init(&loop->ts, OV_TIMESTAMP_RAW, 0, 0);
 
 	struct decoder_ops ops = {
 		.packet = &cha_loop_packet_callback,
@@ -615,6 +1194,34 @@ int cha_loop_init(struct cha_loop* loop, struct cha* cha, struct ov_packet* pack
 		goto fail_frame_decode_init;
 	}
 
+	loop->break_requested = 0;
+	loop->pollfds = NULL;
+	loop->pollfd_count = 0;
+
+	if (cha_loop_wakeup_init(loop) < 0) {
+		cha->error_str = "Can not create wakeup file descriptor";
+		goto fail_cha_loop_wakeup_init;
+	}
+
+#ifndef WIN32
+	if (cha_loop_pollfds_init(loop) < 0) {
+		cha->error_str = "Can not allocate poll file descriptors";
+		goto fail_cha_loop_pollfds_init;
+	}
+
+	libusb_set_pollfd_notifiers(ftdi->usb_ctx, &cha_loop_pollfd_added, &cha_loop_pollfd_removed, loop);
+#endif
+	loop->pollfd_added = NULL;
+	loop->pollfd_removed = NULL;
+	loop->pollfd_user_data = NULL;
+	memset(&loop->backlog, 0, sizeof(loop->backlog));
+	loop->request_first = 0;
+	loop->request_count = 0;
+	loop->request_sent = 0;
+	memset(&loop->rearm, 0, sizeof(loop->rearm));
+	memset(&loop->latency, 0, sizeof(loop->latency));
+	cha_loop_reset_latency(loop);
+
 	size_t i = 0;
 	while (i < sizeof(loop->transfer) / sizeof(loop->transfer[0])) {
 		struct libusb_transfer* tx = libusb_alloc_transfer(0);
@@ -642,23 +1249,24 @@ fail_libusb_alloc_transfer:
 	for (; i > 0; --i) {
 		libusb_free_transfer(loop->transfer[i - 1]);
 	}
+#ifndef WIN32
+	libusb_set_pollfd_notifiers(ftdi->usb_ctx, NULL, NULL, NULL);
+	cha_loop_pollfds_destroy(loop);
+fail_cha_loop_pollfds_init:
+#endif
+	cha_loop_wakeup_destroy(loop);
+fail_cha_loop_wakeup_init:
 fail_frame_decode_init:
 	return -1;
 }
 
-int cha_loop_run(struct cha_loop* loop, int count) {
+static void cha_loop_submit(struct cha_loop* loop) {
 	struct cha* cha = loop->cha;
-	struct ftdi_context* ftdi = &cha->ftdi;
-
 	int ret = 0;
 
-	loop->count = 0;
-	loop->max_count = count;
-	loop->complete = 0;
-
-	if (loop->state == FATAL_ERROR) {
-		return -loop->state;
-	}
+	/* Transfers are kept in flight by cha_loop_run_timeout() */
+	if (loop->active_transfers > 0)
+		return;
 
 	for (loop->active_transfers = 0;
 		loop->active_transfers < sizeof(loop->transfer) / sizeof(loop->transfer[0]);
@@ -666,8 +1274,10 @@ int cha_loop_run(struct cha_loop* loop, int count) {
 
 		struct libusb_transfer* tx = loop->transfer[loop->active_transfers];
 
-		if (libusb_submit_transfer(tx) < 0) {
-			loop->state = FATAL_ERROR;
+		PROBE2(transfer_submit, tx, loop->active_transfers);
+
+		if ((ret = libusb_submit_transfer(tx)) < 0) {
+			cha_loop_set_state(loop, FATAL_ERROR);
 			cha->error_str = libusb_error_name(ret);
 
 			break;
@@ -677,22 +1287,87 @@ int cha_loop_run(struct cha_loop* loop, int count) {
 	if (loop->state != RUNNING) {
 		cha_loop_cancel_transfer(loop);
 	}
+}
+
+/* When persistent, the loop returns with transfers in flight once count
+ * packets are processed or the timeout expires. Otherwise, it returns
+ * only after all transfers are cancelled. Negative timeout means no
+ * timeout. */
+static int cha_loop_run_internal(struct cha_loop* loop, int count, int timeout_ms, int persistent) {
+	struct cha* cha = loop->cha;
+	const uint64_t deadline = timestamp_monotonic_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000;
+	int handled = 0;
+	int ret = 0;
+
+	loop->count = 0;
+	loop->max_count = count;
+	loop->complete = 0;
+	loop->persistent = persistent;
+
+	if (loop->state == FATAL_ERROR) {
+		return -loop->state;
+	}
+
+	cha_loop_submit(loop);
 
 	do {
 		struct timeval timeout = {1, 0};
 
-		if ((ret = libusb_handle_events_timeout_completed(ftdi->usb_ctx, &timeout, &loop->complete)) < 0
+		cha_loop_check_break(loop);
+
+		if (persistent && loop->state == RUNNING) {
+			if (count > 0 && loop->count >= count)
+				break;
+
+			if (timeout_ms >= 0) {
+				const uint64_t now = timestamp_monotonic_ns();
+				const uint64_t remaining = (deadline > now ? deadline - now : 0);
+
+				/* Events which are already pending are handled at least once */
+				if (handled && remaining == 0)
+					break;
+
+				if (remaining < 1000000000) {
+					timeout.tv_sec = 0;
+					timeout.tv_usec = remaining / 1000;
+				}
+			}
+		}
+
+		/* Wake up in time for the next backlog sample */
+		if (loop->backlog.interval_ms > 0 && loop->backlog.interval_ms < timeout.tv_sec * 1000 + timeout.tv_usec / 1000) {
+			timeout.tv_sec = loop->backlog.interval_ms / 1000;
+			timeout.tv_usec = (loop->backlog.interval_ms % 1000) * 1000;
+		}
+
+		if ((ret = cha_loop_handle_events(loop, &timeout)) < 0
 			&& ret != LIBUSB_ERROR_INTERRUPTED
 			&& ret != LIBUSB_ERROR_TIMEOUT) {
 
-			loop->state = FATAL_ERROR;
+			cha_loop_set_state(loop, FATAL_ERROR);
 			cha->error_str = libusb_error_name(ret);
 		}
+
+		cha_loop_backlog_poll(loop);
+		cha_loop_rearm_poll(loop);
+		cha_loop_request_send(loop);
+
+		handled = 1;
 	} while (!loop->complete);
 
-	assert(loop->state != RUNNING);
+	if (loop->state == RUNNING) {
+		assert(persistent);
+
+		return loop->count;
+	}
+
 	assert(loop->active_transfers == 0);
 
+	/* Break request is consumed when the loop returns because of it */
+	if (loop->state == BREAK_LOOP) {
+		atomic_store_long(&loop->break_requested, 0);
+	}
+
 	if (loop->state != COUNT_LIMIT) {
 		return -loop->state;
 	}
@@ -700,6 +1375,168 @@ int cha_loop_run(struct cha_loop* loop, int count) {
 	return loop->count;
 }
 
+int cha_loop_run(struct cha_loop* loop, int count) {
+	return cha_loop_run_internal(loop, count, -1, 0);
+}
+
+int cha_loop_run_timeout(struct cha_loop* loop, int count, int timeout_ms) {
+	return cha_loop_run_internal(loop, count, timeout_ms, 1);
+}
+
+void cha_loop_set_timestamp_mode(struct cha_loop* loop, enum ov_timestamp_mode mode) {
+	timestamp_start(&loop->ts, mode);
+}
+
+void cha_loop_set_filter(struct cha_loop* loop, const struct filter* filter) {
+	packet_decoder_set_filter(&loop->fd.pd, filter);
+}
+
+void cha_loop_set_validation(struct cha_loop* loop, int enable) {
+	packet_decoder_set_validation(&loop->fd.pd, enable);
+}
+
+void cha_loop_set_snaplen(struct cha_loop* loop, size_t snaplen) {
+	packet_decoder_set_snaplen(&loop->fd.pd, snaplen);
+}
+
+int cha_loop_set_pool(struct cha_loop* loop, struct packet_pool* pool) {
+	struct ov_packet* packet = packet_pool_get(pool);
+
+	if (!packet) {
+		loop->cha->error_str = "Cannot allocate memory for packet pool";
+		return -1;
+	}
+
+	loop->pool = pool;
+	packet_decoder_set_packet(&loop->fd.pd, packet, PACKET_SLOT_SIZE - PACKET_SLOT_HEADER_SIZE);
+
+	return 0;
+}
+
+/* Records are not delivered any more after detaching, e.g. while draining */
+void cha_loop_set_records(struct cha_loop* loop, struct record_buffer* records) {
+	loop->records = records;
+
+	if (records)
+		packet_decoder_set_packet(&loop->fd.pd, record_buffer_packet(records), sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE);
+}
+
+int cha_loop_get_pollfds(struct cha_loop* loop, struct ov_pollfd* pollfds, size_t count) {
+	if (!loop->pollfds) {
+		loop->cha->error_str = "File descriptors are not available on this platform";
+		return -1;
+	}
+
+	for (size_t i = 0; i < count && i < loop->pollfd_count; ++i) {
+		pollfds[i].fd = loop->pollfds[i].fd;
+		pollfds[i].events = loop->pollfds[i].events;
+	}
+
+	return (int)loop->pollfd_count;
+}
+
+int cha_loop_request(struct cha_loop* loop, enum cha_request_type type, uint16_t addr, uint8_t value, ov_register_callback callback, void* user_data) {
+	struct cha_request* request;
+
+	if (loop->request_count == CHA_LOOP_REQUEST_COUNT) {
+		loop->cha->error_str = "Too many register requests in flight";
+		return -1;
+	}
+
+	request = &loop->requests[(loop->request_first + loop->request_count) % CHA_LOOP_REQUEST_COUNT];
+	request->type = type;
+	request->addr = addr;
+	request->value = value;
+	request->step = 0;
+	request->callback = callback;
+	request->user_data = user_data;
+	loop->request_count++;
+
+	return 0;
+}
+
+void cha_loop_abort_requests(struct cha_loop* loop) {
+	while (loop->request_count > 0)
+		cha_loop_request_complete(loop, -1, 0);
+
+	if (loop->rearm.state != CHA_REARM_IDLE)
+		cha_loop_rearm_complete(loop, -1);
+}
+
+/* CSTREAM stops feeding the SDRAM SINK, host reads go on */
+int cha_loop_pause(struct cha_loop* loop) {
+	return cha_loop_request(loop, CHA_REQUEST_WRITE, loop->cha->reg.addr[CSTREAM_CFG], 0, NULL, NULL);
+}
+
+int cha_loop_resume(struct cha_loop* loop) {
+	return cha_loop_request(loop, CHA_REQUEST_WRITE, loop->cha->reg.addr[CSTREAM_CFG], 1, NULL, NULL);
+}
+
+int cha_loop_rearm(struct cha_loop* loop, ov_session_callback callback, void* user_data) {
+	if (loop->rearm.state != CHA_REARM_IDLE) {
+		loop->cha->error_str = "Re-arm already in progress";
+		return -1;
+	}
+
+	if (cha_loop_request(loop, CHA_REQUEST_WRITE, loop->cha->reg.addr[CSTREAM_CFG], 0, &cha_loop_rearm_paused, loop) < 0)
+		return -1;
+
+	loop->rearm.state = CHA_REARM_PAUSING;
+	loop->rearm.sampling = 0;
+	loop->rearm.callback = callback;
+	loop->rearm.user_data = user_data;
+
+	return 0;
+}
+
+void cha_loop_set_backlog_monitor(struct cha_loop* loop, int interval_ms, uint32_t threshold, ov_backlog_callback callback, void* user_data) {
+	loop->backlog.interval_ms = interval_ms;
+	loop->backlog.next_ns = 0;
+	loop->backlog.threshold = threshold;
+	loop->backlog.callback = callback;
+	loop->backlog.user_data = user_data;
+}
+
+void cha_loop_set_latency_monitor(struct cha_loop* loop, int enable, int budget_percent, ov_consumer_load_callback callback, void* user_data) {
+	/* Start a new load interval, the old one was not timed throughout */
+	if (enable && !loop->latency.enabled) {
+		loop->latency.window_start_ns = 0;
+		loop->latency.slow = 0;
+		memset(&loop->latency.load, 0, sizeof(loop->latency.load));
+	}
+
+	loop->latency.enabled = enable;
+	loop->latency.budget_percent = budget_percent;
+	loop->latency.callback = callback;
+	loop->latency.user_data = user_data;
+}
+
+void cha_loop_reset_latency(struct cha_loop* loop) {
+	histogram_reset(&loop->latency.histogram[OV_LATENCY_CALLBACK]);
+	histogram_reset(&loop->latency.histogram[OV_LATENCY_DECODE]);
+}
+
+void cha_loop_get_backlog(struct cha_loop* loop, struct ov_backlog* backlog) {
+	*backlog = loop->backlog.stats;
+}
+
+void cha_loop_set_pollfd_notifiers(struct cha_loop* loop, ov_pollfd_added_callback added, ov_pollfd_removed_callback removed, void* user_data) {
+	loop->pollfd_added = added;
+	loop->pollfd_removed = removed;
+	loop->pollfd_user_data = user_data;
+}
+
+/* Timeouts of libusb which are not signalled by its file descriptors */
+int cha_loop_get_timeout(struct cha_loop* loop) {
+	libusb_context* usb_ctx = loop->cha->ftdi.usb_ctx;
+	struct timeval next;
+
+	if (libusb_pollfds_handle_timeouts(usb_ctx) || libusb_get_next_timeout(usb_ctx, &next) != 1)
+		return -1;
+
+	return next.tv_sec * 1000 + (next.tv_usec + 999) / 1000;
+}
+
 ov_packet_decoder_callback cha_loop_set_callback(struct cha_loop* loop, ov_packet_decoder_callback callback, void* user_data) {
 	ov_packet_decoder_callback old_callback = loop->callback;
 
@@ -709,18 +1546,32 @@ ov_packet_decoder_callback cha_loop_set_callback(struct cha_loop* loop, ov_packe
 	return old_callback;
 }
 
+/* Safe to call from any thread and from a signal handler */
 void cha_loop_break(struct cha_loop* loop) {
-	loop->state = BREAK_LOOP;
+	atomic_store_long(&loop->break_requested, 1);
 
-	cha_loop_cancel_transfer(loop);
+	cha_loop_wakeup(loop);
 }
 
 void cha_loop_destroy(struct cha_loop* loop) {
 	assert(loop->active_transfers == 0);
 
+	cha_loop_abort_requests(loop);
+
+	if (loop->pool) {
+		ov_packet_unref(loop->fd.pd.packet);
+		loop->pool = NULL;
+	}
+
 	for (size_t i = 0; i < sizeof(loop->transfer) / sizeof(loop->transfer[0]); ++i) {
 		libusb_free_transfer(loop->transfer[i]);
 	}
+
+#ifndef WIN32
+	libusb_set_pollfd_notifiers(loop->cha->ftdi.usb_ctx, NULL, NULL, NULL);
+	cha_loop_pollfds_destroy(loop);
+#endif
+	cha_loop_wakeup_destroy(loop);
 }
 
 const char* cha_get_error_string(struct cha* cha) {
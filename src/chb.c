@@ -43,7 +43,7 @@ static void msleep(unsigned int ms) {
 static int chb_set(struct chb* chb, uint8_t cmd, uint8_t val, uint8_t mask) {
 	const uint8_t mpsse_set_high[3] = {cmd, val, mask};
 
-	if (ftdi_write_data(&chb->ftdi, mpsse_set_high, sizeof(mpsse_set_high)) < 0) {
+	if (usbstat_write_data(chb->usbstat, &chb->ftdi, mpsse_set_high, sizeof(mpsse_set_high)) < 0) {
 		chb->error_str = ftdi_get_error_string(&chb->ftdi);
 		goto fail_ftdi_write_data;
 	}
@@ -183,16 +183,18 @@ int chb_set_high(struct chb* chb, uint8_t val) {
 static int chb_get(struct chb* chb, uint8_t* val, uint8_t cmd) {
 	const uint8_t mpsse_get_high[1] = {cmd};
 
-	if (ftdi_write_data(&chb->ftdi, mpsse_get_high, sizeof(mpsse_get_high)) < 0) {
+	if (usbstat_write_data(chb->usbstat, &chb->ftdi, mpsse_get_high, sizeof(mpsse_get_high)) < 0) {
 		chb->error_str = ftdi_get_error_string(&chb->ftdi);
 		goto fail_ftdi_write_data;
 	}
 
-	if (ftdi_read_data(&chb->ftdi, val, 1) < 0) {
+	if (usbstat_read_data(chb->usbstat, &chb->ftdi, val, 1) < 0) {
 		chb->error_str = ftdi_get_error_string(&chb->ftdi);
 		goto fail_ftdi_read_data;
 	}
 
+	usbstat_add_round_trip(chb->usbstat);
+
 	return 0;
 
 fail_ftdi_read_data:
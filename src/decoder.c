@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
 
+#include <crc.h>
 #include <decoder.h>
 
 #include <assert.h>
@@ -19,10 +20,52 @@ int packet_decoder_init(struct packet_decoder* pd, struct ov_packet* p, size_t s
 	pd->ts_byte = 0;
 	pd->ts_length = 0;
 	pd->state = NEED_PACKET_MAGIC;
+	pd->filter = NULL;
+	pd->next_filter = NULL;
+	pd->filter_pending = 0;
+	pd->filter_length = 0;
+	pd->skip_length = 0;
+	pd->validate = 0;
+	pd->snaplen = 0;
+	pd->packet_length = 0;
 
 	return 0;
 }
 
+/* The filter must stay unchanged until the decoder takes the next one */
+void packet_decoder_set_filter(struct packet_decoder* pd, const struct filter* filter) {
+	pd->next_filter = filter;
+}
+
+void packet_decoder_set_validation(struct packet_decoder* pd, int enable) {
+	pd->validate = enable;
+}
+
+void packet_decoder_set_snaplen(struct packet_decoder* pd, size_t snaplen) {
+	pd->snaplen = snaplen;
+}
+
+/* Timestamps of the following packets count from zero again */
+void packet_decoder_reset_timestamp(struct packet_decoder* pd) {
+	pd->cumulative_ts = 0;
+}
+
+/* Keep at most snaplen bytes, the rest of the data is skipped */
+static void packet_decoder_snap(struct packet_decoder* pd) {
+	if (pd->snaplen > 0 && pd->packet_length > pd->snaplen) {
+		pd->packet->captured = pd->snaplen;
+		pd->packet->flags |= OV_FLAGS_SNAPPED;
+	}
+}
+
+/* Buffer may be replaced only between packets, e.g. from the packet callback */
+void packet_decoder_set_packet(struct packet_decoder* pd, struct ov_packet* p, size_t size) {
+	assert(pd->buf_actual_length == 0);
+
+	pd->packet = p;
+	pd->buf_length = size;
+}
+
 int packet_decoder_proc(struct packet_decoder* pd, uint8_t* buf, size_t size) {
 	const uint8_t* end = buf + size;
 
@@ -43,10 +86,12 @@ int packet_decoder_proc(struct packet_decoder* pd, uint8_t* buf, size_t size) {
 				}
 
 				pd->packet->magic = *(buf++);
+				pd->filter = pd->next_filter;
 				pd->state = NEED_PACKET_FLAGS;
 			} break;
 			case NEED_PACKET_FLAGS: {
-				pd->packet->flags = *(buf++);
+				/* Set by the library only, SNAPPED changes the meaning of captured */
+				pd->packet->flags = *(buf++) & ~(OV_FLAGS_BAD_CRC | OV_FLAGS_SNAPPED);
 				pd->state = NEED_PACKET_LENGTH_LO;
 			} break;
 			case NEED_PACKET_LENGTH_LO: {
@@ -67,28 +112,74 @@ int packet_decoder_proc(struct packet_decoder* pd, uint8_t* buf, size_t size) {
 				if (pd->ts_byte >= pd->ts_length) {
 					pd->cumulative_ts += pd->packet->timestamp;
 					pd->packet->timestamp = pd->cumulative_ts;
+					pd->filter_pending = (pd->filter && pd->filter->length > 0);
+					pd->filter_length = (pd->filter_pending ? pd->filter->data_length : 0);
+					pd->packet_length = ov_packet_captured_size(pd->packet);
+					/* Validation needs the whole packet, it is snapped afterwards */
+					if (!pd->validate)
+						packet_decoder_snap(pd);
 					pd->state = NEED_PACKET_DATA;
 				}
 			} break;
 			case NEED_PACKET_DATA: {
-				const size_t required_length = ov_packet_captured_size(pd->packet) - pd->buf_actual_length;
+				const size_t captured_length = ov_packet_captured_size(pd->packet);
+				/* Copy only the bytes the filter looks at until it is evaluated,
+				 * validation needs the whole packet anyway */
+				const size_t filter_length = (pd->filter_pending && !pd->validate ? MIN(captured_length, pd->filter_length) : captured_length);
+				/* Validation may be switched off with more bytes buffered */
+				const size_t target_length = (filter_length > pd->buf_actual_length ? filter_length : pd->buf_actual_length);
+				const size_t required_length = target_length - pd->buf_actual_length;
 				const size_t copy = MIN(required_length, end - buf);
 
 				memcpy(pd->packet->data + pd->buf_actual_length, buf, copy);
 				pd->buf_actual_length += copy;
 				buf += copy;
 
-				if (required_length == copy) {
-					/* Finalize packet here */
-					if (pd->ops.packet) {
-						pd->ops.packet(pd->user_data, pd->packet);
+				if (required_length != copy)
+					break;
+
+				if (pd->validate) {
+					if (crc_check_packet(pd->packet))
+						pd->packet->flags |= OV_FLAGS_BAD_CRC;
+
+					packet_decoder_snap(pd);
+				}
+
+				if (pd->filter_pending) {
+					pd->filter_pending = 0;
+
+					/* The last packet is always passed, it marks the end of stream */
+					if (!(pd->packet->flags & OV_FLAGS_HF0_LAST) && !filter_match(pd->filter, pd->packet)) {
+						pd->skip_length = pd->packet_length - pd->buf_actual_length;
+						pd->buf_actual_length = 0;
+						pd->state = (pd->skip_length > 0 ? SKIP_PACKET_DATA : NEED_PACKET_MAGIC);
+						break;
 					}
 
-					pd->buf_actual_length = 0;
-					pd->state = NEED_PACKET_MAGIC;
+					if (pd->buf_actual_length < captured_length)
+						break;
+				}
+
+				/* Data beyond snaplen follows in the stream */
+				pd->skip_length = pd->packet_length - pd->buf_actual_length;
+				pd->buf_actual_length = 0;
+				pd->state = (pd->skip_length > 0 ? SKIP_PACKET_DATA : NEED_PACKET_MAGIC);
 
-					goto end;
+				/* Finalize packet here, the callback may replace the buffer */
+				if (pd->ops.packet) {
+					pd->ops.packet(pd->user_data, pd->packet);
 				}
+
+				goto end;
+			} break;
+			case SKIP_PACKET_DATA: {
+				const size_t skip = MIN(pd->skip_length, end - buf);
+
+				buf += skip;
+				pd->skip_length -= skip;
+
+				if (pd->skip_length == 0)
+					pd->state = NEED_PACKET_MAGIC;
 			} break;
 		}
 	}
@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <filter.h>
+#include <usb.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Filter expression grammar:
+ *
+ *   or      := and { "||" and }
+ *   and     := not { "&&" not }
+ *   not     := "!" not | cmp
+ *   cmp     := bit [ ("==" | "!=" | "<" | "<=" | ">" | ">=") bit ]
+ *   bit     := primary { "&" primary }
+ *   primary := number | field | constant | "data" "[" number "]" | "(" or ")"
+ *
+ * Fields are pid, addr, endp, dir, size and flags. addr, endp and dir are
+ * only defined for tokens carrying them. Payload bytes past the end of
+ * the packet read as zero.
+ */
+
+enum filter_token {
+	TOKEN_END,
+	TOKEN_NUMBER,
+	TOKEN_IDENT,
+	TOKEN_LPAREN,
+	TOKEN_RPAREN,
+	TOKEN_LBRACKET,
+	TOKEN_RBRACKET,
+	TOKEN_NOT,
+	TOKEN_AND,
+	TOKEN_OR,
+	TOKEN_BITAND,
+	TOKEN_EQ,
+	TOKEN_NE,
+	TOKEN_LT,
+	TOKEN_LE,
+	TOKEN_GT,
+	TOKEN_GE
+};
+
+struct filter_parser {
+	struct filter* filter;
+	const char* pos;
+
+	enum filter_token token;
+	uint32_t value;
+	const char* ident;
+	size_t ident_length;
+
+	size_t depth;
+	/* Recursion of '!' and '(' */
+	size_t nesting;
+	const char* error_str;
+};
+
+struct filter_name {
+	const char* name;
+	enum filter_op op;
+	uint32_t value;
+	size_t data_length;
+};
+
+static const struct filter_name filter_fields[] = {
+	{"pid",   FILTER_OP_PID,   0, 1},
+	{"addr",  FILTER_OP_ADDR,  0, USB_TOKEN_SIZE},
+	{"endp",  FILTER_OP_ENDP,  0, USB_TOKEN_SIZE},
+	{"dir",   FILTER_OP_DIR,   0, 1},
+	{"size",  FILTER_OP_SIZE,  0, 0},
+	{"flags", FILTER_OP_FLAGS, 0, 0},
+
+	{"OUT",   FILTER_OP_PUSH, USB_PID_TOKEN_OUT, 0},
+	{"IN",    FILTER_OP_PUSH, USB_PID_TOKEN_IN, 0},
+	{"SOF",   FILTER_OP_PUSH, USB_PID_TOKEN_SOF, 0},
+	{"SETUP", FILTER_OP_PUSH, USB_PID_TOKEN_SETUP, 0},
+	{"DATA0", FILTER_OP_PUSH, USB_PID_DATA_DATA0, 0},
+	{"DATA1", FILTER_OP_PUSH, USB_PID_DATA_DATA1, 0},
+	{"DATA2", FILTER_OP_PUSH, USB_PID_DATA_DATA2, 0},
+	{"MDATA", FILTER_OP_PUSH, USB_PID_DATA_MDATA, 0},
+	{"ACK",   FILTER_OP_PUSH, USB_PID_HANDSHAKE_ACK, 0},
+	{"NAK",   FILTER_OP_PUSH, USB_PID_HANDSHAKE_NAK, 0},
+	{"STALL", FILTER_OP_PUSH, USB_PID_HANDSHAKE_STALL, 0},
+	{"NYET",  FILTER_OP_PUSH, USB_PID_HANDSHAKE_NYET, 0},
+	{"PRE",   FILTER_OP_PUSH, USB_PID_SPECIAL_PRE_OR_ERR, 0},
+	{"ERR",   FILTER_OP_PUSH, USB_PID_SPECIAL_PRE_OR_ERR, 0},
+	{"SPLIT", FILTER_OP_PUSH, USB_PID_SPECIAL_SPLIT, 0},
+	{"PING",  FILTER_OP_PUSH, USB_PID_SPECIAL_PING, 0},
+
+	{"in",    FILTER_OP_PUSH, 1, 0},
+	{"out",   FILTER_OP_PUSH, 0, 0},
+
+	{"HF0_ERR",   FILTER_OP_PUSH, OV_FLAGS_HF0_ERR, 0},
+	{"HF0_OVF",   FILTER_OP_PUSH, OV_FLAGS_HF0_OVF, 0},
+	{"HF0_TRUNC", FILTER_OP_PUSH, OV_FLAGS_HF0_TRUNC, 0},
+	{"HF0_FIRST", FILTER_OP_PUSH, OV_FLAGS_HF0_FIRST, 0},
+	{"HF0_LAST",  FILTER_OP_PUSH, OV_FLAGS_HF0_LAST, 0},
+	{"BAD_CRC",   FILTER_OP_PUSH, OV_FLAGS_BAD_CRC, 0},
+};
+
+static int filter_parse_or(struct filter_parser* p);
+
+static int filter_next(struct filter_parser* p) {
+	const char* s = p->pos;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	if (*s == '\0') {
+		p->token = TOKEN_END;
+	} else if (isdigit((unsigned char)*s)) {
+		char* end = NULL;
+		unsigned long value = strtoul(s, &end, 0);
+
+		if (value > UINT32_MAX) {
+			p->error_str = "Number is too large";
+			return -1;
+		}
+
+		p->token = TOKEN_NUMBER;
+		p->value = value;
+		s = end;
+	} else if (isalpha((unsigned char)*s) || *s == '_') {
+		p->token = TOKEN_IDENT;
+		p->ident = s;
+		while (isalnum((unsigned char)*s) || *s == '_')
+			s++;
+		p->ident_length = s - p->ident;
+	} else {
+		switch (*s++) {
+		case '(': p->token = TOKEN_LPAREN; break;
+		case ')': p->token = TOKEN_RPAREN; break;
+		case '[': p->token = TOKEN_LBRACKET; break;
+		case ']': p->token = TOKEN_RBRACKET; break;
+		case '!': {
+			p->token = (*s == '=' ? (s++, TOKEN_NE) : TOKEN_NOT);
+		} break;
+		case '&': {
+			p->token = (*s == '&' ? (s++, TOKEN_AND) : TOKEN_BITAND);
+		} break;
+		case '|': {
+			if (*s++ != '|') {
+				p->error_str = "Unexpected character";
+				return -1;
+			}
+			p->token = TOKEN_OR;
+		} break;
+		case '=': {
+			if (*s++ != '=') {
+				p->error_str = "Unexpected character";
+				return -1;
+			}
+			p->token = TOKEN_EQ;
+		} break;
+		case '<': {
+			p->token = (*s == '=' ? (s++, TOKEN_LE) : TOKEN_LT);
+		} break;
+		case '>': {
+			p->token = (*s == '=' ? (s++, TOKEN_GE) : TOKEN_GT);
+		} break;
+		default: {
+			p->error_str = "Unexpected character";
+			return -1;
+		} break;
+		}
+	}
+
+	p->pos = s;
+
+	return 0;
+}
+
+static int filter_emit(struct filter_parser* p, enum filter_op op, uint32_t arg) {
+	struct filter* filter = p->filter;
+
+	if (filter->length >= FILTER_MAX_INSN) {
+		p->error_str = "Filter is too long";
+		return -1;
+	}
+
+	switch (op) {
+	case FILTER_OP_PUSH:
+	case FILTER_OP_PID:
+	case FILTER_OP_ADDR:
+	case FILTER_OP_ENDP:
+	case FILTER_OP_DIR:
+	case FILTER_OP_SIZE:
+	case FILTER_OP_FLAGS:
+	case FILTER_OP_DATA: {
+		if (++p->depth > FILTER_MAX_STACK) {
+			p->error_str = "Filter is too complex";
+			return -1;
+		}
+	} break;
+	case FILTER_OP_NOT:
+	case FILTER_OP_RET:
+		break;
+	default: {
+		/* Binary operations, and jumps pop when fall through */
+		p->depth--;
+	} break;
+	}
+
+	filter->insn[filter->length].op = op;
+	filter->insn[filter->length].arg = arg;
+	filter->length++;
+
+	return 0;
+}
+
+/* Bounds the recursion of the parser on user supplied expressions */
+static int filter_enter(struct filter_parser* p) {
+	if (++p->nesting > FILTER_MAX_NESTING) {
+		p->error_str = "Filter is too complex";
+		return -1;
+	}
+
+	return 0;
+}
+
+static void filter_need_data(struct filter_parser* p, size_t length) {
+	if (p->filter->data_length < length)
+		p->filter->data_length = length;
+}
+
+static int filter_parse_primary(struct filter_parser* p) {
+	size_t i;
+
+	switch (p->token) {
+	case TOKEN_NUMBER: {
+		if (filter_emit(p, FILTER_OP_PUSH, p->value) < 0)
+			return -1;
+
+		return filter_next(p);
+	} break;
+	case TOKEN_LPAREN: {
+		if (filter_enter(p) < 0 || filter_next(p) < 0 || filter_parse_or(p) < 0)
+			return -1;
+
+		if (p->token != TOKEN_RPAREN) {
+			p->error_str = "Expected ')'";
+			return -1;
+		}
+
+		p->nesting--;
+
+		return filter_next(p);
+	} break;
+	case TOKEN_IDENT: {
+		if (p->ident_length == 4 && strncmp(p->ident, "data", 4) == 0) {
+			uint32_t offset;
+
+			if (filter_next(p) < 0)
+				return -1;
+			if (p->token != TOKEN_LBRACKET) {
+				p->error_str = "Expected '['";
+				return -1;
+			}
+			if (filter_next(p) < 0)
+				return -1;
+			if (p->token != TOKEN_NUMBER || p->value >= OV_MAX_PACKET_SIZE) {
+				p->error_str = "Invalid data offset";
+				return -1;
+			}
+
+			offset = p->value;
+
+			if (filter_next(p) < 0)
+				return -1;
+			if (p->token != TOKEN_RBRACKET) {
+				p->error_str = "Expected ']'";
+				return -1;
+			}
+
+			filter_need_data(p, offset + 1);
+			if (filter_emit(p, FILTER_OP_DATA, offset) < 0)
+				return -1;
+
+			return filter_next(p);
+		}
+
+		for (i = 0; i < sizeof(filter_fields) / sizeof(filter_fields[0]); ++i) {
+			const struct filter_name* name = &filter_fields[i];
+
+			if (strlen(name->name) == p->ident_length && strncmp(p->ident, name->name, p->ident_length) == 0) {
+				filter_need_data(p, name->data_length);
+				if (filter_emit(p, name->op, name->value) < 0)
+					return -1;
+
+				return filter_next(p);
+			}
+		}
+
+		p->error_str = "Unknown identifier";
+		return -1;
+	} break;
+	default: {
+		p->error_str = "Unexpected token";
+		return -1;
+	} break;
+	}
+}
+
+static int filter_parse_bit(struct filter_parser* p) {
+	if (filter_parse_primary(p) < 0)
+		return -1;
+
+	while (p->token == TOKEN_BITAND) {
+		if (filter_next(p) < 0 || filter_parse_primary(p) < 0)
+			return -1;
+
+		if (filter_emit(p, FILTER_OP_BITAND, 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int filter_parse_cmp(struct filter_parser* p) {
+	enum filter_op op;
+
+	if (filter_parse_bit(p) < 0)
+		return -1;
+
+	switch (p->token) {
+	case TOKEN_EQ: op = FILTER_OP_EQ; break;
+	case TOKEN_NE: op = FILTER_OP_NE; break;
+	case TOKEN_LT: op = FILTER_OP_LT; break;
+	case TOKEN_LE: op = FILTER_OP_LE; break;
+	case TOKEN_GT: op = FILTER_OP_GT; break;
+	case TOKEN_GE: op = FILTER_OP_GE; break;
+	default:
+		return 0;
+	}
+
+	if (filter_next(p) < 0 || filter_parse_bit(p) < 0)
+		return -1;
+
+	return filter_emit(p, op, 0);
+}
+
+static int filter_parse_not(struct filter_parser* p) {
+	if (p->token == TOKEN_NOT) {
+		if (filter_enter(p) < 0 || filter_next(p) < 0 || filter_parse_not(p) < 0)
+			return -1;
+
+		p->nesting--;
+
+		return filter_emit(p, FILTER_OP_NOT, 0);
+	}
+
+	return filter_parse_cmp(p);
+}
+
+static int filter_parse_and(struct filter_parser* p) {
+	if (filter_parse_not(p) < 0)
+		return -1;
+
+	while (p->token == TOKEN_AND) {
+		const size_t jump = p->filter->length;
+
+		if (filter_emit(p, FILTER_OP_JFALSE, 0) < 0)
+			return -1;
+		if (filter_next(p) < 0 || filter_parse_not(p) < 0)
+			return -1;
+
+		p->filter->insn[jump].arg = p->filter->length;
+	}
+
+	return 0;
+}
+
+static int filter_parse_or(struct filter_parser* p) {
+	if (filter_parse_and(p) < 0)
+		return -1;
+
+	while (p->token == TOKEN_OR) {
+		const size_t jump = p->filter->length;
+
+		if (filter_emit(p, FILTER_OP_JTRUE, 0) < 0)
+			return -1;
+		if (filter_next(p) < 0 || filter_parse_and(p) < 0)
+			return -1;
+
+		p->filter->insn[jump].arg = p->filter->length;
+	}
+
+	return 0;
+}
+
+void filter_init(struct filter* filter) {
+	filter->length = 0;
+	filter->data_length = 0;
+	filter->error_str = NULL;
+}
+
+int filter_compile(struct filter* filter, const char* expr) {
+	struct filter_parser p = {
+		.filter = filter,
+		.pos = expr,
+	};
+
+	filter_init(filter);
+
+	if (filter_next(&p) < 0)
+		goto fail_parse;
+
+	/* Empty expression accepts everything */
+	if (p.token == TOKEN_END)
+		return 0;
+
+	if (filter_parse_or(&p) < 0)
+		goto fail_parse;
+
+	if (p.token != TOKEN_END) {
+		p.error_str = "Unexpected token";
+		goto fail_parse;
+	}
+
+	if (filter_emit(&p, FILTER_OP_RET, 0) < 0)
+		goto fail_parse;
+
+	return 0;
+
+fail_parse:
+	filter_init(filter);
+	filter->error_str = p.error_str;
+
+	return -1;
+}
+
+static int filter_is_token(const struct ov_packet* packet, size_t captured) {
+	return (captured >= USB_TOKEN_SIZE && usb_pid_has_endpoint(packet->data[0]));
+}
+
+int filter_match(const struct filter* filter, const struct ov_packet* packet) {
+	const size_t captured = ov_packet_captured_size((struct ov_packet*)packet);
+	uint32_t stack[FILTER_MAX_STACK];
+	size_t sp = 0;
+	size_t pc = 0;
+
+	if (filter->length == 0)
+		return 1;
+
+	for (;;) {
+		const struct filter_insn* insn = &filter->insn[pc++];
+
+		switch (insn->op) {
+		case FILTER_OP_PUSH: {
+			stack[sp++] = insn->arg;
+		} break;
+		case FILTER_OP_PID: {
+			stack[sp++] = (captured > 0 ? packet->data[0] : 0);
+		} break;
+		case FILTER_OP_ADDR: {
+			stack[sp++] = (filter_is_token(packet, captured) ? usb_token_address(packet->data) : FILTER_NONE);
+		} break;
+		case FILTER_OP_ENDP: {
+			stack[sp++] = (filter_is_token(packet, captured) ? usb_token_endpoint(packet->data) : FILTER_NONE);
+		} break;
+		case FILTER_OP_DIR: {
+			stack[sp++] = (filter_is_token(packet, captured) ? (packet->data[0] == USB_PID_TOKEN_IN) : FILTER_NONE);
+		} break;
+		case FILTER_OP_SIZE: {
+			stack[sp++] = packet->size;
+		} break;
+		case FILTER_OP_FLAGS: {
+			stack[sp++] = packet->flags;
+		} break;
+		case FILTER_OP_DATA: {
+			stack[sp++] = (insn->arg < captured ? packet->data[insn->arg] : 0);
+		} break;
+		case FILTER_OP_BITAND: {
+			sp--;
+			stack[sp - 1] &= stack[sp];
+		} break;
+		case FILTER_OP_EQ: {
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] == stack[sp]);
+		} break;
+		case FILTER_OP_NE: {
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] != stack[sp]);
+		} break;
+		case FILTER_OP_LT: {
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] < stack[sp]);
+		} break;
+		case FILTER_OP_LE: {
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] <= stack[sp]);
+		} break;
+		case FILTER_OP_GT: {
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] > stack[sp]);
+		} break;
+		case FILTER_OP_GE: {
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] >= stack[sp]);
+		} break;
+		case FILTER_OP_NOT: {
+			stack[sp - 1] = !stack[sp - 1];
+		} break;
+		case FILTER_OP_JFALSE: {
+			if (!stack[sp - 1])
+				pc = insn->arg;
+			else
+				sp--;
+		} break;
+		case FILTER_OP_JTRUE: {
+			if (stack[sp - 1])
+				pc = insn->arg;
+			else
+				sp--;
+		} break;
+		case FILTER_OP_RET: {
+			return stack[sp - 1] != 0;
+		} break;
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <histogram.h>
+
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static unsigned int histogram_msb(uint64_t value) {
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long index;
+
+	_BitScanReverse64(&index, value);
+
+	return index;
+#elif defined(_MSC_VER)
+	/* No 64-bit scan on 32-bit targets */
+	unsigned long index;
+
+	if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+		return index + 32;
+
+	_BitScanReverse(&index, (unsigned long)value);
+
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+static size_t histogram_index(uint64_t value) {
+	unsigned int shift;
+
+	if (value < HISTOGRAM_SUB_COUNT)
+		return value;
+
+	shift = histogram_msb(value) - HISTOGRAM_SUB_BITS + 1;
+
+	return shift * HISTOGRAM_HALF_COUNT + (value >> shift);
+}
+
+static uint64_t histogram_highest(size_t index) {
+	unsigned int shift;
+
+	if (index < HISTOGRAM_SUB_COUNT)
+		return index;
+
+	shift = index / HISTOGRAM_HALF_COUNT - 1;
+
+	return ((uint64_t)(index - shift * HISTOGRAM_HALF_COUNT + 1) << shift) - 1;
+}
+
+void histogram_reset(struct histogram* h) {
+	memset(h, 0, sizeof(struct histogram));
+	h->min = UINT64_MAX;
+}
+
+void histogram_record(struct histogram* h, uint64_t value) {
+	h->buckets[histogram_index(value)]++;
+	h->count++;
+	h->total += value;
+
+	if (value < h->min)
+		h->min = value;
+
+	if (value > h->max)
+		h->max = value;
+}
+
+uint64_t histogram_percentile(const struct histogram* h, double percentile) {
+	uint64_t rank;
+	uint64_t seen = 0;
+
+	if (h->count == 0)
+		return 0;
+
+	if (percentile >= 100.0)
+		return h->max;
+
+	rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		seen += h->buckets[i];
+
+		if (seen >= rank) {
+			const uint64_t highest = histogram_highest(i);
+
+			return highest < h->max ? highest : h->max;
+		}
+	}
+
+	return h->max;
+}
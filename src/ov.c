@@ -2,13 +2,21 @@
 
 #include <openvizsla.h>
 
+#include <aggregator.h>
+#include <atomic.h>
 #include <cha.h>
 #include <chb.h>
 #include <bit.h>
+#include <filter.h>
 #include <fwpkg.h>
+#include <pool.h>
+#include <queue.h>
+#include <record.h>
+#include <usbstat.h>
 
 #include <openvizsla_export.h>
 
+#include <limits.h>
 #include <stdlib.h>
 
 #define PORTB_DONE_BIT     (1 << 2)  // GPIOH2
@@ -19,6 +27,48 @@ struct ov_device {
 	struct chb chb;
 	struct fwpkg fwpkg;
 	struct cha_loop loop;
+	enum ov_timestamp_mode timestamp_mode;
+	/* The decoder keeps the filter of the packet in progress, so a new
+	 * one is compiled into the other slot */
+	struct filter filters[2];
+	struct filter* filter;
+	int validate;
+	size_t snaplen;
+	int aggregate;
+	struct ov_aggregator* aggregator;
+	size_t pool_size;
+	struct packet_pool* pool;
+
+	ov_pollfd_added_callback pollfd_added;
+	ov_pollfd_removed_callback pollfd_removed;
+	void* pollfd_user_data;
+
+	int backlog_interval_ms;
+	uint32_t backlog_threshold;
+	ov_backlog_callback backlog_callback;
+	void* backlog_user_data;
+
+	int latency_enabled;
+	int latency_budget_percent;
+	ov_consumer_load_callback latency_callback;
+	void* latency_user_data;
+
+	/* Pull mode, see ov_capture_start_queued() */
+	struct packet_queue queue;
+	struct ov_packet* queue_packet;
+	uint64_t queue_dropped;
+	int queue_end;
+
+	/* Native records, see ov_capture_start_records() */
+	struct record_buffer records;
+
+	/* USB round trips of the control path per public call */
+	struct usbstat usbstat;
+
+	/* Pending ov_capture_rearm() */
+	ov_session_callback session_callback;
+	void* session_user_data;
+
 	const char* error_str;
 };
 
@@ -102,6 +152,10 @@ struct ov_device* ov_new(const char* firmware_filename) {
 	}
 
 	memset(ov, 0, sizeof(struct ov_device));
+	filter_init(&ov->filters[0]);
+	filter_init(&ov->filters[1]);
+	ov->filter = &ov->filters[0];
+	usbstat_init(&ov->usbstat);
 
 	ret = fwpkg_init(&ov->fwpkg, firmware_filename);
 	if (ret < 0) {
@@ -121,6 +175,9 @@ struct ov_device* ov_new(const char* firmware_filename) {
 		goto fail_chb_init;
 	}
 
+	ov->cha.usbstat = &ov->usbstat;
+	ov->chb.usbstat = &ov->usbstat;
+
 	return ov;
 
 fail_chb_init:
@@ -138,6 +195,8 @@ OPENVIZSLA_EXPORT
 int ov_open(struct ov_device* ov) {
 	int ret = 0;
 
+	usbstat_begin(&ov->usbstat, OV_CALL_OPEN);
+
 	ret = cha_open(&ov->cha);
 	if (ret < 0) {
 		ov->error_str = cha_get_error_string(&ov->cha);
@@ -167,6 +226,7 @@ int ov_open(struct ov_device* ov) {
 		goto fail_cha_stop_stream;
 	}
 
+	usbstat_end(&ov->usbstat);
 	return 0;
 
 fail_cha_stop_stream:
@@ -176,6 +236,7 @@ fail_chb_open:
 	// FIXME: close cha?
 fail_cha_open:
 
+	usbstat_end(&ov->usbstat);
 	return ret;
 }
 
@@ -202,41 +263,338 @@ fail_cha_get_usb_speed:
 
 OPENVIZSLA_EXPORT
 int ov_set_usb_speed(struct ov_device* ov, enum ov_usb_speed speed) {
+	usbstat_begin(&ov->usbstat, OV_CALL_SET_USB_SPEED);
+
 	if (cha_set_usb_speed(&ov->cha, speed) < 0) {
 		ov->error_str = cha_get_error_string(&ov->cha);
 		goto fail_cha_set_usb_speed;
 	}
 
+	usbstat_end(&ov->usbstat);
 	return 0;
 
 fail_cha_set_usb_speed:
+	usbstat_end(&ov->usbstat);
 	return -1;
 }
 
+OPENVIZSLA_EXPORT
+int ov_capture_set_timestamp_mode(struct ov_device* ov, enum ov_timestamp_mode mode) {
+	switch (mode) {
+	case OV_TIMESTAMP_RAW:
+	case OV_TIMESTAMP_REALTIME:
+	case OV_TIMESTAMP_MONOTONIC: {
+		ov->timestamp_mode = mode;
+	} break;
+	default: {
+		ov->error_str = "Invalid timestamp mode";
+
+		return -1;
+	} break;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_set_filter(struct ov_device* ov, const char* expr) {
+	struct filter* slot = (ov->loop.fd.pd.filter == &ov->filters[0] ? &ov->filters[1] : &ov->filters[0]);
+	struct filter filter;
+
+	if (filter_compile(&filter, expr ? expr : "") < 0) {
+		ov->error_str = filter.error_str;
+
+		return -1;
+	}
+
+	/* Taken by the decoder at the next packet when capturing */
+	*slot = filter;
+	ov->filter = slot;
+	cha_loop_set_filter(&ov->loop, slot);
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_set_validation(struct ov_device* ov, int enable) {
+	ov->validate = enable;
+	cha_loop_set_validation(&ov->loop, enable);
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_set_snaplen(struct ov_device* ov, size_t snaplen) {
+	ov->snaplen = snaplen;
+	cha_loop_set_snaplen(&ov->loop, snaplen);
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_set_sdram_ring(struct ov_device* ov, uint32_t base, uint32_t size) {
+	if (cha_set_sdram_ring(&ov->cha, base, size) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_set_burst_mode(struct ov_device* ov, int enable) {
+	return ov_capture_set_sdram_ring(ov, 0, enable ? OV_SDRAM_SIZE : OV_SDRAM_RING_DEFAULT_SIZE);
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_set_aggregation(struct ov_device* ov, int flags) {
+	ov->aggregate = flags;
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_set_pool(struct ov_device* ov, size_t count) {
+	ov->pool_size = count;
+}
+
 OPENVIZSLA_EXPORT
 int ov_capture_start(struct ov_device* ov, struct ov_packet* packet, size_t packet_size, ov_packet_decoder_callback callback, void* user_data) {
+	usbstat_begin(&ov->usbstat, OV_CALL_CAPTURE_START);
+
+	if (!packet && ov->pool_size == 0) {
+		ov->error_str = "Packet buffer is required when packet pool is not used";
+		goto fail_packet;
+	}
+
+	/* Records are written in place by the decoder, so they are never aggregated */
+	if (ov->aggregate && callback) {
+		if (ov->pool_size > 0) {
+			ov->error_str = "Packet pool cannot be used with aggregation";
+			goto fail_aggregate;
+		}
+
+		ov->aggregator = ov_aggregator_new(ov->aggregate, callback, user_data);
+		if (!ov->aggregator) {
+			ov->error_str = "Cannot allocate memory for aggregator";
+			goto fail_ov_aggregator_new;
+		}
+
+		callback = &ov_aggregator_packet;
+		user_data = ov->aggregator;
+	}
 
 	if (cha_loop_init(&ov->loop, &ov->cha, packet, packet_size, callback, user_data) < 0) {
 		ov->error_str = cha_get_error_string(&ov->cha);
 		goto fail_cha_loop_init;
 	}
 
+	if (ov->pool_size > 0) {
+		ov->pool = packet_pool_new(ov->pool_size);
+		if (!ov->pool) {
+			ov->error_str = "Cannot allocate memory for packet pool";
+			goto fail_packet_pool_new;
+		}
+
+		if (cha_loop_set_pool(&ov->loop, ov->pool) < 0) {
+			ov->error_str = cha_get_error_string(&ov->cha);
+			goto fail_cha_loop_set_pool;
+		}
+	}
+
 	if (cha_start_stream(&ov->cha) < 0) {
 		ov->error_str = cha_get_error_string(&ov->cha);
 		goto fail_cha_start_stream;
 	}
 
+	/* Device timestamps start counting from zero when the stream starts */
+	cha_loop_set_timestamp_mode(&ov->loop, ov->timestamp_mode);
+	cha_loop_set_filter(&ov->loop, ov->filter);
+	cha_loop_set_validation(&ov->loop, ov->validate);
+	cha_loop_set_snaplen(&ov->loop, ov->snaplen);
+	cha_loop_set_pollfd_notifiers(&ov->loop, ov->pollfd_added, ov->pollfd_removed, ov->pollfd_user_data);
+	cha_loop_set_backlog_monitor(&ov->loop, ov->backlog_interval_ms, ov->backlog_threshold, ov->backlog_callback, ov->backlog_user_data);
+	cha_loop_set_latency_monitor(&ov->loop, ov->latency_enabled, ov->latency_budget_percent, ov->latency_callback, ov->latency_user_data);
+
+	usbstat_end(&ov->usbstat);
 	return 0;
 
 fail_cha_start_stream:
+fail_cha_loop_set_pool:
+	if (ov->pool) {
+		packet_pool_unref(ov->pool);
+		ov->pool = NULL;
+	}
+fail_packet_pool_new:
+	cha_loop_destroy(&ov->loop);
 fail_cha_loop_init:
+	if (ov->aggregator) {
+		ov_aggregator_free(ov->aggregator);
+		ov->aggregator = NULL;
+	}
+fail_ov_aggregator_new:
+fail_aggregate:
+fail_packet:
 fail_ucfg_wcmd_wr:
 fail_ucfg_wdata_wr:
 fail_cha_stop_stream:
 fail_cha_switch_fifo_mode:
+	usbstat_end(&ov->usbstat);
+	return -1;
+}
+
+static void ov_capture_queue_packet(struct ov_packet* packet, void* data) {
+	struct ov_device* ov = (struct ov_device*)data;
+
+	if (packet_queue_push(&ov->queue, packet) < 0)
+		ov->queue_dropped++;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_start_queued(struct ov_device* ov, size_t queue_size) {
+	ov->queue_packet = malloc(sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE);
+	if (!ov->queue_packet) {
+		ov->error_str = "Cannot allocate memory for packet";
+		goto fail_malloc;
+	}
+
+	if (packet_queue_init(&ov->queue, queue_size) < 0) {
+		ov->error_str = "Cannot allocate memory for packet queue";
+		goto fail_packet_queue_init;
+	}
+
+	ov->queue_dropped = 0;
+	ov->queue_end = 0;
+
+	if (ov_capture_start(ov, ov->queue_packet, sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE, &ov_capture_queue_packet, ov) < 0)
+		goto fail_ov_capture_start;
+
+	return 0;
+
+fail_ov_capture_start:
+	packet_queue_destroy(&ov->queue);
+fail_packet_queue_init:
+	free(ov->queue_packet);
+	ov->queue_packet = NULL;
+fail_malloc:
 	return -1;
 }
 
+OPENVIZSLA_EXPORT
+int ov_capture_start_records(struct ov_device* ov, size_t buffer_size, ov_record_callback callback, void* user_data) {
+	if (ov->pool_size > 0) {
+		ov->error_str = "Packet pool cannot be used with records";
+		goto fail_pool;
+	}
+
+	if (record_buffer_init(&ov->records, buffer_size, callback, user_data) < 0) {
+		ov->error_str = "Cannot allocate memory for record buffer";
+		goto fail_record_buffer_init;
+	}
+
+	if (ov_capture_start(ov, record_buffer_packet(&ov->records), sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE, NULL, NULL) < 0)
+		goto fail_ov_capture_start;
+
+	cha_loop_set_records(&ov->loop, &ov->records);
+
+	return 0;
+
+fail_ov_capture_start:
+	record_buffer_destroy(&ov->records);
+fail_record_buffer_init:
+fail_pool:
+	return -1;
+}
+
+/* Wait until there are unread packets in the queue, at most timeout_ms when not negative */
+static int ov_capture_fill_queue(struct ov_device* ov, int timeout_ms) {
+	/* Data of all transfers in flight has to fit */
+	const size_t headroom = CHA_LOOP_TRANSFER_COUNT * CHA_LOOP_BUFFER_SIZE * 4;
+	int ret = 0;
+
+	if (!ov->queue_packet) {
+		ov->error_str = "Capture is not started by ov_capture_start_queued()";
+		return -1;
+	}
+
+	while (packet_queue_unread(&ov->queue) == 0) {
+		if (ov->queue_end)
+			return 0;
+
+		if (packet_queue_free_space(&ov->queue) < headroom) {
+			ov->error_str = "Packet queue is full, release packets first";
+			return -1;
+		}
+
+		/* Return after the first transfer with packets, keeping the others in flight */
+		switch ((ret = cha_loop_run_timeout(&ov->loop, 1, timeout_ms))) {
+		case -FATAL_ERROR: {
+			ov->error_str = cha_get_error_string(&ov->cha);
+			return -1;
+		} break;
+		case -BREAK_LOOP: {
+			/* Let the next call resume the capture */
+			ov->loop.state = RUNNING;
+			return 0;
+		} break;
+		case -END_OF_STREAM:
+		case -HOST_READ_OFF: {
+			ov->queue_end = 1;
+		} break;
+		default: {
+			if (timeout_ms >= 0)
+				return packet_queue_unread(&ov->queue) > 0;
+		} break;
+		}
+	}
+
+	return 1;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_next(struct ov_device* ov, struct ov_packet** packet) {
+	int ret = 0;
+
+	if ((ret = ov_capture_fill_queue(ov, -1)) <= 0)
+		return ret;
+
+	*packet = packet_queue_next(&ov->queue);
+
+	return 1;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_read_batch(struct ov_device* ov, struct ov_packet** packets, size_t count) {
+	size_t i = 0;
+	int ret = 0;
+
+	if ((ret = ov_capture_fill_queue(ov, -1)) <= 0)
+		return ret;
+
+	for (i = 0; i < count && i < INT_MAX; ++i) {
+		if (!(packets[i] = packet_queue_next(&ov->queue)))
+			break;
+	}
+
+	return (int)i;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_wait(struct ov_device* ov, int timeout_ms) {
+	return ov_capture_fill_queue(ov, timeout_ms);
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_at_end(struct ov_device* ov) {
+	return ov->queue_end && packet_queue_unread(&ov->queue) == 0;
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_release(struct ov_device* ov, size_t count) {
+	packet_queue_release(&ov->queue, count);
+}
+
+OPENVIZSLA_EXPORT
+uint64_t ov_capture_get_dropped(struct ov_device* ov) {
+	return ov->queue_dropped;
+}
+
 OPENVIZSLA_EXPORT
 int ov_capture_dispatch(struct ov_device* ov, int count) {
 	int ret = 0;
@@ -248,8 +606,217 @@ int ov_capture_dispatch(struct ov_device* ov, int count) {
 	return ret;
 }
 
+OPENVIZSLA_EXPORT
+int ov_capture_dispatch_timeout(struct ov_device* ov, int count, int timeout_ms) {
+	int ret = 0;
+
+	if ((ret = cha_loop_run_timeout(&ov->loop, count, timeout_ms)) == -1) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+	}
+
+	return ret;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_dispatch_nonblock(struct ov_device* ov, int count) {
+	return ov_capture_dispatch_timeout(ov, count, 0);
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_get_pollfds(struct ov_device* ov, struct ov_pollfd* pollfds, size_t count) {
+	int ret = 0;
+
+	if ((ret = cha_loop_get_pollfds(&ov->loop, pollfds, count)) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+	}
+
+	return ret;
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_set_pollfd_notifiers(struct ov_device* ov, ov_pollfd_added_callback added, ov_pollfd_removed_callback removed, void* user_data) {
+	ov->pollfd_added = added;
+	ov->pollfd_removed = removed;
+	ov->pollfd_user_data = user_data;
+
+	cha_loop_set_pollfd_notifiers(&ov->loop, added, removed, user_data);
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_set_backlog_monitor(struct ov_device* ov, int interval_ms, uint32_t threshold, ov_backlog_callback callback, void* user_data) {
+	ov->backlog_interval_ms = interval_ms;
+	ov->backlog_threshold = threshold;
+	ov->backlog_callback = callback;
+	ov->backlog_user_data = user_data;
+
+	cha_loop_set_backlog_monitor(&ov->loop, interval_ms, threshold, callback, user_data);
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_get_backlog(struct ov_device* ov, struct ov_backlog* backlog) {
+	cha_loop_get_backlog(&ov->loop, backlog);
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_set_latency_monitor(struct ov_device* ov, int enable, int budget_percent, ov_consumer_load_callback callback, void* user_data) {
+	ov->latency_enabled = enable;
+	ov->latency_budget_percent = budget_percent;
+	ov->latency_callback = callback;
+	ov->latency_user_data = user_data;
+
+	cha_loop_set_latency_monitor(&ov->loop, enable, budget_percent, callback, user_data);
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_get_latency(struct ov_device* ov, enum ov_latency_kind kind, struct ov_latency* latency) {
+	const struct histogram* h;
+
+	if (kind != OV_LATENCY_CALLBACK && kind != OV_LATENCY_DECODE) {
+		ov->error_str = "Unknown latency kind";
+		return -1;
+	}
+
+	h = &ov->loop.latency.histogram[kind];
+
+	latency->count = h->count;
+	latency->min_ns = (h->count ? h->min : 0);
+	latency->max_ns = h->max;
+	latency->mean_ns = (h->count ? h->total / h->count : 0);
+	latency->p50_ns = histogram_percentile(h, 50.0);
+	latency->p90_ns = histogram_percentile(h, 90.0);
+	latency->p99_ns = histogram_percentile(h, 99.0);
+	latency->p999_ns = histogram_percentile(h, 99.9);
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+uint64_t ov_capture_get_latency_percentile(struct ov_device* ov, enum ov_latency_kind kind, double percentile) {
+	if (kind != OV_LATENCY_CALLBACK && kind != OV_LATENCY_DECODE)
+		return 0;
+
+	return histogram_percentile(&ov->loop.latency.histogram[kind], percentile);
+}
+
+OPENVIZSLA_EXPORT
+void ov_capture_reset_latency(struct ov_device* ov) {
+	cha_loop_reset_latency(&ov->loop);
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_pause(struct ov_device* ov) {
+	if (cha_loop_pause(&ov->loop) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_resume(struct ov_device* ov) {
+	if (cha_loop_resume(&ov->loop) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void ov_capture_session_end(int status, void* data) {
+	struct ov_device* ov = (struct ov_device*)data;
+
+	/* Runs of the old session are not merged into the new one */
+	if (status == 0 && ov->aggregator)
+		ov_aggregator_flush(ov->aggregator);
+
+	if (ov->session_callback)
+		ov->session_callback(status, ov->session_user_data);
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_rearm(struct ov_device* ov, ov_session_callback callback, void* user_data) {
+	if (cha_loop_rearm(&ov->loop, &ov_capture_session_end, ov) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	ov->session_callback = callback;
+	ov->session_user_data = user_data;
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_read_register(struct ov_device* ov, const char* name, ov_register_callback callback, void* user_data) {
+	uint16_t addr;
+
+	if (reg_lookup(&ov->cha.reg, name, &addr) < 0) {
+		ov->error_str = reg_get_error_string(&ov->cha.reg);
+		return -1;
+	}
+
+	if (cha_loop_request(&ov->loop, CHA_REQUEST_READ, addr, 0, callback, user_data) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_write_register(struct ov_device* ov, const char* name, uint8_t value, ov_register_callback callback, void* user_data) {
+	uint16_t addr;
+
+	if (reg_lookup(&ov->cha.reg, name, &addr) < 0) {
+		ov->error_str = reg_get_error_string(&ov->cha.reg);
+		return -1;
+	}
+
+	if (cha_loop_request(&ov->loop, CHA_REQUEST_WRITE, addr, value, callback, user_data) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_read_ulpi(struct ov_device* ov, uint8_t addr, ov_register_callback callback, void* user_data) {
+	if (cha_loop_request(&ov->loop, CHA_REQUEST_ULPI_READ, addr, 0, callback, user_data) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_write_ulpi(struct ov_device* ov, uint8_t addr, uint8_t value, ov_register_callback callback, void* user_data) {
+	if (cha_loop_request(&ov->loop, CHA_REQUEST_ULPI_WRITE, addr, value, callback, user_data) < 0) {
+		ov->error_str = cha_get_error_string(&ov->cha);
+		return -1;
+	}
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_capture_get_timeout(struct ov_device* ov) {
+	return cha_loop_get_timeout(&ov->loop);
+}
+
+/* Handle only the ready events, transfers stay in flight */
+OPENVIZSLA_EXPORT
+int ov_capture_process_events(struct ov_device* ov) {
+	return ov_capture_dispatch_timeout(ov, 0, 0);
+}
+
 OPENVIZSLA_EXPORT
 ov_packet_decoder_callback ov_capture_set_callback(struct ov_device* ov, ov_packet_decoder_callback callback, void* user_data) {
+	if (ov->aggregator)
+		return aggregator_set_callback(ov->aggregator, callback, user_data);
+
 	return cha_loop_set_callback(&ov->loop, callback, user_data);
 }
 
@@ -262,13 +829,24 @@ OPENVIZSLA_EXPORT
 int ov_capture_stop(struct ov_device* ov) {
 	int ret = 0;
 
+	usbstat_begin(&ov->usbstat, OV_CALL_CAPTURE_STOP);
+
 	if (cha_halt_stream(&ov->cha) < 0) {
 		ret = -1;
 		ov->error_str = cha_get_error_string(&ov->cha);
 	}
 
+	/* Runs seen so far are still reported */
+	if (ov->aggregator)
+		ov_aggregator_flush(ov->aggregator);
+
 	ov_capture_set_callback(ov, NULL, NULL);
+	cha_loop_set_records(&ov->loop, NULL);
+	/* No more requests while the stream is drained */
+	ov->loop.backlog.interval_ms = 0;
+	cha_loop_abort_requests(&ov->loop);
 	ov->loop.state = RUNNING;
+	atomic_store_long(&ov->loop.break_requested, 0);
 
 	if ((ret = cha_loop_run(&ov->loop, -1)) < 0 && ret != -HOST_READ_OFF) {
 		ret = -1;
@@ -279,11 +857,32 @@ int ov_capture_stop(struct ov_device* ov) {
 
 	cha_loop_destroy(&ov->loop);
 
+	/* Packets still referenced by the user keep the pool alive */
+	if (ov->pool) {
+		packet_pool_unref(ov->pool);
+		ov->pool = NULL;
+	}
+
+	if (ov->aggregator) {
+		ov_aggregator_free(ov->aggregator);
+		ov->aggregator = NULL;
+	}
+
+	if (ov->records.buf)
+		record_buffer_destroy(&ov->records);
+
+	if (ov->queue_packet) {
+		packet_queue_destroy(&ov->queue);
+		free(ov->queue_packet);
+		ov->queue_packet = NULL;
+	}
+
 	if (cha_stop_stream(&ov->cha) < 0) {
 		ret = -1;
 		ov->error_str = cha_get_error_string(&ov->cha);
 	}
 
+	usbstat_end(&ov->usbstat);
 	return ret;
 }
 
@@ -293,6 +892,8 @@ int ov_load_firmware(struct ov_device* ov, const char* filename) {
 	struct fwpkg fwpkg;
 	struct reg reg;
 
+	usbstat_begin(&ov->usbstat, OV_CALL_LOAD_FIRMWARE);
+
 	ret = fwpkg_init(&fwpkg, filename);
 	if (ret < 0) {
 		ov->error_str = fwpkg_get_error_string(&fwpkg);
@@ -318,6 +919,7 @@ int ov_load_firmware(struct ov_device* ov, const char* filename) {
 
 	fwpkg_destroy(&fwpkg);
 
+	usbstat_end(&ov->usbstat);
 	return 0;
 
 fail_cha_set_reg:
@@ -326,9 +928,32 @@ fail_reg_init_from_fwpkg:
 	fwpkg_destroy(&fwpkg);
 fail_fwpkg_init:
 
+	usbstat_end(&ov->usbstat);
 	return -1;
 }
 
+OPENVIZSLA_EXPORT
+int ov_get_call_stats(struct ov_device* ov, enum ov_call call, struct ov_call_stats* stats) {
+	if ((unsigned int)call >= OV_CALL_COUNT) {
+		ov->error_str = "Unknown call";
+		return -1;
+	}
+
+	*stats = ov->usbstat.calls[call];
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+void ov_reset_call_stats(struct ov_device* ov) {
+	memset(ov->usbstat.calls, 0, sizeof(ov->usbstat.calls));
+}
+
+OPENVIZSLA_EXPORT
+size_t ov_format_call_stats(struct ov_device* ov, char* buf, size_t size) {
+	return usbstat_format(&ov->usbstat, buf, size);
+}
+
 OPENVIZSLA_EXPORT
 const char* ov_get_error_string(struct ov_device* ov) {
 	return ov->error_str;
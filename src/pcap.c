@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <pcap.h>
+
+#include <string.h>
+
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+/* Files are written in host byte order, readers detect it by the magic */
+
+static uint8_t* put16(uint8_t* buf, uint16_t value) {
+	memcpy(buf, &value, sizeof(value));
+	return buf + sizeof(value);
+}
+
+static uint8_t* put32(uint8_t* buf, uint32_t value) {
+	memcpy(buf, &value, sizeof(value));
+	return buf + sizeof(value);
+}
+
+size_t pcap_file_header(uint8_t* buf, enum ov_sink_format format, uint32_t linktype) {
+	uint8_t* p = buf;
+
+	switch (format) {
+	case OV_SINK_PCAP: {
+		p = put32(p, PCAP_NANOSEC_MAGIC);
+		p = put16(p, 2);
+		p = put16(p, 4);
+		p = put32(p, 0);
+		p = put32(p, 0);
+		p = put32(p, 65535);
+		p = put32(p, linktype);
+	} break;
+	case OV_SINK_PCAPNG: {
+		/* Section Header Block */
+		p = put32(p, PCAPNG_BLOCK_SHB);
+		p = put32(p, PCAPNG_SHB_SIZE);
+		p = put32(p, PCAPNG_BYTE_ORDER_MAGIC);
+		p = put16(p, 1);
+		p = put16(p, 0);
+		/* Section length is not specified */
+		p = put32(p, 0xffffffff);
+		p = put32(p, 0xffffffff);
+		p = put32(p, PCAPNG_SHB_SIZE);
+
+		/* Interface Description Block with nanosecond resolution */
+		p = put32(p, PCAPNG_BLOCK_IDB);
+		p = put32(p, PCAPNG_IDB_SIZE);
+		p = put16(p, linktype);
+		p = put16(p, 0);
+		p = put32(p, 65535);
+		p = put16(p, PCAPNG_OPT_IF_TSRESOL);
+		p = put16(p, 1);
+		/* Single byte value, 10^-9 s, padded to 32 bits */
+		*p++ = 9;
+		memset(p, 0, 3);
+		p += 3;
+		p = put32(p, PCAPNG_OPT_ENDOFOPT);
+		p = put32(p, PCAPNG_IDB_SIZE);
+	} break;
+	}
+
+	return p - buf;
+}
+
+size_t pcap_record_size(enum ov_sink_format format, const struct ov_packet* packet) {
+	const uint32_t incl_len = ov_packet_captured_size((struct ov_packet*)packet);
+
+	switch (format) {
+	case OV_SINK_PCAP:
+		return PCAP_RECORD_HEADER_SIZE + incl_len;
+	case OV_SINK_PCAPNG:
+		return PCAPNG_EPB_HEADER_SIZE + ((incl_len + 3) & ~3u);
+	}
+
+	return 0;
+}
+
+size_t pcap_record(uint8_t* buf, enum ov_sink_format format, const struct ov_packet* packet) {
+	const uint32_t incl_len = ov_packet_captured_size((struct ov_packet*)packet);
+	const uint64_t timestamp = packet->timestamp;
+	uint8_t* p = buf;
+
+	switch (format) {
+	case OV_SINK_PCAP: {
+		p = put32(p, timestamp / 1000000000);
+		p = put32(p, timestamp % 1000000000);
+		p = put32(p, incl_len);
+		p = put32(p, packet->size);
+		memcpy(p, packet->data, incl_len);
+		p += incl_len;
+	} break;
+	case OV_SINK_PCAPNG: {
+		const uint32_t padding = (4 - (incl_len & 3)) & 3;
+		const uint32_t block_size = PCAPNG_EPB_HEADER_SIZE + incl_len + padding;
+
+		p = put32(p, PCAPNG_BLOCK_EPB);
+		p = put32(p, block_size);
+		p = put32(p, 0);
+		p = put32(p, timestamp >> 32);
+		p = put32(p, timestamp & 0xffffffff);
+		p = put32(p, incl_len);
+		p = put32(p, packet->size);
+		memcpy(p, packet->data, incl_len);
+		p += incl_len;
+		memset(p, 0, padding);
+		p += padding;
+		p = put32(p, block_size);
+	} break;
+	}
+
+	return p - buf;
+}
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <atomic.h>
+#include <pool.h>
+
+#include <openvizsla_export.h>
+
+#include <stdlib.h>
+
+static int packet_pool_grow(struct packet_pool* pool) {
+	struct packet_slab* slab = NULL;
+	size_t i;
+
+	slab = malloc(sizeof(struct packet_slab));
+	if (!slab)
+		goto fail_malloc_slab;
+
+	slab->buf = malloc(pool->slab_size * PACKET_SLOT_SIZE);
+	if (!slab->buf)
+		goto fail_malloc_buf;
+
+	for (i = 0; i < pool->slab_size; ++i) {
+		struct packet_slot* slot = (struct packet_slot*)(slab->buf + i * PACKET_SLOT_SIZE);
+
+		slot->pool = pool;
+		slot->refcount = 0;
+		slot->next = pool->free_list;
+		pool->free_list = slot;
+	}
+
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	return 0;
+
+fail_malloc_buf:
+	free(slab);
+fail_malloc_slab:
+	return -1;
+}
+
+struct packet_pool* packet_pool_new(size_t slab_size) {
+	struct packet_pool* pool = NULL;
+
+	pool = calloc(1, sizeof(struct packet_pool));
+	if (!pool)
+		goto fail_calloc;
+
+	pool->slab_size = (slab_size > 0 ? slab_size : 1);
+	pool->refcount = 1;
+
+	if (packet_pool_grow(pool) < 0)
+		goto fail_packet_pool_grow;
+
+	return pool;
+
+fail_packet_pool_grow:
+	free(pool);
+fail_calloc:
+	return NULL;
+}
+
+/* Must be called from the capture thread only */
+struct ov_packet* packet_pool_get(struct packet_pool* pool) {
+	struct packet_slot* slot = NULL;
+
+	if (!pool->free_list)
+		pool->free_list = atomic_exchange_ptr(&pool->returned, NULL);
+
+	if (!pool->free_list && packet_pool_grow(pool) < 0)
+		return NULL;
+
+	slot = pool->free_list;
+	pool->free_list = slot->next;
+	slot->next = NULL;
+	slot->refcount = 1;
+	atomic_inc(&pool->refcount);
+
+	return packet_slot_packet(slot);
+}
+
+static void packet_pool_put(struct packet_pool* pool, struct packet_slot* slot) {
+	void* head = NULL;
+
+	do {
+		head = atomic_load_ptr(&pool->returned);
+		slot->next = head;
+	} while (!atomic_cas_ptr(&pool->returned, head, slot));
+
+	packet_pool_unref(pool);
+}
+
+void packet_pool_unref(struct packet_pool* pool) {
+	struct packet_slab* slab = NULL;
+
+	if (atomic_dec(&pool->refcount) > 0)
+		return;
+
+	while ((slab = pool->slabs)) {
+		pool->slabs = slab->next;
+		free(slab->buf);
+		free(slab);
+	}
+
+	free(pool);
+}
+
+OPENVIZSLA_EXPORT
+struct ov_packet* ov_packet_ref(struct ov_packet* packet) {
+	atomic_inc(&packet_slot_from_packet(packet)->refcount);
+
+	return packet;
+}
+
+OPENVIZSLA_EXPORT
+void ov_packet_unref(struct ov_packet* packet) {
+	struct packet_slot* slot = packet_slot_from_packet(packet);
+
+	if (atomic_dec(&slot->refcount) == 0)
+		packet_pool_put(slot->pool, slot);
+}
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <queue.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t packet_queue_record_size(const struct ov_packet* packet) {
+	const size_t size = sizeof(struct ov_packet) + ov_packet_captured_size((struct ov_packet*)packet);
+
+	return (size + PACKET_QUEUE_ALIGN - 1) & ~(size_t)(PACKET_QUEUE_ALIGN - 1);
+}
+
+static void packet_queue_reset(struct packet_queue* queue) {
+	queue->head = 0;
+	queue->read = 0;
+	queue->tail = 0;
+	queue->wrap_end = 0;
+	queue->wrapped = 0;
+	queue->count = 0;
+	queue->unread = 0;
+}
+
+int packet_queue_init(struct packet_queue* queue, size_t size) {
+	if (size < PACKET_QUEUE_MIN_SIZE)
+		size = PACKET_QUEUE_MIN_SIZE;
+
+	queue->buf = malloc(size);
+	if (!queue->buf)
+		return -1;
+
+	queue->size = size;
+	packet_queue_reset(queue);
+
+	return 0;
+}
+
+int packet_queue_push(struct packet_queue* queue, const struct ov_packet* packet) {
+	const size_t size = packet_queue_record_size(packet);
+
+	if (queue->count == 0)
+		packet_queue_reset(queue);
+
+	if (!queue->wrapped && queue->size - queue->tail < size) {
+		if (queue->head < size)
+			return -1;
+
+		queue->wrap_end = queue->tail;
+		queue->tail = 0;
+		queue->wrapped = 1;
+
+		/* Nothing unread was left before the wrap point */
+		if (queue->read == queue->wrap_end)
+			queue->read = 0;
+	} else if (queue->wrapped && queue->head - queue->tail < size) {
+		return -1;
+	}
+
+	memcpy(queue->buf + queue->tail, packet, sizeof(struct ov_packet) + ov_packet_captured_size((struct ov_packet*)packet));
+	queue->tail += size;
+	queue->count++;
+	queue->unread++;
+
+	return 0;
+}
+
+struct ov_packet* packet_queue_next(struct packet_queue* queue) {
+	struct ov_packet* packet = NULL;
+
+	if (queue->unread == 0)
+		return NULL;
+
+	if (queue->wrapped && queue->read == queue->wrap_end)
+		queue->read = 0;
+
+	packet = (struct ov_packet*)(queue->buf + queue->read);
+	queue->read += packet_queue_record_size(packet);
+	queue->unread--;
+
+	return packet;
+}
+
+size_t packet_queue_release(struct packet_queue* queue, size_t count) {
+	size_t released = 0;
+
+	for (; released < count && queue->count > queue->unread; ++released) {
+		queue->head += packet_queue_record_size((struct ov_packet*)(queue->buf + queue->head));
+		queue->count--;
+
+		if (queue->wrapped && queue->head == queue->wrap_end) {
+			queue->head = 0;
+			queue->wrapped = 0;
+			if (queue->read == queue->wrap_end)
+				queue->read = 0;
+		}
+	}
+
+	if (queue->count == 0)
+		packet_queue_reset(queue);
+
+	return released;
+}
+
+/* The largest contiguous free region */
+size_t packet_queue_free_space(const struct packet_queue* queue) {
+	if (queue->count == 0)
+		return queue->size;
+
+	if (queue->wrapped)
+		return queue->head - queue->tail;
+
+	return (queue->size - queue->tail > queue->head ? queue->size - queue->tail : queue->head);
+}
+
+void packet_queue_destroy(struct packet_queue* queue) {
+	free(queue->buf);
+	queue->buf = NULL;
+}
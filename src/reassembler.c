@@ -0,0 +1,386 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <reassembler.h>
+#include <usb.h>
+
+#include <openvizsla_export.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define USB_REQUEST_CLEAR_FEATURE 0x01
+#define USB_REQUEST_SET_CONFIGURATION 0x09
+#define USB_REQUEST_SET_INTERFACE 0x0b
+#define USB_RECIPIENT_ENDPOINT 0x02
+#define USB_FEATURE_ENDPOINT_HALT 0x00
+
+static struct reasm_endpoint* reasm_endpoint(struct ov_reassembler* reasm, uint8_t address, uint8_t endpoint, int in) {
+	return &reasm->endpoints[((address & 0x7f) * REASM_ENDPOINTS + (endpoint & 0x0f)) * 2 + !!in];
+}
+
+static void reasm_finish_transfer(struct ov_reassembler* reasm, struct reasm_endpoint* ep, uint8_t address, uint8_t endpoint, int in, enum ov_transfer_status status) {
+	struct ov_transfer transfer = {
+		.first_ts = ep->first_ts,
+		.last_ts = ep->last_ts,
+		.address = address,
+		.endpoint = endpoint,
+		.direction = in,
+		.control = ep->control,
+		.status = status,
+		.size = ep->size,
+		.data = ep->buf,
+	};
+
+	if (ep->control)
+		memcpy(transfer.setup, ep->setup, USB_SETUP_SIZE);
+
+	if (reasm->transfer_callback)
+		reasm->transfer_callback(&transfer, reasm->user_data);
+
+	ep->active = 0;
+	ep->control = 0;
+	ep->size = 0;
+}
+
+static int reasm_append(struct ov_reassembler* reasm, struct reasm_endpoint* ep, const struct ov_transaction* t) {
+	if (!ep->buf) {
+		ep->buf = malloc(reasm->max_transfer_size);
+		if (!ep->buf)
+			return -1;
+	}
+
+	if (!ep->active) {
+		ep->active = 1;
+		ep->size = 0;
+		ep->first_ts = t->timestamp;
+	}
+
+	memcpy(ep->buf + ep->size, t->data, t->data_size);
+	ep->size += t->data_size;
+	ep->last_ts = t->timestamp;
+
+	return 0;
+}
+
+/* Data toggle is reset by these requests, otherwise the next packet would
+ * be taken for a retransmission */
+static void reasm_control_complete(struct ov_reassembler* reasm, const struct reasm_endpoint* ep, uint8_t address) {
+	const uint8_t request_type = ep->setup[0];
+	const uint8_t request = ep->setup[1];
+	const uint16_t value = ep->setup[2] | (ep->setup[3] << 8);
+	const uint8_t index = ep->setup[4];
+	size_t i;
+
+	if (request == USB_REQUEST_CLEAR_FEATURE && (request_type & 0x1f) == USB_RECIPIENT_ENDPOINT && value == USB_FEATURE_ENDPOINT_HALT) {
+		reasm_endpoint(reasm, address, index & 0x0f, index & 0x80)->last_toggle = 0;
+	} else if (request == USB_REQUEST_SET_CONFIGURATION || request == USB_REQUEST_SET_INTERFACE) {
+		for (i = 0; i < REASM_ENDPOINTS * 2; ++i)
+			reasm->endpoints[(address & 0x7f) * REASM_ENDPOINTS * 2 + i].last_toggle = 0;
+	}
+}
+
+static void reasm_setup(struct ov_reassembler* reasm, const struct ov_transaction* t) {
+	struct reasm_endpoint* ep = reasm_endpoint(reasm, t->address, t->endpoint, 0);
+
+	if (t->handshake != USB_PID_HANDSHAKE_ACK || t->data_size != USB_SETUP_SIZE)
+		return;
+
+	/* New SETUP aborts the previous control transfer */
+	if (ep->active)
+		reasm_finish_transfer(reasm, ep, t->address, t->endpoint, ep->control_in, OV_TRANSFER_PARTIAL);
+
+	if (!ep->buf) {
+		ep->buf = malloc(reasm->max_transfer_size);
+		if (!ep->buf)
+			return;
+	}
+
+	memcpy(ep->setup, t->data, USB_SETUP_SIZE);
+	ep->control = 1;
+	ep->control_length = ep->setup[6] | (ep->setup[7] << 8);
+	/* Status stage is IN when there is no data stage */
+	ep->control_in = (ep->control_length > 0 && (ep->setup[0] & 0x80));
+	ep->control_data_done = (ep->control_length == 0);
+	ep->active = 1;
+	ep->size = 0;
+	ep->first_ts = t->timestamp;
+	ep->last_ts = t->timestamp;
+	ep->last_toggle = USB_PID_DATA_DATA0;
+}
+
+static void reasm_control(struct ov_reassembler* reasm, struct reasm_endpoint* ep, const struct ov_transaction* t) {
+	const int in = (t->token == USB_PID_TOKEN_IN);
+
+	if (t->handshake == USB_PID_HANDSHAKE_STALL) {
+		reasm_finish_transfer(reasm, ep, t->address, t->endpoint, ep->control_in, OV_TRANSFER_STALL);
+		return;
+	}
+
+	if (t->handshake != USB_PID_HANDSHAKE_ACK && t->handshake != USB_PID_HANDSHAKE_NYET)
+		return;
+
+	if (in == ep->control_in && !ep->control_data_done) {
+		if (t->data_pid == ep->last_toggle)
+			return;
+
+		ep->last_toggle = t->data_pid;
+
+		if (ep->size + t->data_size > reasm->max_transfer_size) {
+			reasm_finish_transfer(reasm, ep, t->address, t->endpoint, ep->control_in, OV_TRANSFER_PARTIAL);
+			return;
+		}
+
+		reasm_append(reasm, ep, t);
+
+		if (ep->size >= ep->control_length || (ep->max_packet_size && t->data_size < ep->max_packet_size) || t->data_size == 0)
+			ep->control_data_done = 1;
+		if (!ep->max_packet_size_fixed && t->data_size > ep->max_packet_size)
+			ep->max_packet_size = t->data_size;
+	} else if (in != ep->control_in) {
+		/* Status stage */
+		ep->last_ts = t->timestamp;
+		reasm_control_complete(reasm, ep, t->address);
+		reasm_finish_transfer(reasm, ep, t->address, t->endpoint, ep->control_in, OV_TRANSFER_COMPLETE);
+	}
+}
+
+static void reasm_transfer(struct ov_reassembler* reasm, const struct ov_transaction* t) {
+	const int in = (t->token == USB_PID_TOKEN_IN);
+	struct reasm_endpoint* control = NULL;
+	struct reasm_endpoint* ep = NULL;
+	int isochronous = 0;
+
+	switch (t->token) {
+	case USB_PID_TOKEN_SETUP: {
+		reasm_setup(reasm, t);
+		return;
+	} break;
+	case USB_PID_SPECIAL_PING: {
+		return;
+	} break;
+	}
+
+	control = reasm_endpoint(reasm, t->address, t->endpoint, 0);
+	if (control->control && control->active) {
+		reasm_control(reasm, control, t);
+		return;
+	}
+
+	ep = reasm_endpoint(reasm, t->address, t->endpoint, in);
+
+	if (t->handshake == USB_PID_HANDSHAKE_STALL) {
+		reasm_finish_transfer(reasm, ep, t->address, t->endpoint, in, OV_TRANSFER_STALL);
+		ep->last_toggle = 0;
+		return;
+	}
+
+	/* NAK, or NYET to a complete split without data */
+	if (!t->data_pid)
+		return;
+
+	isochronous = (t->handshake == 0);
+
+	if (!isochronous) {
+		if (t->handshake != USB_PID_HANDSHAKE_ACK && t->handshake != USB_PID_HANDSHAKE_NYET)
+			return;
+
+		/* The handshake was lost and the host sent the same packet again */
+		if ((t->data_pid == USB_PID_DATA_DATA0 || t->data_pid == USB_PID_DATA_DATA1) && t->data_pid == ep->last_toggle)
+			return;
+
+		ep->last_toggle = t->data_pid;
+	}
+
+	if (ep->active && ep->size + t->data_size > reasm->max_transfer_size)
+		reasm_finish_transfer(reasm, ep, t->address, t->endpoint, in, OV_TRANSFER_PARTIAL);
+
+	if (reasm_append(reasm, ep, t) < 0)
+		return;
+
+	if (!ep->max_packet_size_fixed && t->data_size > ep->max_packet_size)
+		ep->max_packet_size = t->data_size;
+
+	/* Short packet ends the transfer */
+	if (isochronous || t->data_size < ep->max_packet_size || t->data_size == 0)
+		reasm_finish_transfer(reasm, ep, t->address, t->endpoint, in, OV_TRANSFER_COMPLETE);
+}
+
+static void reasm_finish_transaction(struct ov_reassembler* reasm) {
+	struct ov_transaction* t = &reasm->transaction;
+
+	if (reasm->state != REASM_TOKEN && reasm->state != REASM_DATA) {
+		reasm->state = REASM_IDLE;
+		return;
+	}
+
+	reasm->state = REASM_IDLE;
+
+	if (reasm->transaction_callback)
+		reasm->transaction_callback(t, reasm->user_data);
+
+	reasm_transfer(reasm, t);
+}
+
+static void reasm_token(struct ov_reassembler* reasm, const struct ov_packet* packet) {
+	struct ov_transaction* t = &reasm->transaction;
+
+	memset(t, 0, sizeof(struct ov_transaction));
+	t->timestamp = packet->timestamp;
+	t->token = packet->data[0];
+	t->address = usb_token_address(packet->data);
+	t->endpoint = usb_token_endpoint(packet->data);
+	t->data = reasm->data;
+
+	if (reasm->state == REASM_SPLIT) {
+		t->split = reasm->split;
+		t->split_hub = reasm->split_hub;
+		t->split_port = reasm->split_port;
+	}
+
+	reasm->state = REASM_TOKEN;
+}
+
+OPENVIZSLA_EXPORT
+void ov_reassembler_packet(struct ov_packet* packet, void* data) {
+	struct ov_reassembler* reasm = (struct ov_reassembler*)data;
+	const size_t captured = ov_packet_captured_size(packet);
+	uint8_t pid;
+
+	if (captured == 0)
+		return;
+
+	/* Damaged packet breaks the transaction */
+	if (packet->flags & OV_FLAGS_HF0_ERR) {
+		reasm->state = REASM_IDLE;
+		return;
+	}
+
+	pid = packet->data[0];
+
+	switch (pid) {
+	case USB_PID_TOKEN_SOF: {
+		reasm_finish_transaction(reasm);
+	} break;
+	case USB_PID_SPECIAL_SPLIT: {
+		reasm_finish_transaction(reasm);
+
+		if (captured < USB_SPLIT_SIZE)
+			break;
+
+		reasm->split = ((packet->data[1] & 0x80) ? OV_SPLIT_COMPLETE : OV_SPLIT_START);
+		reasm->split_hub = packet->data[1] & 0x7f;
+		reasm->split_port = packet->data[2] & 0x7f;
+		reasm->state = REASM_SPLIT;
+	} break;
+	case USB_PID_TOKEN_OUT:
+	case USB_PID_TOKEN_IN:
+	case USB_PID_TOKEN_SETUP:
+	case USB_PID_SPECIAL_PING: {
+		if (reasm->state != REASM_SPLIT)
+			reasm_finish_transaction(reasm);
+
+		if (captured < USB_TOKEN_SIZE) {
+			reasm->state = REASM_IDLE;
+			break;
+		}
+
+		reasm_token(reasm, packet);
+	} break;
+	case USB_PID_DATA_DATA0:
+	case USB_PID_DATA_DATA1:
+	case USB_PID_DATA_DATA2:
+	case USB_PID_DATA_MDATA: {
+		struct ov_transaction* t = &reasm->transaction;
+
+		if (reasm->state != REASM_TOKEN) {
+			reasm_finish_transaction(reasm);
+			break;
+		}
+
+		/* Strip PID and CRC16 */
+		t->data_pid = pid;
+		t->data_size = (captured >= 3 ? captured - 3 : 0);
+		memcpy(reasm->data, packet->data + 1, t->data_size);
+		reasm->state = REASM_DATA;
+	} break;
+	case USB_PID_HANDSHAKE_ACK:
+	case USB_PID_HANDSHAKE_NAK:
+	case USB_PID_HANDSHAKE_STALL:
+	case USB_PID_HANDSHAKE_NYET:
+	case USB_PID_SPECIAL_PRE_OR_ERR: {
+		if (reasm->state != REASM_TOKEN && reasm->state != REASM_DATA) {
+			reasm->state = REASM_IDLE;
+			break;
+		}
+
+		reasm->transaction.handshake = pid;
+		reasm_finish_transaction(reasm);
+	} break;
+	default: {
+		reasm_finish_transaction(reasm);
+	} break;
+	}
+}
+
+OPENVIZSLA_EXPORT
+void ov_reassembler_flush(struct ov_reassembler* reasm) {
+	size_t i;
+
+	reasm_finish_transaction(reasm);
+
+	for (i = 0; i < REASM_ADDRESSES * REASM_ENDPOINTS * 2; ++i) {
+		struct reasm_endpoint* ep = &reasm->endpoints[i];
+		const uint8_t address = i / (REASM_ENDPOINTS * 2);
+		const uint8_t endpoint = (i / 2) % REASM_ENDPOINTS;
+
+		if (ep->active)
+			reasm_finish_transfer(reasm, ep, address, endpoint, (ep->control ? ep->control_in : (int)(i & 1)), OV_TRANSFER_PARTIAL);
+	}
+}
+
+OPENVIZSLA_EXPORT
+int ov_reassembler_set_max_packet_size(struct ov_reassembler* reasm, uint8_t address, uint8_t endpoint, int in, uint16_t max_packet_size) {
+	struct reasm_endpoint* ep = NULL;
+
+	if (address >= REASM_ADDRESSES || endpoint >= REASM_ENDPOINTS || max_packet_size > OV_MAX_PACKET_SIZE)
+		return -1;
+
+	ep = reasm_endpoint(reasm, address, endpoint, in);
+	ep->max_packet_size = max_packet_size;
+	ep->max_packet_size_fixed = (max_packet_size > 0);
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+struct ov_reassembler* ov_reassembler_new(size_t max_transfer_size, ov_transaction_callback transaction_callback, ov_transfer_callback transfer_callback, void* user_data) {
+	struct ov_reassembler* reasm = NULL;
+
+	if (max_transfer_size == 0)
+		max_transfer_size = REASM_DEFAULT_TRANSFER_SIZE;
+	if (max_transfer_size < OV_MAX_PACKET_SIZE)
+		max_transfer_size = OV_MAX_PACKET_SIZE;
+
+	reasm = calloc(1, sizeof(struct ov_reassembler));
+	if (!reasm) {
+		return NULL;
+	}
+
+	reasm->transaction_callback = transaction_callback;
+	reasm->transfer_callback = transfer_callback;
+	reasm->user_data = user_data;
+	reasm->max_transfer_size = max_transfer_size;
+	reasm->state = REASM_IDLE;
+
+	return reasm;
+}
+
+OPENVIZSLA_EXPORT
+void ov_reassembler_free(struct ov_reassembler* reasm) {
+	size_t i;
+
+	for (i = 0; i < REASM_ADDRESSES * REASM_ENDPOINTS * 2; ++i)
+		free(reasm->endpoints[i].buf);
+
+	free(reasm);
+}
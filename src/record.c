@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <record.h>
+#include <usb.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+int record_buffer_init(struct record_buffer* rb, size_t size, ov_record_callback callback, void* user_data) {
+	if (size < RECORD_BUFFER_MIN_SIZE)
+		size = RECORD_BUFFER_MIN_SIZE;
+
+	rb->buf = malloc(size);
+	if (!rb->buf)
+		return -1;
+
+	rb->size = size;
+	rb->used = 0;
+	rb->count = 0;
+	rb->callback = callback;
+	rb->user_data = user_data;
+
+	return 0;
+}
+
+struct ov_packet* record_buffer_packet(struct record_buffer* rb) {
+	return (struct ov_packet*)(rb->buf + rb->used + RECORD_PACKET_OFFSET);
+}
+
+void record_buffer_commit(struct record_buffer* rb) {
+	struct ov_record* record = (struct ov_record*)(rb->buf + rb->used);
+	struct ov_packet packet;
+	size_t captured;
+
+	/* Both headers overlap, so read the packet one first */
+	memcpy(&packet, rb->buf + rb->used + RECORD_PACKET_OFFSET, sizeof(packet));
+	captured = ov_packet_captured_size(&packet);
+
+	record->timestamp = packet.timestamp;
+	record->size = packet.size;
+	record->captured = captured;
+	record->flags = packet.flags;
+	record->pid = (captured > 0 ? record->data[0] : 0);
+
+	if (captured >= USB_TOKEN_SIZE && usb_pid_has_endpoint(record->pid)) {
+		record->addr = usb_token_address(record->data);
+		record->endp = usb_token_endpoint(record->data);
+	} else {
+		record->addr = OV_RECORD_NONE;
+		record->endp = OV_RECORD_NONE;
+	}
+
+	rb->used += ov_record_size(record);
+	rb->count++;
+
+	if (rb->size - rb->used < RECORD_MAX_SIZE)
+		record_buffer_flush(rb);
+}
+
+void record_buffer_flush(struct record_buffer* rb) {
+	if (rb->count == 0)
+		return;
+
+	if (rb->callback)
+		rb->callback((const struct ov_record*)rb->buf, rb->used, rb->count, rb->user_data);
+
+	rb->used = 0;
+	rb->count = 0;
+}
+
+void record_buffer_destroy(struct record_buffer* rb) {
+	free(rb->buf);
+	rb->buf = NULL;
+}
@@ -130,6 +130,19 @@ fail_malloc:
 	return -1;
 }
 
+int reg_lookup(struct reg* reg, const char* name, uint16_t* addr) {
+	struct reg_decode* rd = in_word_set(name, strlen(name));
+
+	if (!rd) {
+		reg->error_str = "Unknown register name";
+		return -1;
+	}
+
+	*addr = reg->addr[rd->reg_name];
+
+	return 0;
+}
+
 int reg_init_from_reg(struct reg* reg, struct reg* other) {
 	memmove(reg, other, sizeof(struct reg));
 
@@ -0,0 +1,374 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sink.h>
+#ifndef WIN32
+#include <aio_writer.h>
+#endif
+
+#include <openvizsla_export.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+void sink_init(struct ov_sink* sink, const struct sink_ops* ops) {
+	sink->ops = ops;
+	sink->is_open = 0;
+	sink->error_str = NULL;
+}
+
+int sink_file_init(struct sink_file* sf, size_t buf_size) {
+	memset(sf, 0, sizeof(struct sink_file));
+
+	sf->buf = malloc(buf_size);
+	if (!sf->buf) {
+		sf->error_str = "Can not allocate file buffer";
+		return -1;
+	}
+
+	sf->buf_size = buf_size;
+
+	return 0;
+}
+
+int sink_file_set_async(struct sink_file* sf, size_t buf_count, unsigned int flags) {
+#ifdef WIN32
+	sf->error_str = "Asynchronous writing is not supported";
+	return -1;
+#else
+	struct aio_writer* aio = NULL;
+	unsigned int aio_flags = 0;
+	size_t buf_size = sf->buf_size;
+
+	if (sf->aio) {
+		sf->error_str = "Asynchronous writing is already enabled";
+		return -1;
+	}
+
+	if (flags & OV_SINK_ASYNC_DIRECT) {
+		aio_flags |= AIO_DIRECT;
+		/* Room for the unaligned tail carried over between buffers */
+		buf_size += AIO_ALIGN;
+	}
+
+	aio = malloc(sizeof(struct aio_writer));
+	if (!aio) {
+		sf->error_str = "Can not allocate asynchronous writer";
+		return -1;
+	}
+
+	if (aio_writer_init(aio, buf_count, buf_size, aio_flags) < 0) {
+		sf->error_str = aio->error_str;
+		free(aio);
+		return -1;
+	}
+
+	/* Buffers come from the pool from now on */
+	free(sf->buf);
+	sf->buf = NULL;
+	sf->buf_size = aio->buf_size;
+	sf->aio = aio;
+
+	return 0;
+#endif
+}
+
+int sink_file_open(struct sink_file* sf, const char* filename, uint64_t prealloc) {
+#ifndef WIN32
+	if (sf->aio) {
+		if (aio_writer_open(sf->aio, filename, prealloc) < 0) {
+			sf->error_str = sf->aio->error_str;
+			return -1;
+		}
+
+		sf->aio_buffer = NULL;
+		sf->buf = NULL;
+		sf->buf_used = 0;
+		sf->size = 0;
+
+		return 0;
+	}
+#endif
+
+	/* An existing file, e.g. a ring segment, keeps its blocks and is
+	 * overwritten from the start, the stale tail is cut on close */
+	sf->file = fopen(filename, "r+b");
+	if (!sf->file)
+		sf->file = fopen(filename, "wb");
+	if (!sf->file) {
+		sf->error_str = "Can not open file";
+		return -1;
+	}
+
+	/* Records are gathered in buf, stdio buffering would only add a copy */
+	setvbuf(sf->file, NULL, _IONBF, 0);
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+	/* Reserve the blocks up front without changing the file size. Blocks
+	 * of a reused file are kept, so only the missing ones are allocated.
+	 * Not all filesystems support it, so failure is not an error. */
+	if (prealloc)
+		fallocate(fileno(sf->file), FALLOC_FL_KEEP_SIZE, 0, prealloc);
+#endif
+
+	sf->buf_used = 0;
+	sf->size = 0;
+
+	return 0;
+}
+
+#ifndef WIN32
+static int sink_file_acquire(struct sink_file* sf) {
+	sf->aio_buffer = aio_writer_get_buffer(sf->aio);
+	if (!sf->aio_buffer) {
+		sf->error_str = sf->aio->error_str;
+		return -1;
+	}
+
+	sf->buf = sf->aio_buffer->data;
+
+	return 0;
+}
+
+static int sink_file_submit(struct sink_file* sf) {
+	const uint8_t* tail = NULL;
+	size_t length = sf->buf_used;
+	size_t tail_length = 0;
+
+	/* O_DIRECT writes whole blocks, keep the tail for the next buffer */
+	if (sf->aio->direct)
+		length &= ~(size_t)(AIO_ALIGN - 1);
+
+	if (length == 0)
+		return 0;
+
+	tail = sf->buf + length;
+	tail_length = sf->buf_used - length;
+
+	if (aio_writer_submit(sf->aio, sf->aio_buffer, length) < 0) {
+		sf->error_str = sf->aio->error_str;
+		sf->aio_buffer = NULL;
+		return -1;
+	}
+
+	/* The submitted buffer is only read by the writer, so the tail may
+	 * be copied out of it. It may even be the same buffer again. */
+	if (sink_file_acquire(sf) < 0)
+		return -1;
+
+	memmove(sf->buf, tail, tail_length);
+	sf->buf_used = tail_length;
+
+	return 0;
+}
+#endif
+
+uint8_t* sink_file_reserve(struct sink_file* sf, size_t size) {
+	if (size > sf->buf_size) {
+		sf->error_str = "File buffer is too small";
+		return NULL;
+	}
+
+#ifndef WIN32
+	if (sf->aio && !sf->aio_buffer && sink_file_acquire(sf) < 0)
+		return NULL;
+#endif
+
+	if (sf->buf_used + size > sf->buf_size && sink_file_flush(sf) < 0)
+		return NULL;
+
+	/* O_DIRECT tail is still there */
+	if (sf->buf_used + size > sf->buf_size) {
+		sf->error_str = "File buffer is too small";
+		return NULL;
+	}
+
+	return sf->buf + sf->buf_used;
+}
+
+void sink_file_commit(struct sink_file* sf, size_t size) {
+	sf->buf_used += size;
+	sf->size += size;
+}
+
+int sink_file_flush(struct sink_file* sf) {
+#ifndef WIN32
+	if (sf->aio)
+		return (sf->aio_buffer ? sink_file_submit(sf) : 0);
+#endif
+
+	if (sf->buf_used && fwrite(sf->buf, 1, sf->buf_used, sf->file) != sf->buf_used) {
+		sf->error_str = "Can not write file";
+		return -1;
+	}
+
+	sf->buf_used = 0;
+
+	return 0;
+}
+
+int sink_file_close(struct sink_file* sf) {
+	int ret = 0;
+
+#ifndef WIN32
+	if (sf->aio) {
+		/* Does not wait, the file is closed when its writes are done */
+		ret = aio_writer_close(sf->aio, sf->aio_buffer, sf->buf_used);
+		if (ret < 0)
+			sf->error_str = sf->aio->error_str;
+
+		sf->aio_buffer = NULL;
+		sf->buf = NULL;
+		sf->buf_used = 0;
+
+		return ret;
+	}
+#endif
+
+	if (!sf->file)
+		return 0;
+
+	ret = sink_file_flush(sf);
+
+#ifdef WIN32
+	if (_chsize_s(_fileno(sf->file), sf->size) != 0 && ret == 0) {
+#else
+	if (ftruncate(fileno(sf->file), sf->size) != 0 && ret == 0) {
+#endif
+		sf->error_str = "Can not truncate file";
+		ret = -1;
+	}
+
+	if (fclose(sf->file) != 0 && ret == 0) {
+		sf->error_str = "Can not close file";
+		ret = -1;
+	}
+	sf->file = NULL;
+
+	return ret;
+}
+
+int sink_file_wait(struct sink_file* sf) {
+#ifndef WIN32
+	if (sf->aio && aio_writer_wait(sf->aio) < 0) {
+		sf->error_str = sf->aio->error_str;
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+void sink_file_destroy(struct sink_file* sf) {
+#ifndef WIN32
+	if (sf->aio) {
+		aio_writer_destroy(sf->aio);
+		free(sf->aio);
+		sf->aio = NULL;
+		return;
+	}
+#endif
+
+	free(sf->buf);
+	sf->buf = NULL;
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_set_async(struct ov_sink* sink, size_t buffer_count, unsigned int flags) {
+	if (sink->is_open) {
+		sink->error_str = "Sink is already open";
+		return -1;
+	}
+
+	if (buffer_count == 0) {
+		sink->error_str = "Invalid buffer count";
+		return -1;
+	}
+
+	return sink->ops->set_async(sink, buffer_count, flags);
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_open(struct ov_sink* sink, enum ov_sink_format format, uint32_t linktype) {
+	if (sink->is_open) {
+		sink->error_str = "Sink is already open";
+		return -1;
+	}
+
+	switch (format) {
+	case OV_SINK_PCAP:
+	case OV_SINK_PCAPNG:
+		break;
+	default: {
+		sink->error_str = "Invalid sink format";
+		return -1;
+	} break;
+	}
+
+	if (sink->ops->open(sink, format, linktype) < 0)
+		return -1;
+
+	sink->is_open = 1;
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_write(struct ov_sink* sink, struct ov_packet* packet) {
+	if (!sink->is_open) {
+		sink->error_str = "Sink is not open";
+		return -1;
+	}
+
+	/* Only write actual USB packets, summaries of the aggregator are not */
+	if (packet->size == 0 || ov_packet_summary(packet))
+		return 0;
+
+	return sink->ops->write(sink, packet);
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_flush(struct ov_sink* sink) {
+	if (!sink->is_open)
+		return 0;
+
+	return sink->ops->flush(sink);
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_close(struct ov_sink* sink) {
+	if (!sink->is_open)
+		return 0;
+
+	sink->is_open = 0;
+
+	return sink->ops->close(sink);
+}
+
+OPENVIZSLA_EXPORT
+void ov_sink_free(struct ov_sink* sink) {
+	ov_sink_close(sink);
+	sink->ops->destroy(sink);
+}
+
+OPENVIZSLA_EXPORT
+void ov_sink_packet_callback(struct ov_packet* packet, void* sink) {
+	/* Errors are reported via ov_sink_get_error_string() */
+	ov_sink_write((struct ov_sink*)sink, packet);
+}
+
+OPENVIZSLA_EXPORT
+const char* ov_sink_get_error_string(struct ov_sink* sink) {
+	return sink->error_str;
+}
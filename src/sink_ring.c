@@ -0,0 +1,353 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <pcap.h>
+#include <sink.h>
+
+#include <openvizsla_export.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SINK_RING_BUFFER_SIZE (1 << 20)
+/* "_" + slot number + "." + extension + '\0' */
+#define SINK_RING_SUFFIX_SIZE 32
+
+/* Segment files are named <prefix>_NNNN.<ext> after their slot in the ring
+ * and are overwritten once the ring wraps. <prefix>.idx lists timestamp
+ * ranges of the segments present, it is rewritten on each rotation. */
+struct sink_ring {
+	struct ov_sink sink;
+
+	char* prefix;
+	char* filename;
+	char* index_filename;
+	enum ov_sink_format format;
+	uint32_t linktype;
+
+	size_t segment_count;
+	uint64_t segment_size;
+	uint64_t segment_ns;
+
+	struct ov_sink_segment* segments;
+	size_t current;
+	uint32_t sequence;
+
+	struct sink_file file;
+};
+
+static const char* sink_ring_extension(enum ov_sink_format format) {
+	return (format == OV_SINK_PCAPNG ? "pcapng" : "pcap");
+}
+
+static void sink_ring_filename(struct sink_ring* ring, size_t slot) {
+	sprintf(ring->filename, "%s_%04u.%s", ring->prefix, (unsigned int)slot, sink_ring_extension(ring->format));
+}
+
+static int sink_ring_write_index(struct sink_ring* ring) {
+	FILE* file = NULL;
+	size_t i;
+	int ret = 0;
+
+	sprintf(ring->filename, "%s.tmp", ring->index_filename);
+
+	file = fopen(ring->filename, "w");
+	if (!file) {
+		ring->sink.error_str = "Can not open index file";
+		goto fail_fopen;
+	}
+
+	fprintf(file, "# slot sequence first_ts last_ts packets size\n");
+	for (i = 0; i < ring->segment_count; ++i) {
+		const struct ov_sink_segment* segment = &ring->segments[i];
+
+		/* Unused slot, even an empty segment has the file header */
+		if (segment->size == 0)
+			continue;
+
+		fprintf(file, "%u %u %llu %llu %llu %llu\n",
+			(unsigned int)i,
+			segment->sequence,
+			(unsigned long long)segment->first_ts,
+			(unsigned long long)segment->last_ts,
+			(unsigned long long)segment->packets,
+			(unsigned long long)segment->size);
+	}
+
+	if (ferror(file)) {
+		ring->sink.error_str = "Can not write index file";
+		goto fail_write;
+	}
+
+	ret = fclose(file);
+	file = NULL;
+	if (ret != 0) {
+		ring->sink.error_str = "Can not write index file";
+		goto fail_write;
+	}
+
+#ifdef WIN32
+	/* rename() does not replace existing files here */
+	remove(ring->index_filename);
+#endif
+	if (rename(ring->filename, ring->index_filename) != 0) {
+		ring->sink.error_str = "Can not rename index file";
+		goto fail_write;
+	}
+
+	return 0;
+
+fail_write:
+	if (file)
+		fclose(file);
+fail_fopen:
+
+	return -1;
+}
+
+static int sink_ring_open_segment(struct sink_ring* ring, size_t slot) {
+	struct ov_sink_segment* segment = &ring->segments[slot];
+	uint8_t* buf = NULL;
+	size_t size = 0;
+
+	sink_ring_filename(ring, slot);
+
+	if (sink_file_open(&ring->file, ring->filename, ring->segment_size) < 0) {
+		ring->sink.error_str = ring->file.error_str;
+		return -1;
+	}
+
+	buf = sink_file_reserve(&ring->file, PCAP_MAX_FILE_HEADER_SIZE);
+	if (!buf) {
+		ring->sink.error_str = ring->file.error_str;
+		return -1;
+	}
+
+	size = pcap_file_header(buf, ring->format, ring->linktype);
+	sink_file_commit(&ring->file, size);
+
+	memset(segment, 0, sizeof(struct ov_sink_segment));
+	segment->sequence = ring->sequence++;
+	segment->size = ring->file.size;
+	ring->current = slot;
+
+	return 0;
+}
+
+static int sink_ring_close_segment(struct sink_ring* ring) {
+	if (sink_file_close(&ring->file) < 0) {
+		ring->sink.error_str = ring->file.error_str;
+		return -1;
+	}
+
+	return sink_ring_write_index(ring);
+}
+
+static int sink_ring_rotate(struct sink_ring* ring) {
+	if (sink_ring_close_segment(ring) < 0)
+		return -1;
+
+	return sink_ring_open_segment(ring, (ring->current + 1) % ring->segment_count);
+}
+
+static int sink_ring_open(struct ov_sink* sink, enum ov_sink_format format, uint32_t linktype) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+
+	ring->format = format;
+	ring->linktype = linktype;
+	ring->sequence = 0;
+	memset(ring->segments, 0, sizeof(struct ov_sink_segment) * ring->segment_count);
+
+	if (sink_ring_open_segment(ring, 0) < 0) {
+		sink_file_close(&ring->file);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sink_ring_write(struct ov_sink* sink, struct ov_packet* packet) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+	struct ov_sink_segment* segment = &ring->segments[ring->current];
+	const size_t record_size = pcap_record_size(ring->format, packet);
+	uint8_t* buf = NULL;
+	size_t size = 0;
+
+	if (segment->packets > 0) {
+		const int size_exceeded = ring->segment_size && ring->file.size + record_size > ring->segment_size;
+		const int time_exceeded = ring->segment_ns && packet->timestamp - segment->first_ts >= ring->segment_ns;
+
+		if (size_exceeded || time_exceeded) {
+			if (sink_ring_rotate(ring) < 0)
+				return -1;
+
+			segment = &ring->segments[ring->current];
+		}
+	}
+
+	buf = sink_file_reserve(&ring->file, record_size);
+	if (!buf) {
+		sink->error_str = ring->file.error_str;
+		return -1;
+	}
+
+	size = pcap_record(buf, ring->format, packet);
+	sink_file_commit(&ring->file, size);
+
+	if (segment->packets == 0)
+		segment->first_ts = packet->timestamp;
+	segment->last_ts = packet->timestamp;
+	segment->packets++;
+	segment->size = ring->file.size;
+
+	return 0;
+}
+
+static int sink_ring_flush(struct ov_sink* sink) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+
+	if (sink_file_flush(&ring->file) < 0) {
+		sink->error_str = ring->file.error_str;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sink_ring_close(struct ov_sink* sink) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+	int ret = 0;
+
+	ret = sink_ring_close_segment(ring);
+
+	if (sink_file_wait(&ring->file) < 0 && ret == 0) {
+		sink->error_str = ring->file.error_str;
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int sink_ring_set_async(struct ov_sink* sink, size_t buf_count, unsigned int flags) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+
+	if (sink_file_set_async(&ring->file, buf_count, flags) < 0) {
+		sink->error_str = ring->file.error_str;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void sink_ring_destroy(struct ov_sink* sink) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+
+	sink_file_destroy(&ring->file);
+	free(ring->segments);
+	free(ring->index_filename);
+	free(ring->filename);
+	free(ring->prefix);
+	free(ring);
+}
+
+static const struct sink_ops sink_ring_ops = {
+	.open = &sink_ring_open,
+	.write = &sink_ring_write,
+	.flush = &sink_ring_flush,
+	.close = &sink_ring_close,
+	.destroy = &sink_ring_destroy,
+	.set_async = &sink_ring_set_async,
+};
+
+OPENVIZSLA_EXPORT
+struct ov_sink* ov_sink_new_ring(const char* prefix, size_t segment_count, uint64_t segment_size, unsigned int segment_seconds) {
+	struct sink_ring* ring = NULL;
+	size_t prefix_len = 0;
+	size_t buf_size = SINK_RING_BUFFER_SIZE;
+	int ret = 0;
+
+	if (!prefix || segment_count == 0 || (segment_size == 0 && segment_seconds == 0))
+		goto fail_args;
+
+	ring = malloc(sizeof(struct sink_ring));
+	if (!ring) {
+		goto fail_malloc;
+	}
+
+	memset(ring, 0, sizeof(struct sink_ring));
+	sink_init(&ring->sink, &sink_ring_ops);
+
+	prefix_len = strlen(prefix);
+	ring->prefix = malloc(prefix_len + 1);
+	if (!ring->prefix) {
+		goto fail_malloc_prefix;
+	}
+	memcpy(ring->prefix, prefix, prefix_len + 1);
+
+	ring->filename = malloc(prefix_len + SINK_RING_SUFFIX_SIZE);
+	if (!ring->filename) {
+		goto fail_malloc_filename;
+	}
+
+	ring->index_filename = malloc(prefix_len + SINK_RING_SUFFIX_SIZE);
+	if (!ring->index_filename) {
+		goto fail_malloc_index_filename;
+	}
+	sprintf(ring->index_filename, "%s.idx", prefix);
+
+	ring->segments = calloc(segment_count, sizeof(struct ov_sink_segment));
+	if (!ring->segments) {
+		goto fail_malloc_segments;
+	}
+
+	ring->segment_count = segment_count;
+	ring->segment_size = segment_size;
+	ring->segment_ns = (uint64_t)segment_seconds * 1000000000;
+
+	/* There is no point to buffer more than a segment */
+	if (segment_size && segment_size < buf_size)
+		buf_size = segment_size;
+	if (buf_size < PCAP_MAX_FILE_HEADER_SIZE + PCAP_MAX_RECORD_SIZE)
+		buf_size = PCAP_MAX_FILE_HEADER_SIZE + PCAP_MAX_RECORD_SIZE;
+
+	ret = sink_file_init(&ring->file, buf_size);
+	if (ret < 0) {
+		goto fail_sink_file_init;
+	}
+
+	return &ring->sink;
+
+fail_sink_file_init:
+	free(ring->segments);
+fail_malloc_segments:
+	free(ring->index_filename);
+fail_malloc_index_filename:
+	free(ring->filename);
+fail_malloc_filename:
+	free(ring->prefix);
+fail_malloc_prefix:
+	free(ring);
+fail_malloc:
+fail_args:
+
+	return NULL;
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_ring_get_segment(struct ov_sink* sink, size_t index, struct ov_sink_segment* segment) {
+	struct sink_ring* ring = (struct sink_ring*)sink;
+
+	if (sink->ops != &sink_ring_ops) {
+		sink->error_str = "Sink is not a ring";
+		return -1;
+	}
+
+	if (index >= ring->segment_count || ring->segments[index].size == 0) {
+		sink->error_str = "Segment is not present";
+		return -1;
+	}
+
+	*segment = ring->segments[index];
+
+	return 0;
+}
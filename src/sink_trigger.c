@@ -0,0 +1,410 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <sink.h>
+#include <usb.h>
+
+#include <openvizsla_export.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TRIGGER_RECORD_ALIGN 4
+
+struct trigger {
+	struct ov_trigger match;
+	/* Owned copies of pattern and mask */
+	uint8_t* data;
+};
+
+/* Packets are kept back to back, a record never wraps. When the tail does
+ * not fit at the end of the buffer, the data ends at wrap_end and
+ * continues from the start. */
+struct trigger_ring {
+	uint8_t* buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t wrap_end;
+	size_t count;
+	int wrapped;
+};
+
+struct sink_trigger {
+	struct ov_sink sink;
+	struct ov_sink* target;
+
+	struct trigger* triggers;
+	size_t trigger_count;
+
+	struct trigger_ring ring;
+	size_t post_size;
+	size_t post_remaining;
+	int triggered;
+};
+
+static size_t trigger_record_size(const struct ov_packet* packet) {
+	const size_t size = sizeof(struct ov_packet) + ov_packet_captured_size((struct ov_packet*)packet);
+
+	return (size + TRIGGER_RECORD_ALIGN - 1) & ~(size_t)(TRIGGER_RECORD_ALIGN - 1);
+}
+
+static void trigger_ring_reset(struct trigger_ring* ring) {
+	ring->head = 0;
+	ring->tail = 0;
+	ring->wrap_end = 0;
+	ring->count = 0;
+	ring->wrapped = 0;
+}
+
+static void trigger_ring_pop(struct trigger_ring* ring) {
+	ring->head += trigger_record_size((struct ov_packet*)(ring->buf + ring->head));
+	ring->count--;
+
+	if (ring->count == 0) {
+		trigger_ring_reset(ring);
+	} else if (ring->wrapped && ring->head == ring->wrap_end) {
+		ring->head = 0;
+		ring->wrapped = 0;
+	}
+}
+
+static void trigger_ring_push(struct trigger_ring* ring, const struct ov_packet* packet) {
+	const size_t size = trigger_record_size(packet);
+
+	/* Drop the oldest packets until there is room */
+	for (;;) {
+		if (ring->count == 0) {
+			trigger_ring_reset(ring);
+			break;
+		}
+
+		if (!ring->wrapped) {
+			if (ring->size - ring->tail >= size)
+				break;
+
+			ring->wrap_end = ring->tail;
+			ring->tail = 0;
+			ring->wrapped = 1;
+		} else {
+			if (ring->head - ring->tail >= size)
+				break;
+
+			trigger_ring_pop(ring);
+		}
+	}
+
+	memcpy(ring->buf + ring->tail, packet, sizeof(struct ov_packet) + ov_packet_captured_size((struct ov_packet*)packet));
+	ring->tail += size;
+	ring->count++;
+}
+
+static int trigger_match(const struct trigger* trigger, const struct ov_packet* packet) {
+	const struct ov_trigger* match = &trigger->match;
+	const size_t captured = ov_packet_captured_size((struct ov_packet*)packet);
+	size_t offset, last, i;
+
+	switch (match->type) {
+	case OV_TRIGGER_PID: {
+		return (captured > 0 && packet->data[0] == match->pid);
+	} break;
+	case OV_TRIGGER_ENDPOINT: {
+		if (captured < USB_TOKEN_SIZE || !usb_pid_has_endpoint(packet->data[0]))
+			return 0;
+
+		return (usb_token_address(packet->data) == match->address &&
+			(match->endpoint == OV_TRIGGER_ANY_ENDPOINT || usb_token_endpoint(packet->data) == match->endpoint));
+	} break;
+	case OV_TRIGGER_PATTERN: {
+		if (captured < match->pattern_size)
+			return 0;
+
+		if (match->offset == OV_TRIGGER_ANY_OFFSET) {
+			offset = 0;
+			last = captured - match->pattern_size;
+		} else {
+			offset = match->offset;
+			last = offset;
+			if (offset > captured - match->pattern_size)
+				return 0;
+		}
+
+		for (; offset <= last; ++offset) {
+			for (i = 0; i < match->pattern_size; ++i) {
+				if ((packet->data[offset + i] & match->mask[i]) != match->pattern[i])
+					break;
+			}
+
+			if (i == match->pattern_size)
+				return 1;
+		}
+
+		return 0;
+	} break;
+	case OV_TRIGGER_ERROR: {
+		return (packet->flags & OV_FLAGS_HF0_ERR) != 0;
+	} break;
+	}
+
+	return 0;
+}
+
+static int sink_trigger_forward(struct sink_trigger* st, struct ov_packet* packet) {
+	if (ov_sink_write(st->target, packet) < 0) {
+		st->sink.error_str = ov_sink_get_error_string(st->target);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write out the pre-trigger window and start the post-trigger one */
+static int sink_trigger_start(struct sink_trigger* st) {
+	struct trigger_ring* ring = &st->ring;
+
+	while (ring->count > 0) {
+		if (sink_trigger_forward(st, (struct ov_packet*)(ring->buf + ring->head)) < 0) {
+			trigger_ring_reset(ring);
+			return -1;
+		}
+
+		trigger_ring_pop(ring);
+	}
+
+	st->triggered = (st->post_size > 0);
+	st->post_remaining = st->post_size;
+
+	return 0;
+}
+
+static int sink_trigger_open(struct ov_sink* sink, enum ov_sink_format format, uint32_t linktype) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+
+	trigger_ring_reset(&st->ring);
+	st->triggered = 0;
+
+	if (ov_sink_open(st->target, format, linktype) < 0) {
+		sink->error_str = ov_sink_get_error_string(st->target);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sink_trigger_write(struct ov_sink* sink, struct ov_packet* packet) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+	const size_t size = trigger_record_size(packet);
+	size_t i;
+
+	for (i = 0; i < st->trigger_count; ++i) {
+		if (trigger_match(&st->triggers[i], packet))
+			break;
+	}
+
+	if (i < st->trigger_count) {
+		/* Triggering again within the post-trigger window restarts it */
+		if (sink_trigger_start(st) < 0)
+			return -1;
+
+		return sink_trigger_forward(st, packet);
+	}
+
+	if (!st->triggered) {
+		if (st->ring.size > 0)
+			trigger_ring_push(&st->ring, packet);
+
+		return 0;
+	}
+
+	if (sink_trigger_forward(st, packet) < 0)
+		return -1;
+
+	if (st->post_remaining > size) {
+		st->post_remaining -= size;
+	} else {
+		st->triggered = 0;
+		st->post_remaining = 0;
+	}
+
+	return 0;
+}
+
+static int sink_trigger_flush(struct ov_sink* sink) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+
+	if (ov_sink_flush(st->target) < 0) {
+		sink->error_str = ov_sink_get_error_string(st->target);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sink_trigger_close(struct ov_sink* sink) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+
+	/* Packets not followed by a trigger are dropped */
+	trigger_ring_reset(&st->ring);
+	st->triggered = 0;
+
+	if (ov_sink_close(st->target) < 0) {
+		sink->error_str = ov_sink_get_error_string(st->target);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void sink_trigger_destroy(struct ov_sink* sink) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+	size_t i;
+
+	for (i = 0; i < st->trigger_count; ++i)
+		free(st->triggers[i].data);
+
+	free(st->triggers);
+	free(st->ring.buf);
+	free(st);
+}
+
+static int sink_trigger_set_async(struct ov_sink* sink, size_t buf_count, unsigned int flags) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+
+	if (ov_sink_set_async(st->target, buf_count, flags) < 0) {
+		sink->error_str = ov_sink_get_error_string(st->target);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct sink_ops sink_trigger_ops = {
+	.open = &sink_trigger_open,
+	.write = &sink_trigger_write,
+	.flush = &sink_trigger_flush,
+	.close = &sink_trigger_close,
+	.destroy = &sink_trigger_destroy,
+	.set_async = &sink_trigger_set_async,
+};
+
+OPENVIZSLA_EXPORT
+struct ov_sink* ov_sink_new_trigger(struct ov_sink* target, size_t pre_size, size_t post_size) {
+	struct sink_trigger* st = NULL;
+
+	if (!target)
+		goto fail_args;
+
+	/* The ring must hold at least a single packet of any size */
+	if (pre_size > 0 && pre_size < sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE + TRIGGER_RECORD_ALIGN)
+		pre_size = sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE + TRIGGER_RECORD_ALIGN;
+
+	st = malloc(sizeof(struct sink_trigger));
+	if (!st) {
+		goto fail_malloc;
+	}
+
+	memset(st, 0, sizeof(struct sink_trigger));
+	sink_init(&st->sink, &sink_trigger_ops);
+
+	if (pre_size > 0) {
+		st->ring.buf = malloc(pre_size);
+		if (!st->ring.buf) {
+			goto fail_malloc_ring;
+		}
+
+		st->ring.size = pre_size;
+	}
+
+	st->target = target;
+	st->post_size = post_size;
+
+	return &st->sink;
+
+fail_malloc_ring:
+	free(st);
+fail_malloc:
+fail_args:
+
+	return NULL;
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_trigger_add(struct ov_sink* sink, const struct ov_trigger* trigger) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+	struct trigger* triggers = NULL;
+	struct trigger* t = NULL;
+	size_t i;
+
+	if (sink->ops != &sink_trigger_ops) {
+		sink->error_str = "Sink is not a trigger";
+		return -1;
+	}
+
+	switch (trigger->type) {
+	case OV_TRIGGER_PID:
+	case OV_TRIGGER_ENDPOINT:
+	case OV_TRIGGER_ERROR:
+		break;
+	case OV_TRIGGER_PATTERN: {
+		if (!trigger->pattern || trigger->pattern_size == 0 || trigger->pattern_size > OV_MAX_PACKET_SIZE ||
+			trigger->offset < OV_TRIGGER_ANY_OFFSET || trigger->offset >= OV_MAX_PACKET_SIZE) {
+			sink->error_str = "Invalid trigger pattern";
+			return -1;
+		}
+	} break;
+	default: {
+		sink->error_str = "Invalid trigger type";
+		return -1;
+	} break;
+	}
+
+	triggers = realloc(st->triggers, sizeof(struct trigger) * (st->trigger_count + 1));
+	if (!triggers) {
+		sink->error_str = "Can not allocate trigger";
+		return -1;
+	}
+	st->triggers = triggers;
+
+	t = &st->triggers[st->trigger_count];
+	t->match = *trigger;
+	t->data = NULL;
+
+	if (trigger->type == OV_TRIGGER_PATTERN) {
+		t->data = malloc(2 * trigger->pattern_size);
+		if (!t->data) {
+			sink->error_str = "Can not allocate trigger";
+			return -1;
+		}
+
+		/* Pattern is stored pre-masked */
+		for (i = 0; i < trigger->pattern_size; ++i) {
+			const uint8_t mask = (trigger->mask ? trigger->mask[i] : 0xff);
+
+			t->data[i] = trigger->pattern[i] & mask;
+			t->data[trigger->pattern_size + i] = mask;
+		}
+
+		t->match.pattern = t->data;
+		t->match.mask = t->data + trigger->pattern_size;
+	}
+
+	st->trigger_count++;
+
+	return 0;
+}
+
+OPENVIZSLA_EXPORT
+int ov_sink_trigger_fire(struct ov_sink* sink) {
+	struct sink_trigger* st = (struct sink_trigger*)sink;
+
+	if (sink->ops != &sink_trigger_ops) {
+		sink->error_str = "Sink is not a trigger";
+		return -1;
+	}
+
+	if (!sink->is_open) {
+		sink->error_str = "Sink is not open";
+		return -1;
+	}
+
+	return sink_trigger_start(st);
+}
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <timestamp.h>
+
+#include <string.h>
+#ifdef WIN32
+#include <Windows.h>
+#endif
+#include <time.h>
+
+#define NSEC_PER_SEC UINT64_C(1000000000)
+
+/* Drift is re-estimated once per interval using the sample with the
+ * lowest transfer latency observed during the interval. */
+#define TIMESTAMP_SAMPLE_INTERVAL_NS (1 * NSEC_PER_SEC)
+/* The rate estimate is applied only when the baseline is long enough
+ * for the transfer latency jitter to be negligible. */
+#define TIMESTAMP_MIN_BASELINE_NS (5 * NSEC_PER_SEC)
+/* Estimates outside of crystal tolerance are considered bogus */
+#define TIMESTAMP_MAX_PPM 500
+/* Accumulated error is slewed out by at most this rate adjustment */
+#define TIMESTAMP_MAX_SLEW_PPM 200
+
+void timestamp_init(struct timestamp* ts, enum ov_timestamp_mode mode, uint64_t monotonic_ns, int64_t clock_offset) {
+	memset(ts, 0, sizeof(struct timestamp));
+
+	ts->mode = mode;
+	ts->nominal_mult = ((NSEC_PER_SEC << TIMESTAMP_SHIFT) + OV_TIMESTAMP_FREQ_HZ / 2) / OV_TIMESTAMP_FREQ_HZ;
+	ts->mult = ts->nominal_mult;
+	ts->anchor_ticks = 0;
+	ts->anchor_ns = monotonic_ns;
+	ts->origin_ns = monotonic_ns;
+	ts->clock_offset = clock_offset;
+	ts->interval_start_ns = monotonic_ns;
+}
+
+void timestamp_start(struct timestamp* ts, enum ov_timestamp_mode mode) {
+	const uint64_t monotonic_ns = timestamp_monotonic_ns();
+	int64_t clock_offset = 0;
+
+	if (mode == OV_TIMESTAMP_REALTIME)
+		clock_offset = (int64_t)(timestamp_realtime_ns() - monotonic_ns);
+
+	timestamp_init(ts, mode, monotonic_ns, clock_offset);
+}
+
+static void timestamp_advance(struct timestamp* ts, uint64_t delta) {
+	const uint64_t frac_mask = (UINT64_C(1) << TIMESTAMP_SHIFT) - 1;
+	const uint64_t product = delta * ts->mult + ts->anchor_frac;
+
+	ts->anchor_ns += product >> TIMESTAMP_SHIFT;
+	ts->anchor_frac = product & frac_mask;
+	ts->anchor_ticks += delta;
+}
+
+void timestamp_rebase(struct timestamp* ts, uint64_t ticks) {
+	while (ticks - ts->anchor_ticks >= TIMESTAMP_MAX_DELTA) {
+		timestamp_advance(ts, TIMESTAMP_MAX_DELTA);
+	}
+
+	timestamp_advance(ts, ticks - ts->anchor_ticks);
+}
+
+/* Ticks count from zero again, the timeline continues at the given old
+ * tick count. Tick based state is moved to the new zero. */
+void timestamp_restart(struct timestamp* ts, uint64_t ticks) {
+	timestamp_rebase(ts, ticks);
+
+	ts->anchor_ticks = 0;
+	ts->last_ticks -= ticks;
+	ts->sampled_ticks -= ticks;
+	ts->base_ticks -= ticks;
+	ts->best_ticks -= ticks;
+	/* Steering converges to the line through the restart */
+	ts->origin_ns = ts->anchor_ns;
+}
+
+static void timestamp_steer(struct timestamp* ts, double ratio) {
+	const double scale = (double)(UINT64_C(1) << TIMESTAMP_SHIFT);
+	const double horizon = (double)TIMESTAMP_SAMPLE_INTERVAL_NS / ratio;
+	double target, slope;
+
+	/* Keep the timeline continuous at the latest converted packet */
+	timestamp_rebase(ts, ts->last_ticks);
+
+	/* Converge to the line through the capture start having the estimated
+	 * rate within the next interval, limiting the rate adjustment so that
+	 * timestamps stay monotonic. */
+	target = (double)ts->origin_ns + ratio * (double)(ts->anchor_ticks + horizon);
+	slope = (target - (double)ts->anchor_ns - (double)ts->anchor_frac / scale) / horizon;
+
+	if (slope < ratio * (1.0 - TIMESTAMP_MAX_SLEW_PPM * 1e-6))
+		slope = ratio * (1.0 - TIMESTAMP_MAX_SLEW_PPM * 1e-6);
+	if (slope > ratio * (1.0 + TIMESTAMP_MAX_SLEW_PPM * 1e-6))
+		slope = ratio * (1.0 + TIMESTAMP_MAX_SLEW_PPM * 1e-6);
+
+	ts->mult = (uint64_t)(slope * scale + 0.5);
+}
+
+void timestamp_sample(struct timestamp* ts, uint64_t ticks, uint64_t monotonic_ns) {
+	int64_t offset;
+
+	/* No packets since the previous sample, the pair carries no information */
+	if (ticks == ts->sampled_ticks)
+		return;
+	ts->sampled_ticks = ticks;
+
+	if (ticks - ts->anchor_ticks >= TIMESTAMP_MAX_DELTA)
+		timestamp_rebase(ts, ticks);
+
+	/* Transfers complete some time after the last packet was captured,
+	 * the lowest offset corresponds to the lowest latency */
+	offset = (int64_t)(monotonic_ns - ts->anchor_ns - (((ticks - ts->anchor_ticks) * ts->mult + ts->anchor_frac) >> TIMESTAMP_SHIFT));
+	if (!ts->have_best || offset < ts->best_offset) {
+		ts->best_ticks = ticks;
+		ts->best_host_ns = monotonic_ns;
+		ts->best_offset = offset;
+		ts->have_best = 1;
+	}
+
+	if (monotonic_ns - ts->interval_start_ns < TIMESTAMP_SAMPLE_INTERVAL_NS)
+		return;
+
+	if (!ts->have_base) {
+		ts->base_ticks = ts->best_ticks;
+		ts->base_host_ns = ts->best_host_ns;
+		ts->have_base = 1;
+	} else if (ts->best_host_ns - ts->base_host_ns >= TIMESTAMP_MIN_BASELINE_NS && ts->best_ticks != ts->base_ticks) {
+		const double nominal = (double)NSEC_PER_SEC / OV_TIMESTAMP_FREQ_HZ;
+		const double ratio = (double)(ts->best_host_ns - ts->base_host_ns) / (double)(ts->best_ticks - ts->base_ticks);
+
+		if (ratio > nominal * (1.0 - TIMESTAMP_MAX_PPM * 1e-6) && ratio < nominal * (1.0 + TIMESTAMP_MAX_PPM * 1e-6))
+			timestamp_steer(ts, ratio);
+	}
+
+	ts->interval_start_ns = monotonic_ns;
+	ts->have_best = 0;
+}
+
+void timestamp_sample_now(struct timestamp* ts) {
+	if (ts->last_ticks == ts->sampled_ticks)
+		return;
+
+	timestamp_sample(ts, ts->last_ticks, timestamp_monotonic_ns());
+}
+
+uint64_t timestamp_monotonic_ns(void) {
+#ifdef WIN32
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * NSEC_PER_SEC
+		+ (uint64_t)(count.QuadPart % freq.QuadPart) * NSEC_PER_SEC / freq.QuadPart;
+#else
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return (uint64_t)tp.tv_sec * NSEC_PER_SEC + tp.tv_nsec;
+#endif
+}
+
+uint64_t timestamp_raw_ns(void) {
+#ifdef CLOCK_MONOTONIC_RAW
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tp);
+
+	return (uint64_t)tp.tv_sec * NSEC_PER_SEC + tp.tv_nsec;
+#else
+	return timestamp_monotonic_ns();
+#endif
+}
+
+uint64_t timestamp_realtime_ns(void) {
+	struct timespec tp;
+
+#ifdef WIN32
+	timespec_get(&tp, TIME_UTC);
+#else
+	clock_gettime(CLOCK_REALTIME, &tp);
+#endif
+
+	return (uint64_t)tp.tv_sec * NSEC_PER_SEC + tp.tv_nsec;
+}
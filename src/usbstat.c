@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include <timestamp.h>
+#include <usbstat.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+void usbstat_init(struct usbstat* stat) {
+	memset(stat, 0, sizeof(struct usbstat));
+}
+
+void usbstat_begin(struct usbstat* stat, enum ov_call call) {
+	if (stat->depth++ > 0)
+		return;
+
+	stat->current = &stat->calls[call];
+	stat->start_ns = timestamp_monotonic_ns();
+}
+
+void usbstat_end(struct usbstat* stat) {
+	struct ov_call_stats* current = stat->current;
+	uint64_t ns;
+
+	if (--stat->depth > 0)
+		return;
+
+	ns = timestamp_monotonic_ns() - stat->start_ns;
+
+	current->calls++;
+	current->total_ns += ns;
+	if (ns > current->max_ns)
+		current->max_ns = ns;
+
+	stat->current = NULL;
+}
+
+void usbstat_add_write(struct usbstat* stat, int size, uint64_t ns) {
+	if (!stat || !stat->current)
+		return;
+
+	stat->current->writes++;
+	stat->current->bytes_written += size;
+	stat->current->usb_ns += ns;
+}
+
+void usbstat_add_read(struct usbstat* stat, int size, uint64_t ns) {
+	if (!stat || !stat->current)
+		return;
+
+	/* Empty reads are polls for a reply which is not there yet */
+	if (size == 0)
+		stat->current->empty_reads++;
+
+	stat->current->reads++;
+	stat->current->bytes_read += size;
+	stat->current->usb_ns += ns;
+}
+
+void usbstat_add_round_trip(struct usbstat* stat) {
+	if (stat && stat->current)
+		stat->current->round_trips++;
+}
+
+size_t usbstat_format(struct usbstat* stat, char* buf, size_t size) {
+	size_t length = 0;
+	int ret;
+
+	ret = snprintf(buf, size, "%-16s %8s %10s %10s %10s %10s %12s %12s %12s\n",
+		"call", "calls", "writes", "reads", "empty", "trips", "usb_us", "total_us", "max_us");
+	if (ret < 0)
+		return 0;
+	length += ret;
+
+	for (int i = 0; i < OV_CALL_COUNT; ++i) {
+		const struct ov_call_stats* s = &stat->calls[i];
+
+		ret = snprintf(length < size ? buf + length : NULL, length < size ? size - length : 0,
+			"%-16s %8" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+			usbstat_call_name(i), s->calls, s->writes, s->reads, s->empty_reads, s->round_trips,
+			s->usb_ns / 1000, s->total_ns / 1000, s->max_ns / 1000);
+		if (ret < 0)
+			return 0;
+		length += ret;
+	}
+
+	return length;
+}
+
+const char* usbstat_call_name(enum ov_call call) {
+	switch (call) {
+	case OV_CALL_OPEN:
+		return "open";
+	case OV_CALL_SET_USB_SPEED:
+		return "set_usb_speed";
+	case OV_CALL_CAPTURE_START:
+		return "capture_start";
+	case OV_CALL_CAPTURE_STOP:
+		return "capture_stop";
+	case OV_CALL_LOAD_FIRMWARE:
+		return "load_firmware";
+	default:
+		return "unknown";
+	}
+}
+
+int usbstat_write_data(struct usbstat* stat, struct ftdi_context* ftdi, const uint8_t* buf, int size) {
+	const uint64_t start_ns = timestamp_monotonic_ns();
+	int ret;
+
+	ret = ftdi_write_data(ftdi, (uint8_t*)buf, size);
+
+	if (ret >= 0)
+		usbstat_add_write(stat, ret, timestamp_monotonic_ns() - start_ns);
+
+	return ret;
+}
+
+int usbstat_read_data(struct usbstat* stat, struct ftdi_context* ftdi, uint8_t* buf, int size) {
+	const uint64_t start_ns = timestamp_monotonic_ns();
+	int ret;
+
+	ret = ftdi_read_data(ftdi, buf, size);
+
+	if (ret >= 0)
+		usbstat_add_read(stat, ret, timestamp_monotonic_ns() - start_ns);
+
+	return ret;
+}
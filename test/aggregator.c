@@ -0,0 +1,221 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aggregator.h>
+#include <decoder.h>
+#include <usb.h>
+
+union {
+	struct ov_packet packet;
+	uint8_t data[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
+} p;
+
+struct {
+	uint64_t timestamp;
+	uint8_t pid;
+	int is_summary;
+	struct ov_summary summary;
+} received[16];
+size_t received_count;
+
+struct ov_aggregator* agg;
+
+static void packet_callback(struct ov_packet* packet, void* data) {
+	const struct ov_summary* summary = ov_packet_summary(packet);
+
+	ck_assert_uint_lt(received_count, sizeof(received) / sizeof(received[0]));
+
+	received[received_count].timestamp = packet->timestamp;
+	received[received_count].pid = packet->data[0];
+	received[received_count].is_summary = (summary != NULL);
+	if (summary) {
+		ck_assert_uint_eq(packet->size, sizeof(struct ov_summary));
+		memcpy(&received[received_count].summary, summary, sizeof(*summary));
+	}
+
+	received_count++;
+}
+
+static void send(const uint8_t* data, size_t size) {
+	p.packet.magic = 0xa0;
+	p.packet.flags = 0;
+	p.packet.size = size;
+	p.packet.timestamp++;
+	memcpy(p.packet.data, data, size);
+
+	ov_aggregator_packet(&p.packet, agg);
+}
+
+static void send_pid(uint8_t pid) {
+	send(&pid, 1);
+}
+
+static void send_token(uint8_t pid, uint8_t address, uint8_t endpoint) {
+	const uint8_t token[] = {pid, address | ((endpoint & 1) << 7), endpoint >> 1};
+
+	send(token, sizeof(token));
+}
+
+static void send_sof(uint16_t frame) {
+	const uint8_t sof[] = {USB_PID_TOKEN_SOF, frame & 0xff, (frame >> 8) & 0x07};
+
+	send(sof, sizeof(sof));
+}
+
+static void setup(void) {
+	agg = ov_aggregator_new(OV_AGGREGATE_SOF | OV_AGGREGATE_NAK, &packet_callback, NULL);
+	ck_assert_ptr_ne(agg, NULL);
+
+	p.packet.timestamp = 0;
+	received_count = 0;
+}
+
+static void teardown(void) {
+	ov_aggregator_free(agg);
+}
+
+START_TEST (test_aggregator_sof) {
+	uint16_t frame;
+
+	for (frame = 0x7fe; frame < 0x803; ++frame)
+		send_sof(frame & 0x7ff);
+	ck_assert_uint_eq(received_count, 0);
+
+	/* A packet not aggregated ends the run */
+	send_pid(USB_PID_HANDSHAKE_ACK);
+	ck_assert_uint_eq(received_count, 2);
+
+	ck_assert_uint_eq(received[0].pid, USB_PID_SPECIAL_RESERVED);
+	ck_assert_uint_eq(received[0].timestamp, 1);
+	ck_assert_uint_eq(received[0].summary.type, OV_SUMMARY_SOF);
+	ck_assert_uint_eq(received[0].summary.count, 5);
+	ck_assert_uint_eq(received[0].summary.first_frame, 0x7fe);
+	ck_assert_uint_eq(received[0].summary.last_frame, 0x002);
+	ck_assert_uint_eq(received[0].summary.last_timestamp, 5);
+
+	ck_assert_uint_eq(received[1].pid, USB_PID_HANDSHAKE_ACK);
+	ck_assert_uint_eq(received[1].timestamp, 6);
+}
+END_TEST
+
+START_TEST (test_aggregator_nak) {
+	size_t i;
+
+	/* Two endpoints are polled between SOFs */
+	for (i = 0; i < 3; ++i) {
+		send_sof(i);
+		send_token(USB_PID_TOKEN_IN, 5, 1);
+		send_pid(USB_PID_HANDSHAKE_NAK);
+		send_token(USB_PID_SPECIAL_PING, 5, 2);
+		send_pid(USB_PID_HANDSHAKE_NAK);
+	}
+	ck_assert_uint_eq(received_count, 0);
+
+	/* IN which is answered by data is passed on */
+	send_token(USB_PID_TOKEN_IN, 5, 1);
+	send_pid(USB_PID_DATA_DATA0);
+	ck_assert_uint_eq(received_count, 5);
+
+	ck_assert_uint_eq(received[0].summary.type, OV_SUMMARY_SOF);
+	ck_assert_uint_eq(received[0].summary.count, 3);
+
+	ck_assert_uint_eq(received[1].summary.type, OV_SUMMARY_IN_NAK);
+	ck_assert_uint_eq(received[1].summary.address, 5);
+	ck_assert_uint_eq(received[1].summary.endpoint, 1);
+	ck_assert_uint_eq(received[1].summary.count, 3);
+	ck_assert_uint_eq(received[1].timestamp, 2);
+	ck_assert_uint_eq(received[1].summary.last_timestamp, 13);
+
+	ck_assert_uint_eq(received[2].summary.type, OV_SUMMARY_PING_NAK);
+	ck_assert_uint_eq(received[2].summary.endpoint, 2);
+	ck_assert_uint_eq(received[2].summary.count, 3);
+
+	ck_assert_uint_eq(received[3].pid, USB_PID_TOKEN_IN);
+	ck_assert_uint_eq(received[3].timestamp, 16);
+	ck_assert_uint_eq(received[4].pid, USB_PID_DATA_DATA0);
+}
+END_TEST
+
+START_TEST (test_aggregator_flush) {
+	/* Damaged packets are not aggregated */
+	send_sof(1);
+	p.packet.flags = OV_FLAGS_HF0_ERR;
+	p.packet.timestamp++;
+	ov_aggregator_packet(&p.packet, agg);
+	ck_assert_uint_eq(received_count, 2);
+	ck_assert_uint_eq(received[0].summary.count, 1);
+	ck_assert_uint_eq(received[1].pid, USB_PID_TOKEN_SOF);
+
+	/* Token waiting for the handshake is passed on by flush */
+	send_token(USB_PID_TOKEN_IN, 1, 0);
+	ck_assert_uint_eq(received_count, 2);
+	ov_aggregator_flush(agg);
+	ck_assert_uint_eq(received_count, 3);
+	ck_assert_uint_eq(received[2].pid, USB_PID_TOKEN_IN);
+
+	ov_aggregator_flush(agg);
+	ck_assert_uint_eq(received_count, 3);
+}
+END_TEST
+
+static void decoded_packet(void* data, struct ov_packet* packet) {
+	ov_aggregator_packet(packet, data);
+}
+
+START_TEST (test_aggregator_snaplen) {
+	/* DATA0 of 200 bytes snapped at 0xa8, the value of the summary magic */
+	uint8_t inp[5 + 200] = {0xa0, 0x00, 200, 0x00, 0x10, USB_PID_DATA_DATA0};
+	struct decoder_ops ops = {
+		.packet = &decoded_packet,
+	};
+	struct packet_decoder pd;
+
+	ck_assert_int_eq(packet_decoder_init(&pd, &p.packet, sizeof(p), &ops, agg), 0);
+	packet_decoder_set_snaplen(&pd, OV_PACKET_MAGIC_SUMMARY);
+	packet_decoder_proc(&pd, inp, sizeof(inp));
+
+	ck_assert_uint_eq(received_count, 1);
+	ck_assert_int_eq(received[0].is_summary, 0);
+	ck_assert_uint_eq(received[0].pid, USB_PID_DATA_DATA0);
+	ck_assert_uint_eq(ov_packet_captured_size(&p.packet), OV_PACKET_MAGIC_SUMMARY);
+
+	/* Summaries stay recognizable */
+	send_sof(1);
+	ov_aggregator_flush(agg);
+	ck_assert_uint_eq(received_count, 2);
+	ck_assert_int_eq(received[1].is_summary, 1);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("aggregator");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_checked_fixture(tc_core, setup, teardown);
+	tcase_add_test(tc_core, test_aggregator_sof);
+	tcase_add_test(tc_core, test_aggregator_nak);
+	tcase_add_test(tc_core, test_aggregator_flush);
+	tcase_add_test(tc_core, test_aggregator_snaplen);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <crc.h>
+#include <usb.h>
+
+union {
+	struct ov_packet packet;
+	uint8_t data[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
+} p;
+
+static void set_packet(const uint8_t* data, size_t size) {
+	p.packet.magic = 0xa0;
+	p.packet.flags = 0;
+	p.packet.size = size;
+	p.packet.timestamp = 0;
+	memcpy(p.packet.data, data, size);
+}
+
+/* Bit by bit reference */
+static uint16_t crc16_reference(const uint8_t* data, size_t size) {
+	uint16_t crc = 0xffff;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (j = 0; j < 8; ++j)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xa001 : 0);
+	}
+
+	return crc ^ 0xffff;
+}
+
+START_TEST (test_crc5) {
+	/* Examples from USB 2.0 CRC whitepaper */
+	const uint8_t zero[] = {0x00, 0x00};
+	const uint8_t token[] = {0x15, 0x07};
+
+	ck_assert_uint_eq(crc5_usb(zero, 11), 0x02);
+	ck_assert_uint_eq(crc5_usb(token, 11), 0x1d);
+}
+END_TEST
+
+START_TEST (test_crc16) {
+	const uint8_t setup[] = {0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x40, 0x00};
+	uint8_t data[OV_MAX_PACKET_SIZE];
+	size_t i;
+
+	ck_assert_uint_eq(crc16_usb(setup, sizeof(setup)), 0x94dd);
+	ck_assert_uint_eq(crc16_usb(setup, 0), 0x0000);
+
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = (i * 7919) >> 3;
+
+	/* Every tail length of the slice-by-8 loop */
+	for (i = 0; i < 64; ++i)
+		ck_assert_uint_eq(crc16_usb(data + i, sizeof(data) - 2 * i), crc16_reference(data + i, sizeof(data) - 2 * i));
+}
+END_TEST
+
+START_TEST (test_crc_packet) {
+	const uint8_t setup[] = {USB_PID_TOKEN_SETUP, 0x00, 0x10};
+	const uint8_t sof[] = {USB_PID_TOKEN_SOF, 0x15, 0x07 | (0x1d << 3)};
+	const uint8_t data0[] = {USB_PID_DATA_DATA0, 0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x40, 0x00, 0xdd, 0x94};
+	const uint8_t zlp[] = {USB_PID_DATA_DATA1, 0x00, 0x00};
+	const uint8_t ack[] = {USB_PID_HANDSHAKE_ACK};
+	const uint8_t bad_pid[] = {0xd3};
+	uint8_t bad[sizeof(data0)];
+
+	set_packet(setup, sizeof(setup));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), 0);
+	set_packet(sof, sizeof(sof));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), 0);
+	set_packet(data0, sizeof(data0));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), 0);
+	set_packet(zlp, sizeof(zlp));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), 0);
+	set_packet(ack, sizeof(ack));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), 0);
+	ck_assert_uint_eq(p.packet.flags, 0);
+
+	set_packet(bad_pid, sizeof(bad_pid));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), -1);
+	ck_assert_uint_eq(p.packet.flags, OV_FLAGS_BAD_CRC);
+
+	memcpy(bad, data0, sizeof(bad));
+	bad[3] ^= 0x10;
+	set_packet(bad, sizeof(bad));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), -1);
+
+	memcpy(bad, setup, sizeof(setup));
+	bad[1] = 0x01;
+	set_packet(bad, sizeof(setup));
+	ck_assert_int_eq(ov_packet_validate(&p.packet), -1);
+
+	/* Truncated packets are only checked for PID */
+	set_packet(bad, sizeof(bad));
+	p.packet.flags = OV_FLAGS_HF0_TRUNC;
+	p.packet.size = OV_MAX_PACKET_SIZE + 1;
+	ck_assert_int_eq(ov_packet_validate(&p.packet), 0);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("crc");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_crc5);
+	tcase_add_test(tc_core, test_crc16);
+	tcase_add_test(tc_core, test_crc_packet);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
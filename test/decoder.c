@@ -80,6 +80,27 @@ START_TEST (test_packet_decoder5) {
 }
 END_TEST
 
+START_TEST (test_packet_decoder_library_flags) {
+	char inp[] = {0xa0,OV_FLAGS_BAD_CRC | OV_FLAGS_SNAPPED | OV_FLAGS_HF0_FIRST,0x01,0,0xc4,0x5a};
+	ck_assert_int_eq(packet_decoder_proc(&pd, inp, sizeof(inp)), sizeof(inp));
+	ck_assert_int_eq(pd.state, NEED_PACKET_MAGIC);
+	ck_assert_int_eq(p.packet.flags, OV_FLAGS_HF0_FIRST);
+	ck_assert_int_eq(ov_packet_captured_size(&p.packet), 1);
+}
+END_TEST
+
+START_TEST (test_packet_decoder_reset_timestamp) {
+	char inp[] = {0xa0,0,0x01,0,0xc4,0x5a};
+	ck_assert_int_eq(packet_decoder_proc(&pd, inp, sizeof(inp)), sizeof(inp));
+	ck_assert_int_eq(packet_decoder_proc(&pd, inp, sizeof(inp)), sizeof(inp));
+	ck_assert_int_eq(p.packet.timestamp, 2 * 0xc4);
+
+	packet_decoder_reset_timestamp(&pd);
+	ck_assert_int_eq(packet_decoder_proc(&pd, inp, sizeof(inp)), sizeof(inp));
+	ck_assert_int_eq(p.packet.timestamp, 0xc4);
+}
+END_TEST
+
 START_TEST (test_packet_decoder_truncated) {
 	char inp[5 + OV_MAX_PACKET_SIZE + 1] = {
 		0xa0, OV_FLAGS_HF0_TRUNC,
@@ -148,6 +169,186 @@ START_TEST (test_frame_decoder3) {
 }
 END_TEST
 
+size_t filtered_count;
+
+static void filtered_packet(void* data, struct ov_packet* packet) {
+	ck_assert_int_eq(packet->data[0], 0x5a);
+	filtered_count++;
+}
+
+START_TEST (test_packet_decoder_filter) {
+	/* IN token, NAK and a truncated DATA0 */
+	char inp[] = {
+		0xa0, 0x00, 0x03, 0x00, 0x10, 0x69, 0x83, 0x00,
+		0xa0, 0x00, 0x01, 0x00, 0x10, 0x5a,
+		0xa0, OV_FLAGS_HF0_TRUNC, (OV_MAX_PACKET_SIZE + 1) & 0xff, ((OV_MAX_PACKET_SIZE + 1) >> 8) & 0x1f, 0x10, 0xc3,
+	};
+	struct decoder_ops filter_ops = {
+		.packet = &filtered_packet,
+	};
+	uint8_t data[OV_MAX_PACKET_SIZE - 1] = {0};
+	struct filter filter;
+	size_t offset = 0;
+	int ret;
+
+	ck_assert_int_eq(filter_compile(&filter, "pid == NAK"), 0);
+	ck_assert_int_eq(packet_decoder_init(&pd, &p.packet, sizeof(p), &filter_ops, NULL), 0);
+	packet_decoder_set_filter(&pd, &filter);
+	filtered_count = 0;
+
+	/* Byte by byte to exercise partial filter data */
+	while (offset < sizeof(inp)) {
+		ret = packet_decoder_proc(&pd, inp + offset, 1);
+		ck_assert_int_eq(ret, 1);
+		offset += ret;
+	}
+
+	ck_assert_int_eq(pd.state, SKIP_PACKET_DATA);
+	ck_assert_int_eq(packet_decoder_proc(&pd, data, sizeof(data)), sizeof(data));
+	ck_assert_int_eq(pd.state, NEED_PACKET_MAGIC);
+	ck_assert_uint_eq(filtered_count, 1);
+	/* Payload of the rejected packet is not copied */
+	ck_assert_int_eq(p.packet.data[1], 0x00);
+}
+END_TEST
+
+size_t swapped_count;
+
+static void swapped_packet(void* data, struct ov_packet* packet) {
+	/* DATA0 passed by the first filter, NAK by the second one */
+	if (swapped_count++ == 0) {
+		ck_assert_int_eq(packet->size, 8);
+		ck_assert_int_eq(packet->data[7], 0x77);
+	} else {
+		ck_assert_int_eq(packet->data[0], 0x5a);
+	}
+}
+
+START_TEST (test_packet_decoder_filter_swap) {
+	char head[] = {
+		0xa0, 0x00, 0x08, 0x00, 0x10, 0xc3, 0x11, 0x22,
+	};
+	char tail[] = {
+		0x33, 0x44, 0x55, 0x66, 0x77,
+		0xa0, 0x00, 0x01, 0x00, 0x10, 0x5a,
+		0xa0, 0x00, 0x08, 0x00, 0x10, 0xc3, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	};
+	struct decoder_ops swap_ops = {
+		.packet = &swapped_packet,
+	};
+	struct filter first;
+	struct filter second;
+	size_t offset = 0;
+	int ret;
+
+	ck_assert_int_eq(filter_compile(&first, "data[4] == 0x44"), 0);
+	ck_assert_int_eq(filter_compile(&second, "pid == NAK"), 0);
+	ck_assert_int_eq(packet_decoder_init(&pd, &p.packet, sizeof(p), &swap_ops, NULL), 0);
+	packet_decoder_set_filter(&pd, &first);
+	swapped_count = 0;
+
+	ck_assert_int_eq(packet_decoder_proc(&pd, head, sizeof(head)), sizeof(head));
+	ck_assert_int_eq(pd.buf_actual_length, 3);
+
+	/* Fewer bytes than already buffered are needed by the new filter */
+	packet_decoder_set_filter(&pd, &second);
+
+	while (offset < sizeof(tail)) {
+		ret = packet_decoder_proc(&pd, tail + offset, sizeof(tail) - offset);
+		ck_assert_int_gt(ret, 0);
+		offset += ret;
+	}
+
+	ck_assert_int_eq(pd.state, NEED_PACKET_MAGIC);
+	ck_assert_uint_eq(swapped_count, 2);
+}
+END_TEST
+
+size_t damaged_count;
+
+static void damaged_packet(void* data, struct ov_packet* packet) {
+	ck_assert_int_eq(packet->data[0], 0x69);
+	ck_assert_int_eq(packet->flags & OV_FLAGS_BAD_CRC, OV_FLAGS_BAD_CRC);
+	damaged_count++;
+}
+
+START_TEST (test_packet_decoder_validation) {
+	/* Valid SETUP token and IN token with wrong CRC5 */
+	char inp[] = {
+		0xa0, 0x00, 0x03, 0x00, 0x10, 0x2d, 0x00, 0x10,
+		0xa0, 0x00, 0x03, 0x00, 0x10, 0x69, 0x83, 0x00,
+	};
+	struct decoder_ops validation_ops = {
+		.packet = &damaged_packet,
+	};
+	struct filter filter;
+	size_t offset = 0;
+	int ret;
+
+	ck_assert_int_eq(filter_compile(&filter, "flags & BAD_CRC"), 0);
+	ck_assert_int_eq(packet_decoder_init(&pd, &p.packet, sizeof(p), &validation_ops, NULL), 0);
+	packet_decoder_set_filter(&pd, &filter);
+	packet_decoder_set_validation(&pd, 1);
+	damaged_count = 0;
+
+	while (offset < sizeof(inp)) {
+		ret = packet_decoder_proc(&pd, inp + offset, 1);
+		ck_assert_int_eq(ret, 1);
+		offset += ret;
+	}
+
+	ck_assert_int_eq(pd.state, NEED_PACKET_MAGIC);
+	ck_assert_uint_eq(damaged_count, 1);
+}
+END_TEST
+
+size_t snapped_count;
+
+static void snapped_packet(void* data, struct ov_packet* packet) {
+	ck_assert_int_eq(packet->magic, 0xa0);
+	ck_assert_int_eq(packet->size, 6);
+	ck_assert_int_eq(packet->flags & OV_FLAGS_SNAPPED, OV_FLAGS_SNAPPED);
+	ck_assert_int_eq(ov_packet_captured_size(packet), 2);
+	ck_assert_int_eq(packet->data[0], 0xc3);
+	ck_assert_int_eq(packet->data[1], 0x01);
+	snapped_count++;
+}
+
+START_TEST (test_packet_decoder_snaplen) {
+	/* DATA0 longer than snaplen, then a NAK shorter than snaplen */
+	char inp[] = {
+		0xa0, 0x00, 0x06, 0x00, 0x10, 0xc3, 0x01, 0x02, 0x03, 0x04, 0x05,
+		0xa0, 0x00, 0x01, 0x00, 0x10, 0x5a,
+	};
+	struct decoder_ops snaplen_ops = {
+		.packet = &snapped_packet,
+	};
+	int ret;
+
+	ck_assert_int_eq(packet_decoder_init(&pd, &p.packet, sizeof(p), &snaplen_ops, NULL), 0);
+	packet_decoder_set_snaplen(&pd, 2);
+	snapped_count = 0;
+	p.packet.data[2] = 0;
+
+	/* Packet is passed on before its tail is skipped */
+	ret = packet_decoder_proc(&pd, inp, sizeof(inp));
+	ck_assert_int_eq(ret, 7);
+	ck_assert_int_eq(pd.state, SKIP_PACKET_DATA);
+	ck_assert_uint_eq(snapped_count, 1);
+
+	/* Skipped bytes are not copied */
+	ck_assert_int_eq(p.packet.data[2], 0);
+
+	pd.ops.packet = NULL;
+	ck_assert_int_eq(packet_decoder_proc(&pd, inp + ret, sizeof(inp) - ret), sizeof(inp) - ret);
+	ck_assert_int_eq(pd.state, NEED_PACKET_MAGIC);
+	ck_assert_int_eq(p.packet.size, 1);
+	ck_assert_int_eq(p.packet.flags & OV_FLAGS_SNAPPED, 0);
+	ck_assert_int_eq(ov_packet_captured_size(&p.packet), 1);
+	ck_assert_int_eq(p.packet.data[0], 0x5a);
+}
+END_TEST
+
 Suite* range_suite(void) {
 	Suite *s;
 	TCase *tc_packet;
@@ -162,7 +363,13 @@ Suite* range_suite(void) {
 	tcase_add_test(tc_packet, test_packet_decoder3);
 	tcase_add_test(tc_packet, test_packet_decoder4);
 	tcase_add_test(tc_packet, test_packet_decoder5);
+	tcase_add_test(tc_packet, test_packet_decoder_library_flags);
+	tcase_add_test(tc_packet, test_packet_decoder_reset_timestamp);
 	tcase_add_test(tc_packet, test_packet_decoder_truncated);
+	tcase_add_test(tc_packet, test_packet_decoder_filter);
+	tcase_add_test(tc_packet, test_packet_decoder_filter_swap);
+	tcase_add_test(tc_packet, test_packet_decoder_validation);
+	tcase_add_test(tc_packet, test_packet_decoder_snaplen);
 	suite_add_tcase(s, tc_packet);
 
 	tc_frame = tcase_create("Frame");
@@ -0,0 +1,164 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <filter.h>
+#include <usb.h>
+
+union {
+	struct ov_packet packet;
+	uint8_t data[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
+} p;
+
+struct filter filter;
+
+static void set_packet(const uint8_t* data, size_t size, uint8_t flags) {
+	p.packet.magic = 0xa0;
+	p.packet.flags = flags;
+	p.packet.size = size;
+	p.packet.timestamp = 0;
+	memcpy(p.packet.data, data, size);
+}
+
+static int match(const char* expr) {
+	ck_assert_int_eq(filter_compile(&filter, expr), 0);
+	return filter_match(&filter, &p.packet);
+}
+
+START_TEST (test_filter_empty) {
+	const uint8_t ack[] = {USB_PID_HANDSHAKE_ACK};
+
+	set_packet(ack, sizeof(ack), 0);
+	ck_assert_int_eq(match(""), 1);
+	ck_assert_uint_eq(filter.length, 0);
+	ck_assert_int_eq(match("   "), 1);
+}
+END_TEST
+
+START_TEST (test_filter_token) {
+	/* IN token to address 3, endpoint 1 */
+	const uint8_t in[] = {USB_PID_TOKEN_IN, 0x83, 0x00};
+
+	set_packet(in, sizeof(in), 0);
+	ck_assert_int_eq(match("pid == IN"), 1);
+	ck_assert_int_eq(match("pid == OUT"), 0);
+	ck_assert_int_eq(match("addr == 3 && endp == 1"), 1);
+	ck_assert_int_eq(match("addr == 3 && endp == 2"), 0);
+	ck_assert_int_eq(match("dir == in"), 1);
+	ck_assert_int_eq(match("dir == out || addr == 4"), 0);
+	ck_assert_int_eq(match("!(pid == SOF)"), 1);
+	ck_assert_uint_eq(filter.data_length, 1);
+	ck_assert_int_eq(match("addr != 3 || pid == IN && size == 3"), 1);
+	ck_assert_uint_eq(filter.data_length, USB_TOKEN_SIZE);
+}
+END_TEST
+
+START_TEST (test_filter_data) {
+	const uint8_t data[] = {USB_PID_DATA_DATA0, 0x80, 0x06, 0x00, 0x01};
+
+	set_packet(data, sizeof(data), OV_FLAGS_HF0_ERR | OV_FLAGS_HF0_FIRST);
+	ck_assert_int_eq(match("addr == 3"), 0);
+	ck_assert_int_eq(match("addr != 3"), 1);
+	ck_assert_int_eq(match("data[1] == 0x80 && data[2] == 6"), 1);
+	ck_assert_uint_eq(filter.data_length, 3);
+	ck_assert_int_eq(match("data[100] == 0"), 1);
+	ck_assert_int_eq(match("(data[4] & 0x0f) == 1"), 1);
+	ck_assert_int_eq(match("flags & HF0_ERR"), 1);
+	ck_assert_int_eq(match("flags & HF0_OVF"), 0);
+	ck_assert_int_eq(match("size > 4 && size <= 5"), 1);
+	ck_assert_int_eq(match("size >= 6"), 0);
+	ck_assert_int_eq(match("size < 5"), 0);
+}
+END_TEST
+
+START_TEST (test_filter_invalid) {
+	ck_assert_int_eq(filter_compile(&filter, "pid =="), -1);
+	ck_assert_ptr_ne(filter.error_str, NULL);
+	ck_assert_int_eq(filter_compile(&filter, "foo == 1"), -1);
+	ck_assert_int_eq(filter_compile(&filter, "(pid == IN"), -1);
+	ck_assert_int_eq(filter_compile(&filter, "data[2000] == 1"), -1);
+	ck_assert_int_eq(filter_compile(&filter, "pid = IN"), -1);
+	ck_assert_int_eq(filter_compile(&filter, "pid == IN pid"), -1);
+	ck_assert_int_eq(filter_compile(&filter, "pid == 0x100000000"), -1);
+}
+END_TEST
+
+START_TEST (test_filter_complex) {
+	char expr[FILTER_MAX_STACK * 8 + 16] = "";
+	size_t i;
+
+	/* Every nested operand stays on the stack */
+	for (i = 0; i <= FILTER_MAX_STACK; ++i)
+		strcat(expr, "1 & (");
+	strcat(expr, "1");
+	for (i = 0; i <= FILTER_MAX_STACK; ++i)
+		strcat(expr, ")");
+
+	ck_assert_int_eq(filter_compile(&filter, expr), -1);
+	ck_assert_uint_eq(filter.length, 0);
+}
+END_TEST
+
+START_TEST (test_filter_nesting) {
+	const size_t deep = 100000;
+	char* expr = malloc(2 * deep + 2);
+	size_t i;
+
+	ck_assert_ptr_ne(expr, NULL);
+
+	/* Recursion is bounded before the stack or the program fills up */
+	memset(expr, '!', deep);
+	strcpy(expr + deep, "1");
+	ck_assert_int_eq(filter_compile(&filter, expr), -1);
+	ck_assert_str_eq(filter.error_str, "Filter is too complex");
+
+	for (i = 0; i < deep; ++i) {
+		expr[i] = '(';
+		expr[deep + 1 + i] = ')';
+	}
+	expr[deep] = '1';
+	expr[2 * deep + 1] = '\0';
+	ck_assert_int_eq(filter_compile(&filter, expr), -1);
+	ck_assert_str_eq(filter.error_str, "Filter is too complex");
+
+	/* Up to the limit it is fine */
+	memset(expr, '!', FILTER_MAX_NESTING);
+	strcpy(expr + FILTER_MAX_NESTING, "1");
+	ck_assert_int_eq(filter_compile(&filter, expr), 0);
+
+	free(expr);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("filter");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_filter_empty);
+	tcase_add_test(tc_core, test_filter_token);
+	tcase_add_test(tc_core, test_filter_data);
+	tcase_add_test(tc_core, test_filter_invalid);
+	tcase_add_test(tc_core, test_filter_complex);
+	tcase_add_test(tc_core, test_filter_nesting);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
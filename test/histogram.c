@@ -0,0 +1,86 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include <histogram.h>
+
+struct histogram h;
+
+START_TEST (test_histogram_exact) {
+	histogram_reset(&h);
+
+	ck_assert_uint_eq(histogram_percentile(&h, 50.0), 0);
+
+	for (uint64_t i = 1; i <= HISTOGRAM_SUB_COUNT - 1; ++i)
+		histogram_record(&h, i);
+
+	ck_assert_uint_eq(h.count, HISTOGRAM_SUB_COUNT - 1);
+	ck_assert_uint_eq(h.min, 1);
+	ck_assert_uint_eq(h.max, HISTOGRAM_SUB_COUNT - 1);
+	ck_assert_uint_eq(histogram_percentile(&h, 0.0), 1);
+	ck_assert_uint_eq(histogram_percentile(&h, 50.0), HISTOGRAM_SUB_COUNT / 2);
+	ck_assert_uint_eq(histogram_percentile(&h, 100.0), HISTOGRAM_SUB_COUNT - 1);
+}
+END_TEST
+
+START_TEST (test_histogram_precision) {
+	uint64_t value = 1;
+
+	/* Every recorded value is reported within the relative error */
+	for (int i = 0; i < 63; ++i, value = value * 3 / 2 + 1) {
+		uint64_t reported;
+
+		histogram_reset(&h);
+		histogram_record(&h, value);
+		histogram_record(&h, UINT64_MAX);
+
+		reported = histogram_percentile(&h, 50.0);
+		ck_assert_uint_ge(reported, value);
+		ck_assert_uint_le(reported - value, value / (HISTOGRAM_SUB_COUNT / 2));
+	}
+}
+END_TEST
+
+START_TEST (test_histogram_percentile) {
+	histogram_reset(&h);
+
+	/* 99 fast callbacks of 10 us and a slow one of 5 ms */
+	for (int i = 0; i < 99; ++i)
+		histogram_record(&h, 10000);
+	histogram_record(&h, 5000000);
+
+	ck_assert_uint_ge(histogram_percentile(&h, 50.0), 10000);
+	ck_assert_uint_lt(histogram_percentile(&h, 99.0), 11000);
+	ck_assert_uint_eq(histogram_percentile(&h, 99.9), 5000000);
+	ck_assert_uint_eq(h.total, 99 * 10000 + 5000000);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("histogram");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_histogram_exact);
+	tcase_add_test(tc_core, test_histogram_precision);
+	tcase_add_test(tc_core, test_histogram_percentile);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
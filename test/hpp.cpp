@@ -0,0 +1,77 @@
+/* Instantiates the templates of the C++ header. Capturing needs a device,
+ * so only the parts that work without one are run. */
+
+#include <openvizsla.hpp>
+
+#include <cstdint>
+#include <cstdio>
+
+std::uint64_t hpp_dispatch(openvizsla::device& dev) {
+	std::uint64_t bytes = 0;
+	openvizsla::callback_capture cap(dev, [&](const ov_packet& packet) {
+		bytes += openvizsla::captured_size(packet);
+	});
+
+	while (cap.dispatch(16))
+		;
+
+	return bytes;
+}
+
+std::size_t hpp_read_batch(openvizsla::capture& cap) {
+	openvizsla::batch b = cap.read_batch(10);
+	std::size_t count = 0;
+
+	for (const ov_packet& packet : b)
+		count += (packet.size > 0);
+
+	return count + cap.try_read_batch().size();
+}
+
+#ifdef OPENVIZSLA_HAS_COROUTINES
+struct hpp_task {
+	struct promise_type {
+		hpp_task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+hpp_task hpp_next_batch(openvizsla::capture& cap, std::uint64_t& count) {
+	for (;;) {
+		openvizsla::batch b = co_await cap.next_batch();
+
+		if (b.empty())
+			break;
+
+		count += b.size();
+	}
+}
+
+#ifndef _WIN32
+void hpp_event_loop(openvizsla::capture& a, openvizsla::capture& b, std::uint64_t& count) {
+	openvizsla::event_loop loop;
+
+	loop.add(a);
+	loop.add(b);
+	hpp_next_batch(a, count);
+	hpp_next_batch(b, count);
+	loop.run();
+}
+#endif
+#endif
+
+int main() {
+	openvizsla::batch empty;
+
+	if (!empty.empty() || empty.begin() != empty.end()) {
+		std::fprintf(stderr, "Default batch is not empty\n");
+		return 1;
+	}
+
+	openvizsla::batch moved(std::move(empty));
+
+	return (moved.size() == 0 ? 0 : 1);
+}
@@ -0,0 +1,138 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pool.h>
+
+START_TEST (test_pool_reuse) {
+	struct packet_pool* pool = packet_pool_new(2);
+	struct ov_packet* a = NULL;
+	struct ov_packet* b = NULL;
+	struct ov_packet* c = NULL;
+
+	ck_assert_ptr_ne(pool, NULL);
+
+	a = packet_pool_get(pool);
+	b = packet_pool_get(pool);
+	ck_assert_ptr_ne(a, NULL);
+	ck_assert_ptr_ne(b, NULL);
+	ck_assert_ptr_ne(a, b);
+	ck_assert_uint_eq((uintptr_t)a % PACKET_POOL_ALIGN, 0);
+
+	/* Whole packet fits into the slot */
+	memset(a->data, 0xaa, OV_MAX_PACKET_SIZE);
+	memset(b->data, 0xbb, OV_MAX_PACKET_SIZE);
+	ck_assert_int_eq(a->data[OV_MAX_PACKET_SIZE - 1], 0xaa);
+
+	ck_assert_ptr_eq(ov_packet_ref(a), a);
+	ov_packet_unref(a);
+	ov_packet_unref(a);
+	ck_assert_int_eq(pool->refcount, 2);
+
+	/* Released slot is reused before the pool grows */
+	c = packet_pool_get(pool);
+	ck_assert_ptr_eq(c, a);
+	ck_assert_ptr_eq(pool->slabs->next, NULL);
+
+	ov_packet_unref(b);
+	ov_packet_unref(c);
+	packet_pool_unref(pool);
+}
+END_TEST
+
+START_TEST (test_pool_grow) {
+	struct packet_pool* pool = packet_pool_new(4);
+	struct ov_packet* packets[10];
+	size_t i;
+
+	for (i = 0; i < 10; ++i) {
+		packets[i] = packet_pool_get(pool);
+		ck_assert_ptr_ne(packets[i], NULL);
+		packets[i]->timestamp = i;
+	}
+
+	ck_assert_ptr_ne(pool->slabs->next->next, NULL);
+	ck_assert_ptr_eq(pool->slabs->next->next->next, NULL);
+
+	/* Packets outlive the owner reference */
+	packet_pool_unref(pool);
+
+	for (i = 0; i < 10; ++i) {
+		ck_assert_uint_eq(packets[i]->timestamp, i);
+		ov_packet_unref(packets[i]);
+	}
+}
+END_TEST
+
+#ifndef WIN32
+#include <pthread.h>
+
+#define POOL_THREAD_PACKETS 10000
+
+struct ov_packet* pool_thread_packets[POOL_THREAD_PACKETS];
+
+static void* pool_thread(void* data) {
+	size_t i;
+
+	for (i = 0; i < POOL_THREAD_PACKETS; ++i) {
+		while (!__atomic_load_n(&pool_thread_packets[i], __ATOMIC_ACQUIRE));
+		ov_packet_unref(pool_thread_packets[i]);
+	}
+
+	return NULL;
+}
+
+START_TEST (test_pool_thread) {
+	struct packet_pool* pool = packet_pool_new(16);
+	pthread_t thread;
+	size_t i;
+
+	ck_assert_int_eq(pthread_create(&thread, NULL, &pool_thread, NULL), 0);
+
+	/* Slots are released by the other thread while new ones are taken */
+	for (i = 0; i < POOL_THREAD_PACKETS; ++i) {
+		struct ov_packet* packet = packet_pool_get(pool);
+
+		ck_assert_ptr_ne(packet, NULL);
+		packet->timestamp = i;
+		__atomic_store_n(&pool_thread_packets[i], packet, __ATOMIC_RELEASE);
+	}
+
+	pthread_join(thread, NULL);
+	ck_assert_int_eq(pool->refcount, 1);
+	packet_pool_unref(pool);
+}
+END_TEST
+#endif
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("pool");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_pool_reuse);
+	tcase_add_test(tc_core, test_pool_grow);
+#ifndef WIN32
+	tcase_add_test(tc_core, test_pool_thread);
+#endif
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
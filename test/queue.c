@@ -0,0 +1,148 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <queue.h>
+
+union {
+	struct ov_packet packet;
+	uint8_t data[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
+} p;
+
+struct packet_queue queue;
+
+static void set_packet(uint64_t timestamp, size_t size) {
+	p.packet.magic = 0xa0;
+	p.packet.flags = 0;
+	p.packet.size = size;
+	p.packet.timestamp = timestamp;
+	memset(p.packet.data, (uint8_t)timestamp, size);
+}
+
+static void setup(void) {
+	ck_assert_int_eq(packet_queue_init(&queue, 0), 0);
+	ck_assert_uint_eq(queue.size, PACKET_QUEUE_MIN_SIZE);
+}
+
+static void teardown(void) {
+	packet_queue_destroy(&queue);
+}
+
+START_TEST (test_queue_order) {
+	struct ov_packet* packets[3];
+	size_t i;
+
+	ck_assert_ptr_eq(packet_queue_next(&queue), NULL);
+
+	for (i = 0; i < 3; ++i) {
+		set_packet(i, i + 1);
+		ck_assert_int_eq(packet_queue_push(&queue, &p.packet), 0);
+	}
+
+	ck_assert_uint_eq(packet_queue_unread(&queue), 3);
+
+	for (i = 0; i < 3; ++i) {
+		packets[i] = packet_queue_next(&queue);
+		ck_assert_ptr_ne(packets[i], NULL);
+		ck_assert_uint_eq(packets[i]->timestamp, i);
+		ck_assert_uint_eq(packets[i]->size, i + 1);
+		ck_assert_uint_eq((uintptr_t)packets[i] % PACKET_QUEUE_ALIGN, 0);
+	}
+
+	ck_assert_ptr_eq(packet_queue_next(&queue), NULL);
+
+	/* Released packets are not overwritten until released */
+	ck_assert_uint_eq(packet_queue_release(&queue, 1), 1);
+	set_packet(3, 4);
+	ck_assert_int_eq(packet_queue_push(&queue, &p.packet), 0);
+	ck_assert_uint_eq(packets[1]->timestamp, 1);
+	ck_assert_uint_eq(packets[2]->timestamp, 2);
+
+	/* Unread packets cannot be released */
+	ck_assert_uint_eq(packet_queue_release(&queue, 10), 2);
+	ck_assert_uint_eq(queue.count, 1);
+	ck_assert_uint_eq(packet_queue_next(&queue)->timestamp, 3);
+	ck_assert_uint_eq(packet_queue_release(&queue, 1), 1);
+	ck_assert_uint_eq(packet_queue_free_space(&queue), queue.size);
+}
+END_TEST
+
+START_TEST (test_queue_wrap) {
+	struct ov_packet* packet;
+	uint64_t pushed = 0;
+	uint64_t popped = 0;
+	size_t i;
+
+	/* Drain part of the queue whenever it is full, so that it wraps many times */
+	for (i = 0; i < 10000; ++i) {
+		set_packet(pushed, (pushed * 37) % OV_MAX_PACKET_SIZE);
+		if (packet_queue_push(&queue, &p.packet) == 0) {
+			pushed++;
+			continue;
+		}
+
+		while (packet_queue_unread(&queue) > 20 && (packet = packet_queue_next(&queue))) {
+			ck_assert_uint_eq(packet->timestamp, popped);
+			ck_assert_uint_eq(packet->size, (popped * 37) % OV_MAX_PACKET_SIZE);
+			if (packet->size)
+				ck_assert_uint_eq(packet->data[packet->size - 1], (uint8_t)popped);
+			popped++;
+		}
+
+		packet_queue_release(&queue, queue.count - queue.unread);
+	}
+
+	ck_assert_uint_gt(popped, 1000);
+}
+END_TEST
+
+START_TEST (test_queue_full) {
+	size_t pushed = 0;
+
+	set_packet(0, OV_MAX_PACKET_SIZE);
+	while (packet_queue_push(&queue, &p.packet) == 0)
+		pushed++;
+
+	ck_assert_uint_eq(pushed, queue.size / ((sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE + PACKET_QUEUE_ALIGN - 1) & ~(PACKET_QUEUE_ALIGN - 1)));
+	ck_assert_uint_lt(packet_queue_free_space(&queue), sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE);
+
+	/* Space is reclaimed only by release */
+	ck_assert_ptr_ne(packet_queue_next(&queue), NULL);
+	ck_assert_int_eq(packet_queue_push(&queue, &p.packet), -1);
+	ck_assert_uint_eq(packet_queue_release(&queue, 1), 1);
+	ck_assert_int_eq(packet_queue_push(&queue, &p.packet), 0);
+	ck_assert_uint_eq(queue.wrapped, 1);
+	ck_assert_uint_eq(packet_queue_unread(&queue), pushed);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("queue");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_checked_fixture(tc_core, setup, teardown);
+	tcase_add_test(tc_core, test_queue_order);
+	tcase_add_test(tc_core, test_queue_wrap);
+	tcase_add_test(tc_core, test_queue_full);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <reassembler.h>
+#include <usb.h>
+
+union {
+	struct ov_packet packet;
+	uint8_t data[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
+} p;
+
+struct ov_transaction transactions[16];
+size_t transaction_count;
+struct ov_transfer transfers[4];
+uint8_t transfer_data[4][256];
+size_t transfer_count;
+
+static void transaction_callback(const struct ov_transaction* t, void* data) {
+	ck_assert_uint_lt(transaction_count, sizeof(transactions) / sizeof(transactions[0]));
+	transactions[transaction_count++] = *t;
+}
+
+static void transfer_callback(const struct ov_transfer* t, void* data) {
+	ck_assert_uint_lt(transfer_count, sizeof(transfers) / sizeof(transfers[0]));
+	ck_assert_uint_le(t->size, sizeof(transfer_data[0]));
+	transfers[transfer_count] = *t;
+	if (t->size)
+		memcpy(transfer_data[transfer_count], t->data, t->size);
+	transfer_count++;
+}
+
+static void send(struct ov_reassembler* reasm, const uint8_t* data, size_t size) {
+	p.packet.magic = 0xa0;
+	p.packet.flags = 0;
+	p.packet.size = size;
+	p.packet.timestamp++;
+	memcpy(p.packet.data, data, size);
+
+	ov_reassembler_packet(&p.packet, reasm);
+}
+
+static void send_pid(struct ov_reassembler* reasm, uint8_t pid) {
+	send(reasm, &pid, 1);
+}
+
+static void send_token(struct ov_reassembler* reasm, uint8_t pid, uint8_t address, uint8_t endpoint) {
+	const uint8_t token[] = {pid, address | ((endpoint & 1) << 7), endpoint >> 1};
+
+	send(reasm, token, sizeof(token));
+}
+
+/* CRC16 is not checked, so it is left zero */
+static void send_data(struct ov_reassembler* reasm, uint8_t pid, const uint8_t* payload, size_t size) {
+	uint8_t data[OV_MAX_PACKET_SIZE];
+
+	data[0] = pid;
+	if (size)
+		memcpy(data + 1, payload, size);
+	data[size + 1] = 0;
+	data[size + 2] = 0;
+
+	send(reasm, data, size + 3);
+}
+
+static void setup(void) {
+	memset(&p, 0, sizeof(p));
+	transaction_count = 0;
+	transfer_count = 0;
+}
+
+START_TEST (test_reassembler_control) {
+	struct ov_reassembler* reasm = ov_reassembler_new(0, &transaction_callback, &transfer_callback, NULL);
+	/* GET_DESCRIPTOR(DEVICE) */
+	const uint8_t request[] = {0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x40, 0x00};
+	uint8_t descriptor[18];
+	size_t i;
+
+	for (i = 0; i < sizeof(descriptor); ++i)
+		descriptor[i] = i;
+
+	ck_assert_ptr_ne(reasm, NULL);
+
+	send_token(reasm, USB_PID_TOKEN_SETUP, 5, 0);
+	send_data(reasm, USB_PID_DATA_DATA0, request, sizeof(request));
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	send_token(reasm, USB_PID_TOKEN_IN, 5, 0);
+	send_pid(reasm, USB_PID_HANDSHAKE_NAK);
+
+	send_token(reasm, USB_PID_TOKEN_IN, 5, 0);
+	send_data(reasm, USB_PID_DATA_DATA1, descriptor, sizeof(descriptor));
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	ck_assert_uint_eq(transfer_count, 0);
+
+	send_token(reasm, USB_PID_TOKEN_OUT, 5, 0);
+	send_data(reasm, USB_PID_DATA_DATA1, NULL, 0);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	ck_assert_uint_eq(transaction_count, 4);
+	ck_assert_uint_eq(transactions[0].token, USB_PID_TOKEN_SETUP);
+	ck_assert_uint_eq(transactions[0].address, 5);
+	ck_assert_uint_eq(transactions[0].data_size, sizeof(request));
+	ck_assert_uint_eq(transactions[1].handshake, USB_PID_HANDSHAKE_NAK);
+	ck_assert_uint_eq(transactions[1].data_pid, 0);
+	ck_assert_uint_eq(transactions[2].data_pid, USB_PID_DATA_DATA1);
+	ck_assert_uint_eq(transactions[2].data_size, sizeof(descriptor));
+
+	ck_assert_uint_eq(transfer_count, 1);
+	ck_assert_uint_eq(transfers[0].address, 5);
+	ck_assert_uint_eq(transfers[0].endpoint, 0);
+	ck_assert_uint_eq(transfers[0].direction, 1);
+	ck_assert_uint_eq(transfers[0].control, 1);
+	ck_assert_uint_eq(transfers[0].status, OV_TRANSFER_COMPLETE);
+	ck_assert_mem_eq(transfers[0].setup, request, sizeof(request));
+	ck_assert_uint_eq(transfers[0].size, sizeof(descriptor));
+	ck_assert_mem_eq(transfer_data[0], descriptor, sizeof(descriptor));
+
+	ov_reassembler_free(reasm);
+}
+END_TEST
+
+START_TEST (test_reassembler_bulk) {
+	struct ov_reassembler* reasm = ov_reassembler_new(0, &transaction_callback, &transfer_callback, NULL);
+	uint8_t payload[64];
+	size_t i;
+
+	for (i = 0; i < sizeof(payload); ++i)
+		payload[i] = i;
+
+	ck_assert_int_eq(ov_reassembler_set_max_packet_size(reasm, 3, 2, 0, 64), 0);
+	ck_assert_int_eq(ov_reassembler_set_max_packet_size(reasm, 3, 16, 0, 64), -1);
+
+	send_token(reasm, USB_PID_TOKEN_OUT, 3, 2);
+	send_data(reasm, USB_PID_DATA_DATA0, payload, 64);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	/* Retransmission after the lost handshake */
+	send_token(reasm, USB_PID_TOKEN_OUT, 3, 2);
+	send_data(reasm, USB_PID_DATA_DATA0, payload, 64);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	send_token(reasm, USB_PID_TOKEN_OUT, 3, 2);
+	send_data(reasm, USB_PID_DATA_DATA1, payload, 64);
+	send_pid(reasm, USB_PID_HANDSHAKE_NAK);
+
+	send_token(reasm, USB_PID_TOKEN_OUT, 3, 2);
+	send_data(reasm, USB_PID_DATA_DATA1, payload, 64);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	ck_assert_uint_eq(transfer_count, 0);
+
+	send_token(reasm, USB_PID_TOKEN_OUT, 3, 2);
+	send_data(reasm, USB_PID_DATA_DATA0, payload, 10);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	ck_assert_uint_eq(transaction_count, 5);
+	ck_assert_uint_eq(transfer_count, 1);
+	ck_assert_uint_eq(transfers[0].direction, 0);
+	ck_assert_uint_eq(transfers[0].control, 0);
+	ck_assert_uint_eq(transfers[0].endpoint, 2);
+	ck_assert_uint_eq(transfers[0].status, OV_TRANSFER_COMPLETE);
+	ck_assert_uint_eq(transfers[0].size, 138);
+	ck_assert_mem_eq(transfer_data[0] + 64, payload, 64);
+	ck_assert_mem_eq(transfer_data[0] + 128, payload, 10);
+
+	/* Unfinished transfer is reported on flush */
+	send_token(reasm, USB_PID_TOKEN_IN, 3, 1);
+	send_data(reasm, USB_PID_DATA_DATA0, payload, 64);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+	send_token(reasm, USB_PID_TOKEN_IN, 3, 1);
+	send_data(reasm, USB_PID_DATA_DATA1, payload, 64);
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	ck_assert_uint_eq(transfer_count, 1);
+	ov_reassembler_flush(reasm);
+	ck_assert_uint_eq(transfer_count, 2);
+	ck_assert_uint_eq(transfers[1].direction, 1);
+	ck_assert_uint_eq(transfers[1].status, OV_TRANSFER_PARTIAL);
+	ck_assert_uint_eq(transfers[1].size, 128);
+
+	ov_reassembler_free(reasm);
+}
+END_TEST
+
+START_TEST (test_reassembler_stall) {
+	struct ov_reassembler* reasm = ov_reassembler_new(0, &transaction_callback, &transfer_callback, NULL);
+
+	send_token(reasm, USB_PID_TOKEN_IN, 7, 1);
+	send_pid(reasm, USB_PID_HANDSHAKE_STALL);
+
+	ck_assert_uint_eq(transaction_count, 1);
+	ck_assert_uint_eq(transfer_count, 1);
+	ck_assert_uint_eq(transfers[0].status, OV_TRANSFER_STALL);
+	ck_assert_uint_eq(transfers[0].size, 0);
+
+	ov_reassembler_free(reasm);
+}
+END_TEST
+
+START_TEST (test_reassembler_split) {
+	struct ov_reassembler* reasm = ov_reassembler_new(0, &transaction_callback, &transfer_callback, NULL);
+	/* CSPLIT to hub 2, port 3 */
+	const uint8_t split[] = {USB_PID_SPECIAL_SPLIT, 0x82, 0x03, 0x00};
+	const uint8_t payload[] = {0x01, 0x02, 0x03};
+
+	send(reasm, split, sizeof(split));
+	send_token(reasm, USB_PID_TOKEN_IN, 4, 1);
+	send_data(reasm, USB_PID_DATA_DATA0, payload, sizeof(payload));
+	send_pid(reasm, USB_PID_HANDSHAKE_ACK);
+
+	/* Isochronous transaction without handshake is finished by SOF */
+	send_token(reasm, USB_PID_TOKEN_IN, 4, 2);
+	send_data(reasm, USB_PID_DATA_DATA0, payload, sizeof(payload));
+	ck_assert_uint_eq(transaction_count, 1);
+	send_pid(reasm, USB_PID_TOKEN_SOF);
+
+	ck_assert_uint_eq(transaction_count, 2);
+	ck_assert_uint_eq(transactions[0].split, OV_SPLIT_COMPLETE);
+	ck_assert_uint_eq(transactions[0].split_hub, 2);
+	ck_assert_uint_eq(transactions[0].split_port, 3);
+	ck_assert_uint_eq(transactions[0].address, 4);
+	ck_assert_uint_eq(transactions[0].endpoint, 1);
+	ck_assert_mem_eq(transactions[0].data, payload, sizeof(payload));
+	ck_assert_uint_eq(transactions[1].split, OV_SPLIT_NONE);
+	ck_assert_uint_eq(transactions[1].handshake, 0);
+	ck_assert_uint_eq(transactions[1].endpoint, 2);
+
+	/* Maximum packet size of endpoint 1 is not known yet, so the transfer is still open */
+	ck_assert_uint_eq(transfer_count, 1);
+	ck_assert_uint_eq(transfers[0].endpoint, 2);
+	ck_assert_uint_eq(transfers[0].size, sizeof(payload));
+
+	ov_reassembler_free(reasm);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("reassembler");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_checked_fixture(tc_core, setup, NULL);
+	tcase_add_test(tc_core, test_reassembler_control);
+	tcase_add_test(tc_core, test_reassembler_bulk);
+	tcase_add_test(tc_core, test_reassembler_stall);
+	tcase_add_test(tc_core, test_reassembler_split);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <record.h>
+#include <usb.h>
+
+struct record_buffer rb;
+
+size_t delivered_count;
+size_t delivered_size;
+uint8_t delivered[RECORD_BUFFER_MIN_SIZE];
+
+static void record_callback(const struct ov_record* records, size_t size, size_t count, void* user_data) {
+	ck_assert_uint_le(size, sizeof(delivered));
+
+	memcpy(delivered, records, size);
+	delivered_size = size;
+	delivered_count += count;
+}
+
+/* Same as the decoder does */
+static void decode_packet(uint64_t timestamp, uint8_t flags, const uint8_t* data, size_t size) {
+	struct ov_packet* packet = record_buffer_packet(&rb);
+
+	packet->magic = 0xa0;
+	packet->flags = flags;
+	packet->size = size;
+	packet->timestamp = timestamp;
+	if (size > 0)
+		memcpy(packet->data, data, size);
+
+	record_buffer_commit(&rb);
+}
+
+static void setup(void) {
+	ck_assert_int_eq(record_buffer_init(&rb, 0, &record_callback, NULL), 0);
+	ck_assert_uint_eq(rb.size, RECORD_BUFFER_MIN_SIZE);
+
+	delivered_count = 0;
+	delivered_size = 0;
+}
+
+static void teardown(void) {
+	record_buffer_destroy(&rb);
+}
+
+START_TEST (test_record_layout) {
+	const uint8_t in[] = {USB_PID_TOKEN_IN, 0x83, 0x01};
+	const uint8_t data[] = {USB_PID_DATA_DATA0, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09};
+	const struct ov_record* r;
+
+	ck_assert_uint_eq(sizeof(struct ov_record), 16);
+	ck_assert_uint_eq(RECORD_PACKET_OFFSET + sizeof(struct ov_packet), sizeof(struct ov_record));
+
+	decode_packet(1000, 0, in, sizeof(in));
+	decode_packet(2000, OV_FLAGS_HF0_ERR, data, sizeof(data));
+	decode_packet(3000, 0, NULL, 0);
+	ck_assert_uint_eq(delivered_count, 0);
+
+	record_buffer_flush(&rb);
+	ck_assert_uint_eq(delivered_count, 3);
+	ck_assert_uint_eq(delivered_size, 16 + 8 + 16 + 16 + 16);
+
+	r = (const struct ov_record*)delivered;
+	ck_assert_uint_eq(r->timestamp, 1000);
+	ck_assert_uint_eq(r->size, 3);
+	ck_assert_uint_eq(r->captured, 3);
+	ck_assert_uint_eq(r->pid, USB_PID_TOKEN_IN);
+	ck_assert_uint_eq(r->addr, 3);
+	ck_assert_uint_eq(r->endp, 3);
+	ck_assert_mem_eq(r->data, in, sizeof(in));
+
+	r = ov_record_next(r);
+	ck_assert_uint_eq((uintptr_t)r % OV_RECORD_ALIGN, 0);
+	ck_assert_uint_eq(r->timestamp, 2000);
+	ck_assert_uint_eq(r->flags, OV_FLAGS_HF0_ERR);
+	ck_assert_uint_eq(r->pid, USB_PID_DATA_DATA0);
+	ck_assert_uint_eq(r->addr, OV_RECORD_NONE);
+	ck_assert_uint_eq(r->endp, OV_RECORD_NONE);
+	ck_assert_mem_eq(r->data, data, sizeof(data));
+
+	r = ov_record_next(r);
+	ck_assert_uint_eq(r->timestamp, 3000);
+	ck_assert_uint_eq(r->captured, 0);
+	ck_assert_uint_eq(r->pid, 0);
+
+	/* Nothing is delivered twice */
+	record_buffer_flush(&rb);
+	ck_assert_uint_eq(delivered_count, 3);
+}
+END_TEST
+
+START_TEST (test_record_truncated) {
+	uint8_t data[OV_MAX_PACKET_SIZE];
+	const struct ov_record* r;
+
+	memset(data, 0x5a, sizeof(data));
+	data[0] = USB_PID_DATA_DATA1;
+
+	/* The device reports the original size of truncated packets */
+	decode_packet(1, OV_FLAGS_HF0_TRUNC, data, sizeof(data));
+	r = (const struct ov_record*)rb.buf;
+	ck_assert_uint_eq(r->captured, OV_MAX_PACKET_SIZE);
+	ck_assert_uint_eq(ov_record_size(r), RECORD_MAX_SIZE);
+	ck_assert_mem_eq(r->data, data, sizeof(data));
+}
+END_TEST
+
+START_TEST (test_record_full) {
+	uint8_t data[OV_MAX_PACKET_SIZE];
+	size_t i;
+
+	memset(data, 0, sizeof(data));
+	data[0] = USB_PID_DATA_DATA0;
+
+	/* Buffer is passed on as soon as the next packet might not fit */
+	for (i = 0; i < 15; ++i)
+		decode_packet(i, 0, data, sizeof(data));
+	ck_assert_uint_eq(delivered_count, 0);
+
+	decode_packet(15, 0, data, sizeof(data));
+	ck_assert_uint_eq(delivered_count, 16);
+	ck_assert_uint_eq(delivered_size, 16 * RECORD_MAX_SIZE);
+	ck_assert_uint_eq(rb.used, 0);
+	ck_assert_uint_eq(((const struct ov_record*)delivered)->timestamp, 0);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("record");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_checked_fixture(tc_core, setup, teardown);
+	tcase_add_test(tc_core, test_record_layout);
+	tcase_add_test(tc_core, test_record_truncated);
+	tcase_add_test(tc_core, test_record_full);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
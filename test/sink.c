@@ -0,0 +1,518 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openvizsla.h>
+#include <pcap.h>
+#include <sink.h>
+#include <usb.h>
+#ifndef WIN32
+#include <aio_writer.h>
+#endif
+
+#define PREFIX "sink_test"
+#define PACKET_SIZE 100
+#define RECORD_SIZE (PCAP_RECORD_HEADER_SIZE + PACKET_SIZE)
+
+uint8_t packet_buf[sizeof(struct ov_packet) + PACKET_SIZE];
+struct ov_packet* packet = (struct ov_packet*)packet_buf;
+
+static long file_size(const char* filename) {
+	FILE* file = fopen(filename, "rb");
+	long size = -1;
+
+	if (!file)
+		return -1;
+
+	if (fseek(file, 0, SEEK_END) == 0)
+		size = ftell(file);
+	fclose(file);
+
+	return size;
+}
+
+static void write_packet(struct ov_sink* sink, uint64_t timestamp) {
+	packet->size = PACKET_SIZE;
+	packet->timestamp = timestamp;
+
+	ck_assert_int_eq(ov_sink_write(sink, packet), 0);
+}
+
+START_TEST (test_sink_pcap_header) {
+	uint8_t buf[PCAP_MAX_FILE_HEADER_SIZE];
+	uint32_t magic;
+
+	ck_assert_uint_eq(pcap_file_header(buf, OV_SINK_PCAP, 288), PCAP_FILE_HEADER_SIZE);
+	memcpy(&magic, buf, sizeof(magic));
+	ck_assert_uint_eq(magic, PCAP_NANOSEC_MAGIC);
+
+	ck_assert_uint_eq(pcap_file_header(buf, OV_SINK_PCAPNG, 288), PCAPNG_SHB_SIZE + PCAPNG_IDB_SIZE);
+	/* if_tsresol value follows the IDB fields and the option header */
+	ck_assert_uint_eq(buf[PCAPNG_SHB_SIZE + 20], 9);
+	ck_assert_uint_eq(buf[PCAPNG_SHB_SIZE + 21] | buf[PCAPNG_SHB_SIZE + 22] | buf[PCAPNG_SHB_SIZE + 23], 0);
+
+	packet->size = 1;
+	packet->flags = 0;
+	ck_assert_uint_eq(pcap_record_size(OV_SINK_PCAPNG, packet), PCAPNG_EPB_HEADER_SIZE + 4);
+	ck_assert_uint_eq(pcap_record_size(OV_SINK_PCAP, packet), PCAP_RECORD_HEADER_SIZE + 1);
+}
+END_TEST
+
+START_TEST (test_sink_ring_size) {
+	struct ov_sink* sink;
+	struct ov_sink_segment segment;
+	uint64_t i;
+
+	/* Two records fit into the segment */
+	sink = ov_sink_new_ring(PREFIX, 3, PCAP_FILE_HEADER_SIZE + 2 * RECORD_SIZE, 0);
+	ck_assert_ptr_ne(sink, NULL);
+	ck_assert_int_eq(ov_sink_open(sink, OV_SINK_PCAP, 288), 0);
+
+	for (i = 0; i < 7; ++i)
+		write_packet(sink, i * 1000);
+
+	ck_assert_int_eq(ov_sink_close(sink), 0);
+
+	/* The ring has wrapped, the first slot holds the last packet */
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 0, &segment), 0);
+	ck_assert_uint_eq(segment.sequence, 3);
+	ck_assert_uint_eq(segment.first_ts, 6000);
+	ck_assert_uint_eq(segment.packets, 1);
+	ck_assert_uint_eq(segment.size, PCAP_FILE_HEADER_SIZE + RECORD_SIZE);
+
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 1, &segment), 0);
+	ck_assert_uint_eq(segment.sequence, 1);
+	ck_assert_uint_eq(segment.first_ts, 2000);
+	ck_assert_uint_eq(segment.last_ts, 3000);
+	ck_assert_uint_eq(segment.packets, 2);
+
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 3, &segment), -1);
+
+	ck_assert_int_eq(file_size(PREFIX "_0000.pcap"), PCAP_FILE_HEADER_SIZE + RECORD_SIZE);
+	ck_assert_int_eq(file_size(PREFIX "_0002.pcap"), PCAP_FILE_HEADER_SIZE + 2 * RECORD_SIZE);
+	ck_assert_int_eq(file_size(PREFIX "_0003.pcap"), -1);
+	ck_assert_int_gt(file_size(PREFIX ".idx"), 0);
+
+	ov_sink_free(sink);
+}
+END_TEST
+
+START_TEST (test_sink_skip_summary) {
+	struct ov_sink* sink;
+	struct ov_sink_segment segment;
+
+	sink = ov_sink_new_ring(PREFIX, 2, PCAP_FILE_HEADER_SIZE + 4 * RECORD_SIZE, 0);
+	ck_assert_ptr_ne(sink, NULL);
+	ck_assert_int_eq(ov_sink_open(sink, OV_SINK_PCAP, 288), 0);
+
+	write_packet(sink, 1000);
+	packet->magic = OV_PACKET_MAGIC_SUMMARY;
+	write_packet(sink, 2000);
+	packet->magic = 0;
+	write_packet(sink, 3000);
+
+	ck_assert_int_eq(ov_sink_close(sink), 0);
+
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 0, &segment), 0);
+	ck_assert_uint_eq(segment.packets, 2);
+	ck_assert_int_eq(file_size(PREFIX "_0000.pcap"), PCAP_FILE_HEADER_SIZE + 2 * RECORD_SIZE);
+
+	ov_sink_free(sink);
+}
+END_TEST
+
+START_TEST (test_sink_ring_time) {
+	struct ov_sink* sink;
+	struct ov_sink_segment segment;
+
+	sink = ov_sink_new_ring(PREFIX, 2, 0, 1);
+	ck_assert_ptr_ne(sink, NULL);
+	ck_assert_int_eq(ov_sink_open(sink, OV_SINK_PCAPNG, 288), 0);
+
+	write_packet(sink, 0);
+	write_packet(sink, 999999999);
+	write_packet(sink, 1000000000);
+
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 0, &segment), 0);
+	ck_assert_uint_eq(segment.packets, 2);
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 1, &segment), 0);
+	ck_assert_uint_eq(segment.packets, 1);
+	ck_assert_uint_eq(segment.first_ts, 1000000000);
+
+	ov_sink_free(sink);
+
+	ck_assert_int_eq(file_size(PREFIX "_0001.pcapng"), PCAPNG_SHB_SIZE + PCAPNG_IDB_SIZE + PCAPNG_EPB_HEADER_SIZE + PACKET_SIZE);
+}
+END_TEST
+
+START_TEST (test_sink_ring_invalid) {
+	ck_assert_ptr_eq(ov_sink_new_ring(PREFIX, 0, 1024, 0), NULL);
+	ck_assert_ptr_eq(ov_sink_new_ring(PREFIX, 2, 0, 0), NULL);
+}
+END_TEST
+
+/* Sink remembering timestamps of written packets */
+struct sink_collect {
+	struct ov_sink sink;
+	uint64_t timestamps[64];
+	size_t count;
+};
+
+static int sink_collect_open(struct ov_sink* sink, enum ov_sink_format format, uint32_t linktype) {
+	((struct sink_collect*)sink)->count = 0;
+	return 0;
+}
+
+static int sink_collect_write(struct ov_sink* sink, struct ov_packet* packet) {
+	struct sink_collect* sc = (struct sink_collect*)sink;
+
+	ck_assert_uint_lt(sc->count, 64);
+	sc->timestamps[sc->count++] = packet->timestamp;
+	return 0;
+}
+
+static int sink_collect_nop(struct ov_sink* sink) {
+	return 0;
+}
+
+static void sink_collect_destroy(struct ov_sink* sink) {
+}
+
+static const struct sink_ops sink_collect_ops = {
+	.open = &sink_collect_open,
+	.write = &sink_collect_write,
+	.flush = &sink_collect_nop,
+	.close = &sink_collect_nop,
+	.destroy = &sink_collect_destroy,
+};
+
+struct sink_collect collect;
+
+#define TRIGGER_PACKET_SIZE 1000
+#define TRIGGER_RECORD_SIZE (sizeof(struct ov_packet) + TRIGGER_PACKET_SIZE)
+
+uint8_t trigger_packet_buf[sizeof(struct ov_packet) + TRIGGER_PACKET_SIZE];
+
+static void write_trigger_packet(struct ov_sink* sink, uint64_t timestamp, uint8_t pid, uint8_t flags) {
+	struct ov_packet* p = (struct ov_packet*)trigger_packet_buf;
+
+	memset(p->data, 0, TRIGGER_PACKET_SIZE);
+	p->data[0] = pid;
+	p->flags = flags;
+	p->size = TRIGGER_PACKET_SIZE;
+	p->timestamp = timestamp;
+
+	ck_assert_int_eq(ov_sink_write(sink, p), 0);
+}
+
+static void setup_collect(void) {
+	sink_init(&collect.sink, &sink_collect_ops);
+	collect.count = 0;
+}
+
+static void write_sink_file(struct sink_file* sf, uint8_t value, size_t size) {
+	uint8_t* buf;
+
+	ck_assert_int_eq(sink_file_open(sf, PREFIX ".reuse", 1024 * 1024), 0);
+	buf = sink_file_reserve(sf, size);
+	ck_assert_ptr_ne(buf, NULL);
+	memset(buf, value, size);
+	sink_file_commit(sf, size);
+	ck_assert_int_eq(sink_file_close(sf), 0);
+	ck_assert_int_eq(sink_file_wait(sf), 0);
+}
+
+static void check_sink_file_reuse(int async) {
+	struct sink_file sf;
+	uint8_t data[2];
+	FILE* file;
+
+	ck_assert_int_eq(sink_file_init(&sf, 8192), 0);
+	if (async)
+		ck_assert_int_eq(sink_file_set_async(&sf, 2, 0), 0);
+
+	/* The second, shorter write reuses the file and cuts its tail */
+	write_sink_file(&sf, 'a', 5000);
+	ck_assert_int_eq(file_size(PREFIX ".reuse"), 5000);
+	write_sink_file(&sf, 'b', 100);
+	ck_assert_int_eq(file_size(PREFIX ".reuse"), 100);
+
+	sink_file_destroy(&sf);
+
+	file = fopen(PREFIX ".reuse", "rb");
+	ck_assert_ptr_ne(file, NULL);
+	ck_assert_uint_eq(fread(data, 1, sizeof(data), file), sizeof(data));
+	ck_assert_uint_eq(data[0], 'b');
+	fclose(file);
+}
+
+START_TEST (test_sink_file_reuse) {
+	check_sink_file_reuse(0);
+#ifndef WIN32
+	check_sink_file_reuse(1);
+#endif
+}
+END_TEST
+
+START_TEST (test_sink_trigger_window) {
+	struct ov_sink* sink;
+	struct ov_trigger trigger = {
+		.type = OV_TRIGGER_ERROR,
+	};
+	uint64_t i;
+
+	/* Three packets before the trigger and two after it */
+	sink = ov_sink_new_trigger(&collect.sink, 3 * TRIGGER_RECORD_SIZE + 100, 2 * TRIGGER_RECORD_SIZE);
+	ck_assert_ptr_ne(sink, NULL);
+	ck_assert_int_eq(ov_sink_trigger_add(sink, &trigger), 0);
+	ck_assert_int_eq(ov_sink_open(sink, OV_SINK_PCAP, 288), 0);
+
+	for (i = 0; i < 10; ++i)
+		write_trigger_packet(sink, i, USB_PID_DATA_DATA0, (i == 5 ? OV_FLAGS_HF0_ERR : 0));
+
+	ck_assert_uint_eq(collect.count, 6);
+	for (i = 0; i < 6; ++i)
+		ck_assert_uint_eq(collect.timestamps[i], i + 2);
+
+	/* Manual trigger flushes the packets buffered since */
+	ck_assert_int_eq(ov_sink_trigger_fire(sink), 0);
+	ck_assert_uint_eq(collect.count, 8);
+	ck_assert_uint_eq(collect.timestamps[6], 8);
+	ck_assert_uint_eq(collect.timestamps[7], 9);
+
+	ov_sink_free(sink);
+}
+END_TEST
+
+START_TEST (test_sink_trigger_match) {
+	struct ov_sink* sink;
+	const uint8_t pattern[] = {0x12, 0x30};
+	const uint8_t mask[] = {0xff, 0xf0};
+	struct ov_trigger pid = {
+		.type = OV_TRIGGER_PID,
+		.pid = USB_PID_HANDSHAKE_STALL,
+	};
+	struct ov_trigger endpoint = {
+		.type = OV_TRIGGER_ENDPOINT,
+		.address = 5,
+		.endpoint = 2,
+	};
+	struct ov_trigger data = {
+		.type = OV_TRIGGER_PATTERN,
+		.pattern = pattern,
+		.mask = mask,
+		.pattern_size = sizeof(pattern),
+		.offset = OV_TRIGGER_ANY_OFFSET,
+	};
+	struct ov_packet* p = (struct ov_packet*)trigger_packet_buf;
+
+	sink = ov_sink_new_trigger(&collect.sink, 0, 0);
+	ck_assert_ptr_ne(sink, NULL);
+	ck_assert_int_eq(ov_sink_trigger_add(sink, &pid), 0);
+	ck_assert_int_eq(ov_sink_trigger_add(sink, &endpoint), 0);
+	ck_assert_int_eq(ov_sink_trigger_add(sink, &data), 0);
+	ck_assert_int_eq(ov_sink_open(sink, OV_SINK_PCAP, 288), 0);
+
+	write_trigger_packet(sink, 0, USB_PID_HANDSHAKE_ACK, 0);
+	write_trigger_packet(sink, 1, USB_PID_HANDSHAKE_STALL, 0);
+	ck_assert_uint_eq(collect.count, 1);
+
+	/* IN token to 5.2, then to 5.1 */
+	p->data[0] = USB_PID_TOKEN_IN;
+	p->data[1] = 0x05;
+	p->data[2] = 0x01;
+	p->size = 3;
+	p->timestamp = 2;
+	ck_assert_int_eq(ov_sink_write(sink, p), 0);
+	p->data[1] = 0x85;
+	p->data[2] = 0x00;
+	p->timestamp = 3;
+	ck_assert_int_eq(ov_sink_write(sink, p), 0);
+	ck_assert_uint_eq(collect.count, 2);
+	ck_assert_uint_eq(collect.timestamps[1], 2);
+
+	p->data[0] = USB_PID_DATA_DATA1;
+	p->data[1] = 0x00;
+	p->data[2] = 0x12;
+	p->data[3] = 0x3f;
+	p->size = 4;
+	p->timestamp = 4;
+	ck_assert_int_eq(ov_sink_write(sink, p), 0);
+	ck_assert_uint_eq(collect.count, 3);
+
+	ov_sink_free(sink);
+}
+END_TEST
+
+#ifndef WIN32
+static void check_aio_writer(unsigned int flags) {
+	struct aio_writer aw;
+	struct aio_buffer* buffer;
+	uint8_t data[AIO_ALIGN];
+	FILE* file;
+	size_t i;
+
+	ck_assert_int_eq(aio_writer_init(&aw, 2, AIO_ALIGN, flags), 0);
+	ck_assert_int_eq(aio_writer_open(&aw, PREFIX ".aio", 0), 0);
+
+	for (i = 0; i < 5; ++i) {
+		buffer = aio_writer_get_buffer(&aw);
+		ck_assert_ptr_ne(buffer, NULL);
+		memset(buffer->data, 'a' + i, AIO_ALIGN);
+		ck_assert_int_eq(aio_writer_submit(&aw, buffer, AIO_ALIGN), 0);
+	}
+
+	/* Unaligned tail */
+	buffer = aio_writer_get_buffer(&aw);
+	ck_assert_ptr_ne(buffer, NULL);
+	memset(buffer->data, 'z', 100);
+	ck_assert_int_eq(aio_writer_close(&aw, buffer, 100), 0);
+	ck_assert_int_eq(aio_writer_wait(&aw), 0);
+
+	aio_writer_destroy(&aw);
+
+	ck_assert_int_eq(file_size(PREFIX ".aio"), 5 * AIO_ALIGN + 100);
+
+	file = fopen(PREFIX ".aio", "rb");
+	ck_assert_ptr_ne(file, NULL);
+	for (i = 0; i < 5; ++i) {
+		ck_assert_uint_eq(fread(data, 1, AIO_ALIGN, file), AIO_ALIGN);
+		ck_assert_uint_eq(data[0], 'a' + i);
+		ck_assert_uint_eq(data[AIO_ALIGN - 1], 'a' + i);
+	}
+	ck_assert_uint_eq(fread(data, 1, AIO_ALIGN, file), 100);
+	ck_assert_uint_eq(data[99], 'z');
+	fclose(file);
+}
+
+START_TEST (test_aio_writer) {
+	check_aio_writer(0);
+	check_aio_writer(AIO_DIRECT);
+}
+END_TEST
+
+START_TEST (test_aio_writer_thread) {
+	check_aio_writer(AIO_THREAD);
+	check_aio_writer(AIO_THREAD | AIO_DIRECT);
+}
+END_TEST
+
+static void check_aio_writer_close_pending(unsigned int flags) {
+	struct aio_writer aw;
+	struct aio_buffer* buffer;
+	size_t i;
+
+	ck_assert_int_eq(aio_writer_init(&aw, 4, AIO_ALIGN, flags), 0);
+
+	/* The first file is closed with its writes still pending while the
+	 * second one is written */
+	ck_assert_int_eq(aio_writer_open(&aw, PREFIX ".aio", 0), 0);
+	for (i = 0; i < 3; ++i) {
+		buffer = aio_writer_get_buffer(&aw);
+		ck_assert_ptr_ne(buffer, NULL);
+		memset(buffer->data, 'a', AIO_ALIGN);
+		ck_assert_int_eq(aio_writer_submit(&aw, buffer, AIO_ALIGN), 0);
+	}
+	ck_assert_int_eq(aio_writer_close(&aw, NULL, 0), 0);
+
+	ck_assert_int_eq(aio_writer_open(&aw, PREFIX ".aio2", 0), 0);
+	buffer = aio_writer_get_buffer(&aw);
+	ck_assert_ptr_ne(buffer, NULL);
+	memset(buffer->data, 'b', 10);
+	ck_assert_int_eq(aio_writer_close(&aw, buffer, 10), 0);
+
+	ck_assert_int_eq(aio_writer_wait(&aw), 0);
+	aio_writer_destroy(&aw);
+
+	ck_assert_int_eq(file_size(PREFIX ".aio"), 3 * AIO_ALIGN);
+	ck_assert_int_eq(file_size(PREFIX ".aio2"), 10);
+}
+
+START_TEST (test_aio_writer_close_pending) {
+	check_aio_writer_close_pending(0);
+	check_aio_writer_close_pending(AIO_DIRECT);
+	check_aio_writer_close_pending(AIO_THREAD);
+}
+END_TEST
+
+START_TEST (test_sink_ring_async) {
+	struct ov_sink* sink;
+	struct ov_sink_segment segment;
+	uint64_t i;
+
+	sink = ov_sink_new_ring(PREFIX, 3, PCAP_FILE_HEADER_SIZE + 2 * RECORD_SIZE, 0);
+	ck_assert_ptr_ne(sink, NULL);
+	ck_assert_int_eq(ov_sink_set_async(sink, 2, OV_SINK_ASYNC_DIRECT), 0);
+	ck_assert_int_eq(ov_sink_open(sink, OV_SINK_PCAP, 288), 0);
+	ck_assert_int_eq(ov_sink_set_async(sink, 2, 0), -1);
+
+	for (i = 0; i < 7; ++i)
+		write_packet(sink, i * 1000);
+
+	ck_assert_int_eq(ov_sink_close(sink), 0);
+
+	ck_assert_int_eq(ov_sink_ring_get_segment(sink, 0, &segment), 0);
+	ck_assert_uint_eq(segment.sequence, 3);
+
+	ck_assert_int_eq(file_size(PREFIX "_0000.pcap"), PCAP_FILE_HEADER_SIZE + RECORD_SIZE);
+	ck_assert_int_eq(file_size(PREFIX "_0001.pcap"), PCAP_FILE_HEADER_SIZE + 2 * RECORD_SIZE);
+
+	ov_sink_free(sink);
+}
+END_TEST
+#endif
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+	TCase *tc_trigger;
+#ifndef WIN32
+	TCase *tc_async;
+#endif
+
+	s = suite_create("sink");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_sink_pcap_header);
+	tcase_add_test(tc_core, test_sink_ring_size);
+	tcase_add_test(tc_core, test_sink_ring_time);
+	tcase_add_test(tc_core, test_sink_ring_invalid);
+	tcase_add_test(tc_core, test_sink_skip_summary);
+	tcase_add_test(tc_core, test_sink_file_reuse);
+	suite_add_tcase(s, tc_core);
+
+	tc_trigger = tcase_create("Trigger");
+
+	tcase_add_checked_fixture(tc_trigger, setup_collect, NULL);
+	tcase_add_test(tc_trigger, test_sink_trigger_window);
+	tcase_add_test(tc_trigger, test_sink_trigger_match);
+	suite_add_tcase(s, tc_trigger);
+
+#ifndef WIN32
+	tc_async = tcase_create("Async");
+
+	tcase_add_test(tc_async, test_aio_writer);
+	tcase_add_test(tc_async, test_aio_writer_thread);
+	tcase_add_test(tc_async, test_aio_writer_close_pending);
+	tcase_add_test(tc_async, test_sink_ring_async);
+	suite_add_tcase(s, tc_async);
+#endif
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include <timestamp.h>
+
+#define NSEC_PER_SEC UINT64_C(1000000000)
+
+struct timestamp ts;
+
+START_TEST (test_timestamp_nominal) {
+	timestamp_init(&ts, OV_TIMESTAMP_MONOTONIC, 1000, 0);
+
+	ck_assert_uint_eq(timestamp_convert(&ts, 0), 1000);
+	ck_assert_uint_eq(timestamp_convert(&ts, 3), 1050);
+	ck_assert_uint_eq(timestamp_convert(&ts, OV_TIMESTAMP_FREQ_HZ), 1000 + NSEC_PER_SEC);
+}
+END_TEST
+
+START_TEST (test_timestamp_offset) {
+	timestamp_init(&ts, OV_TIMESTAMP_REALTIME, 1000, 5000);
+
+	ck_assert_uint_eq(timestamp_convert(&ts, 0), 6000);
+	ck_assert_uint_eq(timestamp_convert(&ts, 6), 6100);
+}
+END_TEST
+
+START_TEST (test_timestamp_rebase) {
+	const uint64_t hour = UINT64_C(3600) * OV_TIMESTAMP_FREQ_HZ;
+	uint64_t ns;
+
+	timestamp_init(&ts, OV_TIMESTAMP_MONOTONIC, 0, 0);
+
+	ns = timestamp_convert(&ts, hour);
+	ck_assert_uint_le(ns, UINT64_C(3600) * NSEC_PER_SEC + 100);
+	ck_assert_uint_ge(ns, UINT64_C(3600) * NSEC_PER_SEC - 100);
+	ck_assert_uint_eq(ts.anchor_ticks, hour);
+
+	ns = timestamp_convert(&ts, hour + OV_TIMESTAMP_FREQ_HZ);
+	ck_assert_uint_le(ns, UINT64_C(3601) * NSEC_PER_SEC + 100);
+	ck_assert_uint_ge(ns, UINT64_C(3601) * NSEC_PER_SEC - 100);
+}
+END_TEST
+
+START_TEST (test_timestamp_restart) {
+	const uint64_t last = 10 * OV_TIMESTAMP_FREQ_HZ;
+	struct timestamp unbroken;
+	uint64_t expected;
+
+	timestamp_init(&ts, OV_TIMESTAMP_MONOTONIC, 1000, 0);
+	timestamp_convert(&ts, last);
+
+	/* Old session ended at last, the pause is part of the next delta */
+	unbroken = ts;
+	expected = timestamp_convert(&unbroken, last + 3 * OV_TIMESTAMP_FREQ_HZ);
+
+	timestamp_restart(&ts, last);
+	ck_assert_uint_eq(ts.anchor_ticks, 0);
+	ck_assert_uint_eq(timestamp_convert(&ts, 0), 1000 + 10 * NSEC_PER_SEC);
+	ck_assert_uint_eq(timestamp_convert(&ts, 3 * OV_TIMESTAMP_FREQ_HZ), expected);
+}
+END_TEST
+
+START_TEST (test_timestamp_drift) {
+	/* Device crystal runs 100 ppm slow */
+	const double ns_per_tick = (double)NSEC_PER_SEC / OV_TIMESTAMP_FREQ_HZ * (1.0 + 100e-6);
+	uint32_t lcg = 1;
+	uint64_t prev = 0;
+	uint64_t ticks = 0;
+	uint64_t ns;
+	int64_t error;
+
+	timestamp_init(&ts, OV_TIMESTAMP_MONOTONIC, 0, 0);
+
+	/* Transfers complete every 10 ms with up to 2 ms of extra latency */
+	for (int i = 1; i <= 6000; ++i) {
+		ticks = (uint64_t)(i * 10e6 / ns_per_tick);
+		ns = timestamp_convert(&ts, ticks);
+		ck_assert_uint_ge(ns, prev);
+		prev = ns;
+
+		lcg = lcg * 1103515245 + 12345;
+		timestamp_sample(&ts, ticks, (uint64_t)(ticks * ns_per_tick) + (lcg >> 8) % 2000000);
+	}
+
+	ns = timestamp_convert(&ts, ticks);
+	error = (int64_t)(ns - (uint64_t)(ticks * ns_per_tick));
+
+	/* Without correction the error would be 6 ms */
+	ck_assert_int_lt(llabs(error), 100000);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("timestamp");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_timestamp_nominal);
+	tcase_add_test(tc_core, test_timestamp_offset);
+	tcase_add_test(tc_core, test_timestamp_rebase);
+	tcase_add_test(tc_core, test_timestamp_restart);
+	tcase_add_test(tc_core, test_timestamp_drift);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <check.h>
+#include <string.h>
+
+#include <usbstat.h>
+
+struct usbstat stat;
+
+START_TEST (test_usbstat_account) {
+	usbstat_init(&stat);
+
+	/* Outside of calls nothing is accounted */
+	usbstat_add_write(&stat, 5, 10);
+	usbstat_add_round_trip(&stat);
+
+	usbstat_begin(&stat, OV_CALL_SET_USB_SPEED);
+	usbstat_add_write(&stat, 5, 100);
+	usbstat_add_read(&stat, 0, 10);
+	usbstat_add_read(&stat, 5, 20);
+	usbstat_add_round_trip(&stat);
+	usbstat_end(&stat);
+
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].calls, 1);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].writes, 1);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].reads, 2);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].empty_reads, 1);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].round_trips, 1);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].bytes_written, 5);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].bytes_read, 5);
+	ck_assert_uint_eq(stat.calls[OV_CALL_SET_USB_SPEED].usb_ns, 130);
+	ck_assert_uint_ge(stat.calls[OV_CALL_SET_USB_SPEED].total_ns, stat.calls[OV_CALL_SET_USB_SPEED].max_ns);
+	ck_assert_ptr_eq(stat.current, NULL);
+
+	/* Adding to no stat at all is fine */
+	usbstat_add_round_trip(NULL);
+}
+END_TEST
+
+START_TEST (test_usbstat_nested) {
+	usbstat_init(&stat);
+
+	usbstat_begin(&stat, OV_CALL_OPEN);
+	usbstat_begin(&stat, OV_CALL_LOAD_FIRMWARE);
+	usbstat_add_round_trip(&stat);
+	usbstat_end(&stat);
+	usbstat_add_round_trip(&stat);
+	usbstat_end(&stat);
+
+	ck_assert_uint_eq(stat.calls[OV_CALL_OPEN].calls, 1);
+	ck_assert_uint_eq(stat.calls[OV_CALL_OPEN].round_trips, 2);
+	ck_assert_uint_eq(stat.calls[OV_CALL_LOAD_FIRMWARE].calls, 0);
+	ck_assert_uint_eq(stat.calls[OV_CALL_LOAD_FIRMWARE].round_trips, 0);
+}
+END_TEST
+
+START_TEST (test_usbstat_format) {
+	char buf[1024];
+	char small[16];
+	size_t length;
+
+	usbstat_init(&stat);
+
+	length = usbstat_format(&stat, buf, sizeof(buf));
+	ck_assert_uint_lt(length, sizeof(buf));
+	ck_assert_uint_eq(strlen(buf), length);
+	ck_assert_ptr_ne(strstr(buf, "capture_start"), NULL);
+
+	/* Truncated like snprintf() */
+	ck_assert_uint_eq(usbstat_format(&stat, small, sizeof(small)), length);
+	ck_assert_uint_eq(strlen(small), sizeof(small) - 1);
+	ck_assert_uint_eq(usbstat_format(&stat, NULL, 0), length);
+}
+END_TEST
+
+Suite* range_suite(void) {
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("usbstat");
+
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_usbstat_account);
+	tcase_add_test(tc_core, test_usbstat_nested);
+	tcase_add_test(tc_core, test_usbstat_format);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void) {
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = range_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? 0 : 1;
+}
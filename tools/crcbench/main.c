@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <openvizsla.h>
+
+/* Measures ov_packet_validate() throughput on a synthetic high-speed bulk
+ * stream: IN token, 512-byte DATA packet and ACK repeated.
+ */
+
+#define PAYLOAD_SIZE 512
+#define DEFAULT_ITERATIONS 1000000
+
+union packet {
+	struct ov_packet packet;
+	char buf[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
+};
+
+static double now(void) {
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+	static union packet token, data, ack;
+	const long iterations = (argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS);
+	double start, elapsed;
+	long damaged = 0;
+	long i;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	/* IN token to address 0, endpoint 0 */
+	token.packet.size = 3;
+	token.packet.data[0] = 0x69;
+	token.packet.data[1] = 0x00;
+	token.packet.data[2] = 0x10;
+
+	/* CRC16 is left wrong, the whole payload is processed regardless */
+	data.packet.size = PAYLOAD_SIZE + 3;
+	data.packet.data[0] = 0xc3;
+	for (i = 0; i < PAYLOAD_SIZE + 2; ++i)
+		data.packet.data[i + 1] = (uint8_t)(i * 31);
+
+	ack.packet.size = 1;
+	ack.packet.data[0] = 0xd2;
+
+	start = now();
+	for (i = 0; i < iterations; ++i) {
+		damaged += (ov_packet_validate(&token.packet) < 0);
+		damaged += (ov_packet_validate(&data.packet) < 0);
+		damaged += (ov_packet_validate(&ack.packet) < 0);
+	}
+	elapsed = now() - start;
+
+	if (elapsed <= 0)
+		elapsed = 1.0 / CLOCKS_PER_SEC;
+
+	printf("%ld packets, %ld damaged, %.3f s\n", iterations * 3, damaged, elapsed);
+	printf("%.1f Mpackets/s, %.1f MB/s of payload\n",
+		iterations * 3 / elapsed / 1e6,
+		(double)iterations * (PAYLOAD_SIZE + 2 + 3) / elapsed / 1e6);
+
+	return 0;
+}
@@ -4,16 +4,16 @@
  * SPDX-License-Identifier: MIT
  */
 
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200112L
 #include <assert.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #ifdef WIN32
 #include <io.h>
 #include <sys/stat.h>
@@ -23,6 +23,9 @@
 
 #include <openvizsla.h>
 
+#include "ring.h"
+#include "thread.h"
+
 #define EXTCAP_VERSION_STR "0.0.3"
 
 #define EXTCAP_INTERFACE_DEPRECATED "ov"
@@ -43,7 +46,20 @@ enum wireshark_version {
 #define LINKTYPE_USBLL_FULL_SPEED (294)
 #define LINKTYPE_USBLL_HIGH_SPEED (295)
 
-#define OV_TIMESTAMP_FREQ_HZ (60000000)
+#define NSEC_PER_SEC (1000000000)
+
+/* Ring capacities bound the memory used to absorb output stalls:
+ * about 4 MiB of raw packets and 1 MiB of pcap records.
+ */
+#define CAPTURE_RING_SLOTS (4096)
+#define OUTPUT_RING_SLOTS (1024)
+/* Maximum number of records written between two output flushes */
+#define OUTPUT_BATCH_SIZE (256)
+
+#define PCAP_RECORD_HEADER_SIZE (4 * sizeof(uint32_t))
+
+#define OUTPUT_EXTCAP (1 << 0)
+#define OUTPUT_DEBUG (1 << 1)
 
 /* USB packet ID is 4-bit. It is send in octet alongside complemented form.
  * The list of PIDs is available in Universal Serial Bus Specification Revision 2.0,
@@ -76,14 +92,38 @@ struct _record_list {
 	size_t record_length; /**< Size of record in bytes */
 };
 
+/** Packet handed over from the capture thread to the filter thread. */
+struct capture_record {
+	uint64_t timestamp; /**< Nanoseconds since the Epoch */
+	uint16_t size;      /**< Original packet size */
+	uint16_t incl_len;  /**< Captured packet size */
+	uint8_t data[OV_MAX_PACKET_SIZE];
+};
+
+/** Pcap record handed over from the filter thread to the writer thread. */
+struct output_record {
+	uint32_t dest;   /**< Bitmask of OUTPUT_EXTCAP and OUTPUT_DEBUG */
+	uint32_t length; /**< Size of record in bytes */
+	uint8_t record[PCAP_RECORD_HEADER_SIZE + OV_MAX_PACKET_SIZE]; /**< Pcap record header and packet data */
+};
+
+/** Capture state shared by the pipeline threads.
+ *
+ * The capture thread runs libusb event handling and only copies packets to
+ * the capture ring. The filter thread converts timestamps and runs the NAK and
+ * SOF filter. The writer thread writes batches of records to the extcap FIFO
+ * and the debug file, so a stalled reader never delays USB transfer resubmission.
+ */
 struct handler_data {
 	struct ov_device *ov;/**< Capture device */
-	FILE* out;           /**< Output file. Set to NULL if capture stopped from Wireshark (broken pipe). */
-	FILE* debug;         /**< Debug output file. NULL if not writing to debug file. */
-	uint32_t utc_ts;     /**< Seconds since epoch */
-	uint32_t ts_offset;  /**< Timestamp offset in 1/OV_TIMESTAMP_FREQ_HZ units */
-	uint64_t last_ov_ts; /**< Last received packet timestamp */
+	struct ring capture; /**< Capture thread to filter thread ring of struct capture_record */
+	struct ring output;  /**< Filter thread to writer thread ring of struct output_record */
+	volatile uint32_t stop; /**< Set by the writer thread when Wireshark stops reading */
+
+	/* Capture thread */
+	uint64_t dropped;    /**< Packets dropped because the capture ring was full */
 
+	/* Filter thread */
 	bool filter_naks; /**< True if NAKs should be filtered */
 	bool filter_sofs; /**< True if uninteresting SOFs should be filtered */
 	enum { FILTER_STATE_DEFAULT,
@@ -92,6 +132,12 @@ struct handler_data {
 	       FILTER_STATE_EXPECT_NAK,
 	} st;               /**< NAK filter Finite State Machine state */
 	record_list* queue; /**< Queue required for NAK filtering */
+	bool debug_enabled; /**< True if packets are written to debug file */
+	bool debug_pending; /**< True if current packet is still to be written to debug file */
+
+	/* Writer thread */
+	FILE* out;           /**< Output file. Set to NULL if capture stopped from Wireshark (broken pipe). */
+	FILE* debug;         /**< Debug output file. NULL if not writing to debug file. */
 };
 
 struct pcap_packet {
@@ -140,14 +186,55 @@ static void write_pcap_header(FILE** out, uint32_t linktype) {
 	flush_data(out);
 }
 
-static void write_packet(struct pcap_packet* packet, FILE** out) {
-	write_uint32(packet->ts_sec, out);
-	write_uint32(packet->ts_nsec, out);
-	write_uint32(packet->incl_len, out);
-	write_uint32(packet->orig_len, out);
+static size_t serialize_packet(struct pcap_packet* pkt, uint8_t* buffer) {
+	memcpy(buffer, &pkt->ts_sec, sizeof(uint32_t));
+	buffer += sizeof(uint32_t);
+	memcpy(buffer, &pkt->ts_nsec, sizeof(uint32_t));
+	buffer += sizeof(uint32_t);
+	memcpy(buffer, &pkt->incl_len, sizeof(uint32_t));
+	buffer += sizeof(uint32_t);
+	memcpy(buffer, &pkt->orig_len, sizeof(uint32_t));
+	buffer += sizeof(uint32_t);
+
+	memcpy(buffer, pkt->captured, pkt->incl_len);
 
-	write_data(packet->captured, packet->incl_len, out);
-	flush_data(out);
+	return PCAP_RECORD_HEADER_SIZE + pkt->incl_len;
+}
+
+static void push_record(const void* record, size_t record_length, uint32_t dest, struct handler_data* data) {
+	struct output_record* out;
+
+	if (atomic_load_u32(&data->stop)) {
+		dest &= ~OUTPUT_EXTCAP;
+	}
+
+	if (!dest) {
+		return;
+	}
+
+	/* Block while the writer thread is behind, the capture ring absorbs the stall */
+	out = (struct output_record*)ring_producer_wait_slot(&data->output);
+	out->dest = dest;
+	out->length = record_length;
+	memcpy(out->record, record, record_length);
+	ring_produce(&data->output);
+}
+
+static void push_packet(struct pcap_packet* packet, uint32_t dest, struct handler_data* data) {
+	struct output_record* out;
+
+	if (atomic_load_u32(&data->stop)) {
+		dest &= ~OUTPUT_EXTCAP;
+	}
+
+	if (!dest) {
+		return;
+	}
+
+	out = (struct output_record*)ring_producer_wait_slot(&data->output);
+	out->dest = dest;
+	out->length = serialize_packet(packet, out->record);
+	ring_produce(&data->output);
 }
 
 static void* malloc_abort_on_failure(size_t size) {
@@ -159,7 +246,7 @@ static void* malloc_abort_on_failure(size_t size) {
 }
 
 static void queue_packet(struct pcap_packet* pkt, struct handler_data* data) {
-	const size_t record_length = (4 * sizeof(uint32_t)) + pkt->incl_len;
+	const size_t record_length = PCAP_RECORD_HEADER_SIZE + pkt->incl_len;
 	uint8_t* buffer;
 	record_list** ptr;
 
@@ -174,16 +261,7 @@ static void queue_packet(struct pcap_packet* pkt, struct handler_data* data) {
 	(*ptr)->record = buffer;
 	(*ptr)->record_length = record_length;
 
-	memcpy(buffer, &pkt->ts_sec, sizeof(uint32_t));
-	buffer += sizeof(uint32_t);
-	memcpy(buffer, &pkt->ts_nsec, sizeof(uint32_t));
-	buffer += sizeof(uint32_t);
-	memcpy(buffer, &pkt->incl_len, sizeof(uint32_t));
-	buffer += sizeof(uint32_t);
-	memcpy(buffer, &pkt->orig_len, sizeof(uint32_t));
-	buffer += sizeof(uint32_t);
-
-	memcpy(buffer, pkt->captured, pkt->incl_len);
+	serialize_packet(pkt, buffer);
 }
 
 static void free_queued_packets(struct handler_data* data) {
@@ -199,8 +277,7 @@ static void free_queued_packets(struct handler_data* data) {
 
 static void forward_queued_packets(struct handler_data* data) {
 	for (record_list* ptr = data->queue; ptr; ptr = ptr->next) {
-		write_data(ptr->record, ptr->record_length, &data->out);
-		flush_data(&data->out);
+		push_record(ptr->record, ptr->record_length, OUTPUT_EXTCAP, data);
 	}
 	free_queued_packets(data);
 }
@@ -215,7 +292,9 @@ static void discard_queued_packets(struct handler_data* data) {
 }
 
 static void forward_packet(struct pcap_packet* packet, struct handler_data* data) {
-	write_packet(packet, &data->out);
+	/* Write the packet to both outputs with a single record when possible */
+	push_packet(packet, OUTPUT_EXTCAP | (data->debug_pending ? OUTPUT_DEBUG : 0), data);
+	data->debug_pending = false;
 }
 
 static void discard_packet(struct pcap_packet* packet, struct handler_data* data) {
@@ -276,120 +355,225 @@ static void filter_packet(struct pcap_packet* packet, struct handler_data* data)
 	}
 }
 
-static void packet_handler(struct ov_packet* packet, void* user_data) {
+static void process_packet(struct capture_record* rec, struct handler_data* data) {
+	/* The library converts OpenVizsla timestamps to the realtime clock */
+	struct pcap_packet pkt = {
+	    .ts_sec = rec->timestamp / NSEC_PER_SEC,
+	    .ts_nsec = rec->timestamp % NSEC_PER_SEC,
+	    .incl_len = rec->incl_len,
+	    .orig_len = rec->size,
+	    .captured = rec->data,
+	};
+
+	data->debug_pending = data->debug_enabled;
+	filter_packet(&pkt, data);
+
+	/* Debug file receives all packets, including the filtered and queued ones */
+	if (data->debug_pending) {
+		push_packet(&pkt, OUTPUT_DEBUG, data);
+		data->debug_pending = false;
+	}
+}
+
+static void* filter_thread(void* user_data) {
 	struct handler_data* data = (struct handler_data*)user_data;
-	uint32_t nsec;
-	/* Increment timestamp based on the 60 MHz 24-bit counter value.
-	 * Convert remaining clocks to nanoseconds: 1 clk = 1 / 60 MHz = 16.(6) ns
-	 */
-	uint64_t diff_ts;
-	diff_ts = packet->timestamp - data->last_ov_ts;
-	data->last_ov_ts = packet->timestamp;
-	data->utc_ts += (data->ts_offset + diff_ts) / OV_TIMESTAMP_FREQ_HZ;
-	data->ts_offset = (data->ts_offset + diff_ts) % OV_TIMESTAMP_FREQ_HZ;
-	nsec = (data->ts_offset * 17) - (data->ts_offset / 3);
+	struct capture_record* rec;
 
-	/* Only write actual USB packets */
-	if (packet->size > 0) {
-		struct pcap_packet pkt = {
-		    .ts_sec = data->utc_ts,
-		    .ts_nsec = nsec,
-		    .incl_len = ov_packet_captured_size(packet),
-		    .orig_len = packet->size,
-		    .captured = packet->data,
-		};
-
-		write_packet(&pkt, &data->debug);
-		filter_packet(&pkt, data);
-
-		/* Break out of the capture loop if output pipe breaks */
+	while ((rec = (struct capture_record*)ring_consumer_wait_slot(&data->capture))) {
+		process_packet(rec, data);
+		ring_consume(&data->capture);
+	}
+
+	discard_queued_packets(data);
+	ring_close(&data->output);
+
+	return NULL;
+}
+
+static void* writer_thread(void* user_data) {
+	struct handler_data* data = (struct handler_data*)user_data;
+	struct output_record* rec;
+
+	while ((rec = (struct output_record*)ring_consumer_wait_slot(&data->output))) {
+		size_t batch = 0;
+
+		do {
+			if (rec->dest & OUTPUT_EXTCAP) {
+				write_data(rec->record, rec->length, &data->out);
+			}
+			if (rec->dest & OUTPUT_DEBUG) {
+				write_data(rec->record, rec->length, &data->debug);
+			}
+
+			ring_consume(&data->output);
+		} while (++batch < OUTPUT_BATCH_SIZE && (rec = (struct output_record*)ring_consumer_slot(&data->output)));
+
+		flush_data(&data->out);
+		flush_data(&data->debug);
+
+		/* Tell the capture thread to break out of the loop if output pipe breaks */
 		if (!data->out) {
-			ov_capture_breakloop(data->ov);
+			atomic_store_u32(&data->stop, 1);
 		}
 	}
+
+	return NULL;
+}
+
+static void packet_handler(struct ov_packet* packet, void* user_data) {
+	struct handler_data* data = (struct handler_data*)user_data;
+	struct capture_record* rec;
+
+	if (atomic_load_u32(&data->stop)) {
+		ov_capture_breakloop(data->ov);
+		return;
+	}
+
+	/* Only write actual USB packets */
+	if (packet->size == 0) {
+		return;
+	}
+
+	/* Never block USB transfer handling, drop the packet instead */
+	rec = (struct capture_record*)ring_producer_slot(&data->capture);
+	if (!rec) {
+		data->dropped++;
+		return;
+	}
+
+	rec->timestamp = packet->timestamp;
+	rec->size = packet->size;
+	rec->incl_len = ov_packet_captured_size(packet);
+	memcpy(rec->data, packet->data, rec->incl_len);
+
+	ring_produce(&data->capture);
 }
 
 static int start_capture(enum ov_usb_speed speed, uint32_t linktype, bool filter_naks, bool filter_sofs, const char* extcap_fifo,
                          FILE* debug_pcap) {
 	int ret;
-	struct timespec ts;
+	bool started = false;
 	struct handler_data data;
+	thread_t filter, writer;
 	union {
 		struct ov_packet packet;
-		char buf[1024];
+		char buf[sizeof(struct ov_packet) + OV_MAX_PACKET_SIZE];
 	} p;
 
+	/* Owned from here on, closed on every path */
+	data.debug = debug_pcap;
+
 	data.ov = ov_new(NULL);
 	if (!data.ov) {
 		fprintf(stderr, "Cannot create ov_device handler\n");
-		return 1;
+		goto fail_ov_new;
 	}
 
 	ret = ov_open(data.ov);
 	if (ret < 0) {
 		fprintf(stderr, "%s: %s\n", "Cannot open OpenVizsla device", ov_get_error_string(data.ov));
-
-		ov_free(data.ov);
-		return 1;
+		goto fail_ov_open;
 	}
 
 	ret = ov_set_usb_speed(data.ov, speed);
 	if (ret < 0) {
 		fprintf(stderr, "%s: %s\n", "Cannot set USB speed", ov_get_error_string(data.ov));
-
-		ov_free(data.ov);
-		return 1;
+		goto fail_ov_set_usb_speed;
 	}
 
 	data.out = fopen(extcap_fifo, "wb");
 	if (!data.out) {
 		fprintf(stderr, "Cannot open fifo for writing\n");
-
-		ov_free(data.ov);
-		return 1;
+		goto fail_fopen;
 	}
-	data.debug = debug_pcap;
 
-	/* Assume OpenVizsla timestamp value 0 is the current realtime */
-#ifdef _MSC_VER
-	timespec_get(&ts, TIME_UTC);
-#else
-	clock_gettime(CLOCK_REALTIME, &ts);
-#endif
-	data.utc_ts = ts.tv_sec;
-	data.last_ov_ts = 0;
-	data.ts_offset = (ts.tv_nsec / 17) + (ts.tv_nsec / 850);
+	ret = ov_capture_set_timestamp_mode(data.ov, OV_TIMESTAMP_REALTIME);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", "Cannot set timestamp mode", ov_get_error_string(data.ov));
+		goto fail_ov_capture_set_timestamp_mode;
+	}
 
 	data.filter_naks = filter_naks;
 	data.filter_sofs = filter_sofs;
 	data.st = FILTER_STATE_DEFAULT;
 	data.queue = NULL;
+	data.debug_enabled = (debug_pcap != NULL);
+	data.debug_pending = false;
+	data.stop = 0;
+	data.dropped = 0;
 
 	/* Write pcap header */
 	write_pcap_header(&data.out, linktype);
 	write_pcap_header(&data.debug, linktype);
 
+	if (ring_init(&data.capture, sizeof(struct capture_record), CAPTURE_RING_SLOTS) < 0) {
+		fprintf(stderr, "Cannot allocate capture ring\n");
+		goto fail_capture_ring_init;
+	}
+
+	if (ring_init(&data.output, sizeof(struct output_record), OUTPUT_RING_SLOTS) < 0) {
+		fprintf(stderr, "Cannot allocate output ring\n");
+		goto fail_output_ring_init;
+	}
+
+	if (thread_create(&writer, &writer_thread, &data) < 0) {
+		fprintf(stderr, "Cannot create writer thread\n");
+		goto fail_writer_thread;
+	}
+
+	if (thread_create(&filter, &filter_thread, &data) < 0) {
+		fprintf(stderr, "Cannot create filter thread\n");
+		goto fail_filter_thread;
+	}
+
 	ret = ov_capture_start(data.ov, &p.packet, sizeof(p), &packet_handler, &data);
 	if (ret < 0) {
 		fprintf(stderr, "%s: %s\n", "Cannot start capture", ov_get_error_string(data.ov));
-
-		close_file(&data.out);
-		close_file(&data.debug);
-		ov_free(data.ov);
-		return 1;
+		ret = 1;
+	} else {
+		started = true;
+		ret = ov_capture_dispatch(data.ov, 0);
+		if (ret == -1) {
+			fprintf(stderr, "%s: %s\n", "Cannot dispatch capture", ov_get_error_string(data.ov));
+		}
 	}
 
-	ret = ov_capture_dispatch(data.ov, 0);
-	if (ret == -1) {
-		fprintf(stderr, "%s: %s\n", "Cannot dispatch capture", ov_get_error_string(data.ov));
+	/* Let the filter and writer threads drain the rings */
+	ring_close(&data.capture);
+	thread_join(filter);
+	thread_join(writer);
+
+	if (data.dropped) {
+		fprintf(stderr, "%" PRIu64 " packets dropped due to slow output\n", data.dropped);
 	}
 
-	discard_queued_packets(&data);
+	ring_destroy(&data.output);
+	ring_destroy(&data.capture);
 	close_file(&data.out);
 	close_file(&data.debug);
-	ov_capture_stop(data.ov);
+	if (started) {
+		ov_capture_stop(data.ov);
+	}
 	ov_free(data.ov);
 	return ret;
+
+fail_filter_thread:
+	ring_close(&data.output);
+	thread_join(writer);
+fail_writer_thread:
+	ring_destroy(&data.output);
+fail_output_ring_init:
+	ring_destroy(&data.capture);
+fail_capture_ring_init:
+fail_ov_capture_set_timestamp_mode:
+	close_file(&data.out);
+fail_fopen:
+fail_ov_set_usb_speed:
+fail_ov_open:
+	ov_free(data.ov);
+fail_ov_new:
+	close_file(&data.debug);
+	return 1;
 }
 
 static enum wireshark_version wireshark_version_from_string(const char* version) {
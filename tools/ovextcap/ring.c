@@ -0,0 +1,124 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include "ring.h"
+
+#include <stdlib.h>
+
+/* The timeout is only a safety net, wakeups are delivered via cond */
+#define RING_WAIT_MS 100
+
+int ring_init(struct ring* ring, size_t slot_size, uint32_t capacity) {
+	/* Capacity must be a power of two */
+	if (capacity == 0 || (capacity & (capacity - 1))) {
+		return -1;
+	}
+
+	ring->slots = malloc(slot_size * capacity);
+	if (!ring->slots) {
+		return -1;
+	}
+
+	ring->slot_size = slot_size;
+	ring->mask = capacity - 1;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->closed = 0;
+	ring->waiters = 0;
+	mutex_init(&ring->lock);
+	cond_init(&ring->cond);
+
+	return 0;
+}
+
+void ring_destroy(struct ring* ring) {
+	cond_destroy(&ring->cond);
+	mutex_destroy(&ring->lock);
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+static void ring_wakeup(struct ring* ring) {
+	if (atomic_load_u32(&ring->waiters)) {
+		mutex_lock(&ring->lock);
+		cond_broadcast(&ring->cond);
+		mutex_unlock(&ring->lock);
+	}
+}
+
+void* ring_producer_slot(struct ring* ring) {
+	const uint32_t head = ring->head;
+
+	if (head - atomic_load_u32(&ring->tail) > ring->mask) {
+		return NULL;
+	}
+
+	return ring->slots + (size_t)(head & ring->mask) * ring->slot_size;
+}
+
+void* ring_producer_wait_slot(struct ring* ring) {
+	void* slot;
+
+	while (!(slot = ring_producer_slot(ring))) {
+		mutex_lock(&ring->lock);
+		atomic_store_u32(&ring->waiters, 1);
+		if (ring->head - atomic_load_u32(&ring->tail) > ring->mask) {
+			cond_timedwait_ms(&ring->cond, &ring->lock, RING_WAIT_MS);
+		}
+		atomic_store_u32(&ring->waiters, 0);
+		mutex_unlock(&ring->lock);
+	}
+
+	return slot;
+}
+
+void ring_produce(struct ring* ring) {
+	atomic_store_u32(&ring->head, ring->head + 1);
+	ring_wakeup(ring);
+}
+
+void ring_close(struct ring* ring) {
+	atomic_store_u32(&ring->closed, 1);
+
+	mutex_lock(&ring->lock);
+	cond_broadcast(&ring->cond);
+	mutex_unlock(&ring->lock);
+}
+
+void* ring_consumer_slot(struct ring* ring) {
+	const uint32_t tail = ring->tail;
+
+	if (atomic_load_u32(&ring->head) == tail) {
+		return NULL;
+	}
+
+	return ring->slots + (size_t)(tail & ring->mask) * ring->slot_size;
+}
+
+void* ring_consumer_wait_slot(struct ring* ring) {
+	void* slot;
+
+	while (!(slot = ring_consumer_slot(ring))) {
+		/* closed is set after the last head update, so re-check emptiness */
+		if (atomic_load_u32(&ring->closed)) {
+			return ring_consumer_slot(ring);
+		}
+
+		mutex_lock(&ring->lock);
+		atomic_store_u32(&ring->waiters, 1);
+		if (atomic_load_u32(&ring->head) == ring->tail && !atomic_load_u32(&ring->closed)) {
+			cond_timedwait_ms(&ring->cond, &ring->lock, RING_WAIT_MS);
+		}
+		atomic_store_u32(&ring->waiters, 0);
+		mutex_unlock(&ring->lock);
+	}
+
+	return slot;
+}
+
+void ring_consume(struct ring* ring) {
+	atomic_store_u32(&ring->tail, ring->tail + 1);
+	ring_wakeup(ring);
+}
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _OVEXTCAP_RING_H
+#define _OVEXTCAP_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "thread.h"
+
+/** Bounded single-producer single-consumer ring of fixed-size slots.
+ *
+ * The fast path is lock-free: the producer only writes head, the consumer
+ * only writes tail. The mutex and condition variable are touched only when
+ * one side has to sleep because the ring is empty (consumer) or full
+ * (blocking producer).
+ */
+struct ring {
+	uint8_t* slots;            /**< Storage for capacity slots */
+	size_t slot_size;          /**< Size of every slot in bytes */
+	uint32_t mask;             /**< Capacity minus one, capacity is a power of two */
+	volatile uint32_t head;    /**< Free-running producer index */
+	volatile uint32_t tail;    /**< Free-running consumer index */
+	volatile uint32_t closed;  /**< Set by the producer when no more slots will be produced */
+	volatile uint32_t waiters; /**< Non-zero while one side sleeps on cond */
+	mutex_t lock;
+	cond_t cond;
+};
+
+int ring_init(struct ring* ring, size_t slot_size, uint32_t capacity);
+void ring_destroy(struct ring* ring);
+
+/** Returns a free slot or NULL when the ring is full. Never blocks. */
+void* ring_producer_slot(struct ring* ring);
+/** Returns a free slot, sleeping while the ring is full. */
+void* ring_producer_wait_slot(struct ring* ring);
+/** Publishes the slot obtained from ring_producer_slot() or ring_producer_wait_slot(). */
+void ring_produce(struct ring* ring);
+/** Marks the end of the stream and wakes the consumer. */
+void ring_close(struct ring* ring);
+
+/** Returns the oldest produced slot or NULL when the ring is empty. Never blocks. */
+void* ring_consumer_slot(struct ring* ring);
+/** Returns the oldest produced slot, sleeping while the ring is empty.
+ * Returns NULL when the ring is empty and closed. */
+void* ring_consumer_wait_slot(struct ring* ring);
+/** Releases the slot obtained from ring_consumer_slot() or ring_consumer_wait_slot(). */
+void ring_consume(struct ring* ring);
+
+#endif // _OVEXTCAP_RING_H
@@ -0,0 +1,167 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _OVEXTCAP_THREAD_H
+#define _OVEXTCAP_THREAD_H
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/* Minimal portable threading layer: POSIX threads or Win32 primitives.
+ * Atomics are limited to 32-bit loads and stores which is all the SPSC
+ * ring buffers below require.
+ */
+
+#ifdef _WIN32
+typedef HANDLE thread_t;
+typedef SRWLOCK mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+
+struct thread_start {
+	void* (*fn)(void*);
+	void* arg;
+};
+
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+	struct thread_start start = *(struct thread_start*)param;
+
+	HeapFree(GetProcessHeap(), 0, param);
+	start.fn(start.arg);
+
+	return 0;
+}
+
+static inline int thread_create(thread_t* thread, void* (*fn)(void*), void* arg) {
+	struct thread_start* start = HeapAlloc(GetProcessHeap(), 0, sizeof(struct thread_start));
+
+	if (!start)
+		return -1;
+
+	start->fn = fn;
+	start->arg = arg;
+
+	*thread = CreateThread(NULL, 0, &thread_trampoline, start, 0, NULL);
+	if (!*thread) {
+		HeapFree(GetProcessHeap(), 0, start);
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void thread_join(thread_t thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static inline void mutex_init(mutex_t* m) {
+	InitializeSRWLock(m);
+}
+
+static inline void mutex_destroy(mutex_t* m) {
+	(void)m;
+}
+
+static inline void mutex_lock(mutex_t* m) {
+	AcquireSRWLockExclusive(m);
+}
+
+static inline void mutex_unlock(mutex_t* m) {
+	ReleaseSRWLockExclusive(m);
+}
+
+static inline void cond_init(cond_t* c) {
+	InitializeConditionVariable(c);
+}
+
+static inline void cond_destroy(cond_t* c) {
+	(void)c;
+}
+
+static inline void cond_broadcast(cond_t* c) {
+	WakeAllConditionVariable(c);
+}
+
+static inline void cond_timedwait_ms(cond_t* c, mutex_t* m, unsigned int ms) {
+	SleepConditionVariableSRW(c, m, ms, 0);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t* p) {
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)p, 0, 0);
+}
+
+static inline void atomic_store_u32(volatile uint32_t* p, uint32_t v) {
+	InterlockedExchange((volatile LONG*)p, (LONG)v);
+}
+#else
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+
+static inline int thread_create(thread_t* thread, void* (*fn)(void*), void* arg) {
+	return pthread_create(thread, NULL, fn, arg) ? -1 : 0;
+}
+
+static inline void thread_join(thread_t thread) {
+	pthread_join(thread, NULL);
+}
+
+static inline void mutex_init(mutex_t* m) {
+	pthread_mutex_init(m, NULL);
+}
+
+static inline void mutex_destroy(mutex_t* m) {
+	pthread_mutex_destroy(m);
+}
+
+static inline void mutex_lock(mutex_t* m) {
+	pthread_mutex_lock(m);
+}
+
+static inline void mutex_unlock(mutex_t* m) {
+	pthread_mutex_unlock(m);
+}
+
+static inline void cond_init(cond_t* c) {
+	pthread_cond_init(c, NULL);
+}
+
+static inline void cond_destroy(cond_t* c) {
+	pthread_cond_destroy(c);
+}
+
+static inline void cond_broadcast(cond_t* c) {
+	pthread_cond_broadcast(c);
+}
+
+static inline void cond_timedwait_ms(cond_t* c, mutex_t* m, unsigned int ms) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_cond_timedwait(c, m, &ts);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t* p) {
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_store_u32(volatile uint32_t* p, uint32_t v) {
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+#endif
+
+#endif // _OVEXTCAP_THREAD_H
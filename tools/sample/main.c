@@ -32,6 +32,7 @@ int main(int argc, char** argv) {
 		struct ov_packet packet;
 		char buf[1024];
 	} p;
+	char stats[1024];
 
 	ov = ov_new(NULL);
 	if (!ov) {
@@ -74,6 +75,10 @@ int main(int argc, char** argv) {
 
 	ov_capture_stop(ov);
 
+	/* Where the time of bring-up and capture start went */
+	if (ov_format_call_stats(ov, stats, sizeof(stats)) > 0)
+		fprintf(stderr, "%s", stats);
+
 	ov_free(ov);
 
 	return 0;